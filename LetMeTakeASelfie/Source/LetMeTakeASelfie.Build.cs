@@ -20,7 +20,10 @@ namespace UnrealBuildTool.Rules
 					"SlateCore",
 					"ShaderCore",
 					"RenderCore",
-					"RHI"
+					"RHI",
+					"Sockets",
+					"Networking",
+					"ImageWrapper"
 				}
 				);
 
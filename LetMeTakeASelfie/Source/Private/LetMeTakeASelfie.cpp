@@ -11,12 +11,16 @@
 #include "RenderCore.h"
 #include "RHIStaticStates.h"
 #include "RendererInterface.h"
+#include "SelfieEncodePipeline.h"
+#include "SelfieOutputSink.h"
+#include "SelfieWebMMuxer.h"
+#include "SelfieRingDump.h"
+#include "SelfieThumbnails.h"
+#include "SelfieStaticRegions.h"
+#include "SelfieY4MDump.h"
 
 #include "vpx/vpx_encoder.h"
 #include "vpx/vp8cx.h"
-#include "vpx/video_writer.h"
-#include "vpx/webmenc.h"
-#include "libyuv/convert.h"
 #include <mmsystem.h>
 
 DEFINE_LOG_CATEGORY_STATIC(LogUTSelfie, Log, All);
@@ -259,23 +263,17 @@ void FLetMeTakeASelfie::StopAudioLoopback()
 
 FLetMeTakeASelfie::FLetMeTakeASelfie()
 {
-	SelfieWorld = nullptr;
-	bTakingAnimatedSelfie = false;
-	SelfieTimeWaited = 0;
+	SelfieIdleReleaseSeconds = 30.0f;
 	// The vpx library does not support anything besides 30hz
 	SelfieFrameRate = 30;
-	const float SelfieLength = 6.0f;
+	SelfieLength = 6.0f;
 	SelfieFrameDelay = 1.0f / SelfieFrameRate;
-	SelfieFramesMax = SelfieLength / SelfieFrameDelay;
-	SelfieDeltaTimeAccum = 0;
-	SelfieFrames = 0;
-	HeadFrame = 0;
-	bStartedAnimatedWritingTask = false;
-	bWaitingOnSelfieSurfData = false;
-	bSelfieSurfDataReady = false;
-	RecordedNumberOfScoringPlayers = 0;
-	DelayedEventWriteTimer = 0;
-	bFirstPerson = false;
+	SelfieBurstRate = 0;
+	SelfieBurstSeconds = 1.0f;
+	SelfieSlowMotionLeadIn = 0.5f;
+	bCompressSelfieRing = false;
+	SelfieRingCompressScale = 4;
+	SelfieRingKeyInterval = 8;
 
 	SelfieWidth = 1280;
 	SelfieHeight = 720;
@@ -283,10 +281,18 @@ FLetMeTakeASelfie::FLetMeTakeASelfie()
 	//SelfieHeight = 576;
 
 	bRegisteredSlateDelegate = false;
-	ReadbackTextureIndex = 0;
-	ReadbackBufferIndex = 0;
-	ReadbackBuffers[0] = nullptr;
-	ReadbackBuffers[1] = nullptr;
+	SelfieReadbackDepth = 2;
+	bExportSelfieThumbnails = true;
+	bSkipStaticRegions = true;
+	SelfieStaticBlockSAD = 64;
+	bDeferSelfieEncode = false;
+	SelfieStaticThreshold = 100;
+	Instance = this;
+
+	CaptureSessions.Init(nullptr, MaxCaptureSessions);
+
+	// Image wrappers get used from pool threads by the thumbnail export, load it up front
+	FModuleManager::Get().LoadModule(FName("ImageWrapper"));
 
 	bCapturingAudio = false;
 	MMDevice = nullptr;
@@ -297,63 +303,64 @@ FLetMeTakeASelfie::FLetMeTakeASelfie()
 	AudioDataLength = 0;
 }
 
-void FLetMeTakeASelfie::OnWorldCreated(UWorld* World, const UWorld::InitializationValues IVS)
+FSelfieCaptureSession* FLetMeTakeASelfie::GetSession(int32 PlayerIndex, bool bCreate)
 {
-	if (IsRunningCommandlet() || IsRunningDedicatedServer())
+	if (!CaptureSessions.IsValidIndex(PlayerIndex))
 	{
-		return;
+		return nullptr;
 	}
 
-	USceneCaptureComponent2D* CaptureComponent = NewObject<USceneCaptureComponent2D>();
-	CaptureComponent->UpdateBounds();
-	CaptureComponent->AddToRoot();
-	CaptureComponent->TextureTarget = NewObject<UTextureRenderTarget2D>();
-	CaptureComponent->TextureTarget->InitCustomFormat(SelfieWidth, SelfieHeight, PF_B8G8R8A8, false);
-	CaptureComponent->TextureTarget->ClearColor = FLinearColor::Black;
-	CaptureComponent->SetVisibility(false);
-	WorldToSceneCaptureComponentMap.Add(World, CaptureComponent);
-
-	if (!bRegisteredSlateDelegate)
+	if (CaptureSessions[PlayerIndex] == nullptr && bCreate)
 	{
-		FSlateRenderer* SlateRenderer = FSlateApplication::Get().GetRenderer().Get();
-		SlateRenderer->OnSlateWindowRendered().AddRaw(this, &FLetMeTakeASelfie::OnSlateWindowRenderedDuringCapture);
-		bRegisteredSlateDelegate = true;
+		CaptureSessions[PlayerIndex] = new FSelfieCaptureSession(this, PlayerIndex);
+	}
+	return CaptureSessions[PlayerIndex];
+}
 
-		// Setup readback buffer textures
-		{
-			for (int32 TextureIndex = 0; TextureIndex < 2; ++TextureIndex)
-			{
-				FRHIResourceCreateInfo CreateInfo;
-				ReadbackTextures[TextureIndex] = RHICreateTexture2D(
-					SelfieWidth,
-					SelfieHeight,
-					PF_B8G8R8A8,
-					1,
-					1,
-					TexCreate_CPUReadback,
-					CreateInfo
-					);
-			}
+int32 FLetMeTakeASelfie::GetBurstHeadroomFrames() const
+{
+	return SelfieBurstRate > SelfieFrameRate ? FMath::CeilToInt(SelfieBurstSeconds * (SelfieBurstRate - SelfieFrameRate)) : 0;
+}
 
-			ReadbackTextureIndex = 0;
+void FLetMeTakeASelfie::RequestBurst(int32 PlayerIndex)
+{
+	if (FSelfieCaptureSession* Session = GetSession(PlayerIndex))
+	{
+		Session->BeginBurst();
+	}
+}
 
-			ReadbackBuffers[0] = nullptr;
-			ReadbackBuffers[1] = nullptr;
-			ReadbackBufferIndex = 0;
+UWorld* FLetMeTakeASelfie::GetCaptureWorld() const
+{
+	for (FSelfieCaptureSession* Session : CaptureSessions)
+	{
+		if (Session && Session->SelfieWorld)
+		{
+			return Session->SelfieWorld;
 		}
 	}
+	return nullptr;
+}
 
-	if (IVS.bInitializeScenes)
+bool FLetMeTakeASelfie::IsSaving() const
+{
+	for (FSelfieCaptureSession* Session : CaptureSessions)
 	{
-		CaptureComponent->RegisterComponentWithWorld(World);
+		if (Session && Session->ActiveSave.IsValid())
+		{
+			return true;
+		}
 	}
+	return false;
+}
 
-	TArray<FColor> BlankImage;
-	BlankImage.Empty(SelfieHeight * SelfieWidth);
-	// Allocate the frames once, allocation can be very slow
-	for (int32 i = 0; SelfieSurfaceImages.Num() < SelfieFramesMax && i < SelfieFramesMax; i++)
+void FLetMeTakeASelfie::RegisterSlateDelegate()
+{
+	if (!bRegisteredSlateDelegate)
 	{
-		SelfieSurfaceImages.Add(BlankImage);
+		FSlateRenderer* SlateRenderer = FSlateApplication::Get().GetRenderer().Get();
+		SlateRenderer->OnSlateWindowRendered().AddRaw(this, &FLetMeTakeASelfie::OnSlateWindowRenderedDuringCapture);
+		bRegisteredSlateDelegate = true;
 	}
 }
 
@@ -364,25 +371,64 @@ void FLetMeTakeASelfie::OnWorldDestroyed(UWorld* World)
 		return;
 	}
 
-	USceneCaptureComponent2D* CaptureComponent = WorldToSceneCaptureComponentMap.FindChecked(World);
+	for (FSelfieCaptureSession* Session : CaptureSessions)
+	{
+		if (Session)
+		{
+			Session->OnWorldDestroyed(World);
+		}
+	}
+}
 
-	if (CaptureComponent->IsRegistered())
+/** Saves one session's ring on the encode pool */
+class FSelfieSaveWork : public IQueuedWork
+{
+public:
+	FSelfieSaveWork(FLetMeTakeASelfie* InLetMeTakeASelfie, FSelfieCaptureSession* InSession, const FSelfieSaveHandle& InTask, const FString& InRingDumpPath)
+		: LetMeTakeASelfie(InLetMeTakeASelfie)
+		, Session(InSession)
+		, Task(InTask)
+		, RingDumpPath(InRingDumpPath)
 	{
-		CaptureComponent->UnregisterComponent();
 	}
 
-	WorldToSceneCaptureComponentMap.Remove(World);
-	CaptureComponent->RemoveFromRoot();
+	virtual void DoThreadedWork() override
+	{
+		if (RingDumpPath.IsEmpty())
+		{
+			LetMeTakeASelfie->WriteWebM(*Session, *Task);
+		}
+		else
+		{
+			LetMeTakeASelfie->DumpRing(*Session, RingDumpPath, *Task);
+		}
+		delete this;
+	}
 
-	if (SelfieWorld == World)
+	virtual void Abandon() override
 	{
-		bTakingAnimatedSelfie = false;
-		RecordedNumberOfScoringPlayers = 0;
-		SelfieWorld = nullptr;
+		FSelfieSaveStats Stats;
+		Stats.Error = TEXT("Encode pool shut down");
+		Task->Finish(ESelfieSaveState::Failed, Stats);
+		delete this;
 	}
-}
 
-FWriteWebMSelfieWorker* FWriteWebMSelfieWorker::Runnable = nullptr;
+private:
+	FLetMeTakeASelfie* LetMeTakeASelfie;
+	FSelfieCaptureSession* Session;
+	FSelfieSaveHandle Task;
+	FString RingDumpPath;
+};
+
+FLetMeTakeASelfie* FLetMeTakeASelfie::Instance = nullptr;
+
+/** PLAYER=n on a console command, 0 without one */
+static int32 ParseSelfiePlayer(const TCHAR* Cmd)
+{
+	int32 PlayerIndex = 0;
+	FParse::Value(Cmd, TEXT("PLAYER="), PlayerIndex);
+	return PlayerIndex;
+}
 
 bool FLetMeTakeASelfie::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& Ar)
 {
@@ -401,541 +447,1065 @@ bool FLetMeTakeASelfie::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& A
 	}
 	else if (FParse::Command(&Cmd, TEXT("SELFIEANIM")))
 	{
-		if (bTakingAnimatedSelfie && SelfieWorld != InWorld)
+		// SELFIEANIM [FPS] [ALL | PLAYER=n] [DEPTH=n] [SPILL=seconds [HOT=seconds]], player 0 unless asked
+		const bool bFirstPerson = FParse::Command(&Cmd, TEXT("FPS"));
+		TArray<int32> PlayerIndices;
+		if (FParse::Command(&Cmd, TEXT("ALL")))
 		{
-			// Already in a different world
-			return true;
+			// Every split-screen player gets a session of their own
+			const int32 NumPlayers = FMath::Min(GEngine->GetNumGamePlayers(InWorld), (int32)MaxCaptureSessions);
+			for (int32 PlayerIndex = 0; PlayerIndex < FMath::Max(NumPlayers, 1); PlayerIndex++)
+			{
+				PlayerIndices.Add(PlayerIndex);
+			}
 		}
-
-		SelfieWorld = InWorld;
-		bTakingAnimatedSelfie = true;
-
-		if (FParse::Command(&Cmd, TEXT("FPS")))
+		else
 		{
-			bFirstPerson = true;
+			PlayerIndices.Add(ParseSelfiePlayer(Cmd));
 		}
-		else
+
+		// Optional DEPTH=n to trade latency for fewer dropped captures
+		int32 ReadbackDepth = SelfieReadbackDepth;
+		bool bNewReadbackDepth = false;
+		if (FParse::Value(Cmd, TEXT("DEPTH="), ReadbackDepth))
 		{
-			bFirstPerson = false;
+			ReadbackDepth = FMath::Clamp<int32>(ReadbackDepth, FSelfieFrameHandoff::MinDepth, FSelfieFrameHandoff::MaxDepth);
+			bNewReadbackDepth = ReadbackDepth != SelfieReadbackDepth;
+			SelfieReadbackDepth = ReadbackDepth;
 		}
 
-		USceneCaptureComponent2D* CaptureComponent = WorldToSceneCaptureComponentMap.FindChecked(InWorld);
-		if (bFirstPerson)
+		// Optional SPILL=seconds [HOT=seconds] for a longer pre-roll, only HOT seconds stay in memory and the rest
+		// goes to a memory-mapped file. SPILL=0 goes back to the all in memory ring
+		float SpillSeconds = 0;
+		const bool bResizeRing = FParse::Value(Cmd, TEXT("SPILL="), SpillSeconds);
+		float HotSeconds = 1.0f;
+		FParse::Value(Cmd, TEXT("HOT="), HotSeconds);
+
+		RegisterSlateDelegate();
+
+		for (const int32 PlayerIndex : PlayerIndices)
 		{
-			CaptureComponent->SetVisibility(false);
+			FSelfieCaptureSession* Session = GetSession(PlayerIndex, true);
+			if (Session == nullptr)
+			{
+				Ar.Logf(TEXT("No selfie session for player %d, there are %d at most"), PlayerIndex, (int32)MaxCaptureSessions);
+				continue;
+			}
+			if (Session->bTakingAnimatedSelfie && Session->SelfieWorld != InWorld)
+			{
+				// Already in a different world
+				continue;
+			}
+
+			Session->SelfieWorld = InWorld;
+			Session->bTakingAnimatedSelfie = true;
+			Session->bFirstPerson = bFirstPerson;
+			Session->EnsureCaptureResources(InWorld);
+
+			if (bNewReadbackDepth || Session->FrameHandoff.GetDepth() != SelfieReadbackDepth)
+			{
+				// Init frees every frame the handoff owns, so whatever's read back or still in flight goes into the ring
+				// first. Frames parked in the spill file or compressor get recycled into the new one when they come back
+				Session->FlushCaptureToRing();
+				Session->ConsumeReadbackFrames();
+				Session->FrameHandoff.Init(SelfieWidth, SelfieHeight, SelfieReadbackDepth);
+			}
+
+			if (bResizeRing && !Session->bStartedAnimatedWritingTask)
+			{
+				if (SpillSeconds > 0)
+				{
+					Session->ResizeRing(FMath::CeilToInt(HotSeconds * SelfieFrameRate), FMath::CeilToInt(SpillSeconds * SelfieFrameRate));
+				}
+				else
+				{
+					Session->ResizeRing(FMath::CeilToInt(SelfieLength * SelfieFrameRate), 0);
+				}
+			}
+
+			// The scene capture stays hidden, it only gets rendered on frames the scheduler samples
+			Session->CaptureComponent->SetVisibility(false);
+
+			Session->CaptureScheduler.Reset(SelfieFrameDelay);
 		}
-		else
+
+		// Nothing for the governor to cut when every session is first person, the resample is all there is
+		bool bAnyThirdPerson = false;
+		for (FSelfieCaptureSession* Session : CaptureSessions)
 		{
-			CaptureComponent->SetVisibility(true);
+			bAnyThirdPerson |= Session && Session->bTakingAnimatedSelfie && !Session->bFirstPerson;
 		}
+		CaptureGovernor.MaxLevel = bAnyThirdPerson ? FSelfieCaptureGovernor::GetNumLevels() - 1 : 0;
+		CaptureGovernor.Reset();
+		ApplyGovernorLevel();
 
 		return true;
 	}
-
-	if (FParse::Command(&Cmd, TEXT("SELFIEWRITE")))
+	else if (FParse::Command(&Cmd, TEXT("SELFIESTOP")))
 	{
-		if (!bTakingAnimatedSelfie || bStartedAnimatedWritingTask)
+		// SELFIESTOP [ALL | PLAYER=n] [IDLE=seconds] [NOW], capture resources stay around IDLE seconds in case SELFIEANIM comes straight back
+		const bool bAllPlayers = FParse::Command(&Cmd, TEXT("ALL"));
+		const int32 StopPlayerIndex = ParseSelfiePlayer(Cmd);
+		float IdleSeconds = SelfieIdleReleaseSeconds;
+		if (FParse::Value(Cmd, TEXT("IDLE="), IdleSeconds))
 		{
-			return true;
+			SelfieIdleReleaseSeconds = FMath::Max(IdleSeconds, 0.0f);
+		}
+		const bool bReleaseNow = FParse::Command(&Cmd, TEXT("NOW"));
+
+		for (FSelfieCaptureSession* Session : CaptureSessions)
+		{
+			if (Session == nullptr || (!bAllPlayers && Session->PlayerIndex != StopPlayerIndex))
+			{
+				continue;
+			}
+
+			// Frames already read back still make it into the ring
+			Session->FlushCaptureToRing();
+			Session->bTakingAnimatedSelfie = false;
+			if (Session->SegmentRecorder && SegmentRecorder.IsRecording())
+			{
+				SegmentRecorder.Stop();
+			}
+
+			if (bReleaseNow && !Session->bStartedAnimatedWritingTask && !Session->ActiveSave.IsValid())
+			{
+				Session->ReleaseCaptureResources();
+			}
+			Ar.Logf(TEXT("Selfie capture stopped for player %d, resources %s"), Session->PlayerIndex, !Session->HasCaptureResources() ? TEXT("released") :
+				SelfieIdleReleaseSeconds > 0 ? *FString::Printf(TEXT("released after %.0fs idle"), SelfieIdleReleaseSeconds) : TEXT("kept"));
 		}
-		bStartedAnimatedWritingTask = true;
-		FWriteWebMSelfieWorker::RunWorkerThread(this);
 
 		return true;
 	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIERECORD")))
+	{
+		// SELFIERECORD [PLAYER=n] [SEGMENT=seconds] starts, SELFIERECORD STOP finishes, needs SELFIEANIM running for that player to get frames
+		if (FParse::Command(&Cmd, TEXT("STOP")))
+		{
+			SegmentRecorder.Stop();
+		}
+		else if (FParse::Command(&Cmd, TEXT("STATS")))
+		{
+			SegmentRecorder.LogStats(Ar);
+		}
+		else if (!SegmentRecorder.IsRecording())
+		{
+			FSelfieCaptureSession* RecordSession = GetSession(ParseSelfiePlayer(Cmd), true);
+			if (RecordSession == nullptr)
+			{
+				return true;
+			}
 
-	return false;
-}
+			// Only the one recorder, it follows whichever session it was started for
+			for (FSelfieCaptureSession* Session : CaptureSessions)
+			{
+				if (Session)
+				{
+					Session->SegmentRecorder = Session == RecordSession ? &SegmentRecorder : nullptr;
+				}
+			}
 
-void FLetMeTakeASelfie::ReadPixelsAsync(FRenderTarget* RenderTarget)
-{
-	FIntRect InRect(0, 0, RenderTarget->GetSizeXY().X, RenderTarget->GetSizeXY().Y);
-	SelfieSurfData.Empty(RenderTarget->GetSizeXY().X * RenderTarget->GetSizeXY().Y);
-	FReadSurfaceDataFlags InFlags(RCM_UNorm, CubeFace_MAX);
-
-	// Read the render target surface data back.	
-	struct FReadSurfaceContext
-	{
-		FRenderTarget* SrcRenderTarget;
-		TArray<FColor>* OutData;
-		FIntRect Rect;
-		FReadSurfaceDataFlags Flags;
-		bool* bFinishedPtr;
-	};
-
-	FReadSurfaceContext ReadSurfaceContext =
-	{
-		RenderTarget,
-		&SelfieSurfData,
-		InRect,
-		InFlags,
-		&bSelfieSurfDataReady
-	};
-
-	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
-		ReadSurfaceCommand,
-		FReadSurfaceContext, Context, ReadSurfaceContext,
-		{
-			RHICmdList.ReadSurfaceData(
-			Context.SrcRenderTarget->GetRenderTargetTexture(),
-			Context.Rect,
-			*Context.OutData,
-			Context.Flags
-			);
-
-			*Context.bFinishedPtr = true;
-	});
-
-	bWaitingOnSelfieSurfData = true;
-}
+			float SegmentSeconds = 10.0f;
+			FParse::Value(Cmd, TEXT("SEGMENT="), SegmentSeconds);
 
-void FLetMeTakeASelfie::Tick(float DeltaTime)
-{
-	if (GIsEditor)
-	{
-		return;
+			const FString OutputDir = FPaths::ScreenShotDir() / FString::Printf(TEXT("UTSelfieMatch_%s%s"), *FDateTime::Now().ToString(), *RecordSession->GetFileSuffix());
+			SegmentRecorder.Start(OutputDir, SelfieWidth, SelfieHeight, SelfieFrameRate, SegmentSeconds);
+		}
+
+		return true;
 	}
-	
-	if (bCapturingAudio)
+	else if (FParse::Command(&Cmd, TEXT("SELFIESINK")))
 	{
-		ReadAudioLoopback();
-	}
+		// file, pipe:<name>, tcp:<port>, memory or callback, see ISelfieOutputSink::Create
+		SelfieOutputSpec = FParse::Token(Cmd, false);
+		Ar.Logf(TEXT("Selfie output: %s"), SelfieOutputSpec.IsEmpty() ? TEXT("file") : *SelfieOutputSpec);
 
-	if (SelfieTimeWaited < 0.5f)
-	{
-		SelfieTimeWaited += DeltaTime;
-		return;
+		return true;
 	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIETHUMBS")))
+	{
+		bExportSelfieThumbnails = !bExportSelfieThumbnails;
+		Ar.Logf(TEXT("Selfie thumbnails %s"), bExportSelfieThumbnails ? TEXT("on") : TEXT("off"));
 
-	if (bStartedAnimatedWritingTask)
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIEDEFER")))
 	{
-		return;
+		bDeferSelfieEncode = !bDeferSelfieEncode;
+		Ar.Logf(TEXT("Selfie saves %s"), bDeferSelfieEncode ? TEXT("write .y4m for encoding elsewhere") : TEXT("encode WebM"));
+
+		return true;
 	}
-	
-	if (DelayedEventWriteTimer > 0)
+	else if (FParse::Command(&Cmd, TEXT("SELFIESTATIC")))
 	{
-		DelayedEventWriteTimer -= DeltaTime;
-		if (DelayedEventWriteTimer < 0)
+		// SELFIESTATIC [ON|OFF] [SAD=n] [THRESH=n], SAD is per 16x16 block summed over BGRA, THRESH goes straight to libvpx
+		if (FParse::Command(&Cmd, TEXT("OFF")))
 		{
-			bStartedAnimatedWritingTask = true;
-			FWriteWebMSelfieWorker::RunWorkerThread(this);
+			bSkipStaticRegions = false;
 		}
-	}
+		else if (FParse::Command(&Cmd, TEXT("ON")))
+		{
+			bSkipStaticRegions = true;
+		}
+		int32 Value = 0;
+		if (FParse::Value(Cmd, TEXT("SAD="), Value))
+		{
+			SelfieStaticBlockSAD = FMath::Max(Value, 0);
+		}
+		if (FParse::Value(Cmd, TEXT("THRESH="), Value))
+		{
+			SelfieStaticThreshold = FMath::Max(Value, 0);
+		}
+		Ar.Logf(TEXT("Selfie static regions %s, block SAD %u, encoder threshold %u"), bSkipStaticRegions ? TEXT("on") : TEXT("off"),
+			SelfieStaticBlockSAD, SelfieStaticThreshold);
 
-	if (bWaitingOnSelfieSurfData)
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIEYUV")))
 	{
-		if (bSelfieSurfDataReady)
+		// SELFIEYUV [601|709] [FULL|LIMITED]
+		if (FParse::Command(&Cmd, TEXT("601")))
+		{
+			SelfieYUVFormat.Matrix = ESelfieYUVMatrix::BT601;
+		}
+		else if (FParse::Command(&Cmd, TEXT("709")))
 		{
-			SelfieSurfaceImages[HeadFrame] = SelfieSurfData;
+			SelfieYUVFormat.Matrix = ESelfieYUVMatrix::BT709;
+		}
+		if (FParse::Command(&Cmd, TEXT("FULL")))
+		{
+			SelfieYUVFormat.Range = ESelfieYUVRange::Full;
+		}
+		else if (FParse::Command(&Cmd, TEXT("LIMITED")))
+		{
+			SelfieYUVFormat.Range = ESelfieYUVRange::Limited;
+		}
+		Ar.Logf(TEXT("Selfie colour conversion %s, %s kernels"), *SelfieYUVFormat.ToString(), FSelfieYUV::GetSIMDName(FSelfieYUV::GetBestSIMD()));
+		if (!SelfieYUVFormat.IsVP8Native())
+		{
+			Ar.Logf(TEXT("VP8 can't signal this, WebM players will show it as BT.601 video range. Fine for .y4m dumps going somewhere that knows"));
+		}
 
-			SelfieFrames = FMath::Min(SelfieFrames + 1, SelfieFramesMax);
-			HeadFrame += 1;
-			HeadFrame %= SelfieFramesMax;
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIEGOVERNOR")))
+	{
+		// SELFIEGOVERNOR [ON|OFF] [BUDGETMS=ms] [SHARE=fraction], prints where it's at either way
+		if (FParse::Command(&Cmd, TEXT("OFF")))
+		{
+			CaptureGovernor.bEnabled = false;
+			CaptureGovernor.Reset();
+			ApplyGovernorLevel();
+		}
+		else if (FParse::Command(&Cmd, TEXT("ON")))
+		{
+			CaptureGovernor.bEnabled = true;
+		}
 
-			bWaitingOnSelfieSurfData = false;
-			bSelfieSurfDataReady = false;
+		float BudgetMs = 0;
+		if (FParse::Value(Cmd, TEXT("BUDGETMS="), BudgetMs) && BudgetMs > 0)
+		{
+			CaptureGovernor.FrameBudget = BudgetMs / 1000.0f;
 		}
+		float Share = 0;
+		if (FParse::Value(Cmd, TEXT("SHARE="), Share) && Share > 0)
+		{
+			CaptureGovernor.MaxCaptureShare = FMath::Min(Share, 1.0f);
+		}
+
+		CaptureGovernor.LogStats(Ar);
+
+		return true;
 	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIEENCODE")))
+	{
+		// SELFIEENCODE [ON|OFF] [BUDGET=fraction of a core] [THREADS=n] [CORES=2,3 or CORES=ANY] [WORKERS=n, 0 for automatic]
+		if (FParse::Command(&Cmd, TEXT("OFF")))
+		{
+			EncodeThrottle.bEnabled = false;
+		}
+		else if (FParse::Command(&Cmd, TEXT("ON")))
+		{
+			EncodeThrottle.bEnabled = true;
+		}
+
+		float Budget = 0;
+		if (FParse::Value(Cmd, TEXT("BUDGET="), Budget) && Budget > 0)
+		{
+			EncodeThrottle.CpuBudget = FMath::Min(Budget, 1.0f);
+		}
+		int32 Threads = 0;
+		if (FParse::Value(Cmd, TEXT("THREADS="), Threads) && Threads > 0)
+		{
+			EncodeThrottle.BackgroundEncoderThreads = Threads;
+		}
+		FString Cores;
+		if (FParse::Value(Cmd, TEXT("CORES="), Cores))
+		{
+			TArray<FString> CoreList;
+			Cores.ParseIntoArray(&CoreList, TEXT(","), true);
+			uint64 Mask = 0;
+			for (const FString& Core : CoreList)
+			{
+				const int32 CoreIndex = FCString::Atoi(*Core);
+				if (Core.IsNumeric() && CoreIndex >= 0 && CoreIndex < 64)
+				{
+					Mask |= (uint64)1 << CoreIndex;
+				}
+			}
+			EncodeThrottle.AffinityMask = Mask;
+		}
+		int32 Workers = 0;
+		if (FParse::Value(Cmd, TEXT("WORKERS="), Workers) && !IsSaving())
+		{
+			EncodePool.SetNumWorkers(Workers);
+		}
+
+		EncodeThrottle.LogStats(Ar);
+		EncodePool.LogStats(Ar);
 
-	if (bTakingAnimatedSelfie && SelfieWorld != nullptr)
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIEBURST")))
 	{
-		USceneCaptureComponent2D* CaptureComponent = WorldToSceneCaptureComponentMap.FindChecked(SelfieWorld);
+		// SELFIEBURST [RATE=hz] [SECONDS=s] [LEADIN=s] [OFF] to set it up, SELFIEBURST NOW [PLAYER=n] to start one by hand
+		if (FParse::Command(&Cmd, TEXT("NOW")))
+		{
+			RequestBurst(ParseSelfiePlayer(Cmd));
+			return true;
+		}
+
+		const int32 OldHeadroom = GetBurstHeadroomFrames();
+		if (FParse::Command(&Cmd, TEXT("OFF")))
+		{
+			SelfieBurstRate = 0;
+		}
+		int32 Rate = 0;
+		if (FParse::Value(Cmd, TEXT("RATE="), Rate) && Rate >= 0)
+		{
+			SelfieBurstRate = Rate;
+		}
+		float Seconds = 0;
+		if (FParse::Value(Cmd, TEXT("SECONDS="), Seconds) && Seconds > 0)
+		{
+			SelfieBurstSeconds = Seconds;
+		}
+		float LeadIn = 0;
+		if (FParse::Value(Cmd, TEXT("LEADIN="), LeadIn))
+		{
+			SelfieSlowMotionLeadIn = FMath::Max(LeadIn, 0.0f);
+		}
+
+		if (GetBurstHeadroomFrames() != OldHeadroom)
+		{
+			// Headroom is part of the ring, so it's rebuilt. Rings being saved pick it up next time they're resized
+			for (FSelfieCaptureSession* Session : CaptureSessions)
+			{
+				if (Session && Session->SelfieFrameTimes.Num() > 0 && !Session->bStartedAnimatedWritingTask)
+				{
+					Session->ResizeRing(Session->SelfieRingBaseFrames, Session->SelfieSpillFrames);
+				}
+			}
+		}
 
-		AUTPlayerController* UTPC = Cast<AUTPlayerController>(GEngine->GetFirstLocalPlayerController(SelfieWorld));
+		if (SelfieBurstRate > SelfieFrameRate)
+		{
+			Ar.Logf(TEXT("Selfie bursts at %dhz for %.1fs, %d frames of headroom, slow motion %.1fx with %.1fs lead in"), SelfieBurstRate, SelfieBurstSeconds,
+				GetBurstHeadroomFrames(), (float)SelfieBurstRate / SelfieFrameRate, SelfieSlowMotionLeadIn);
+		}
+		else
+		{
+			Ar.Logf(TEXT("Selfie bursts off, RATE= above %dhz turns them on"), SelfieFrameRate);
+		}
 
-		if (UTPC && UTPC->GetPawn())
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIECOMPRESS")))
+	{
+		// SELFIECOMPRESS [ON|OFF] [SCALE=n] [KEY=n], SCALE is how many frames the ring gets per frame of memory
+		const bool bWasCompressed = bCompressSelfieRing;
+		const int32 OldScale = SelfieRingCompressScale;
+		const int32 OldKeyInterval = SelfieRingKeyInterval;
+		if (FParse::Command(&Cmd, TEXT("OFF")))
+		{
+			bCompressSelfieRing = false;
+		}
+		else if (FParse::Command(&Cmd, TEXT("ON")))
 		{
-			APawn* Pawn = UTPC->GetPawn();
+			bCompressSelfieRing = true;
+		}
+		int32 Value = 0;
+		if (FParse::Value(Cmd, TEXT("SCALE="), Value))
+		{
+			SelfieRingCompressScale = FMath::Clamp(Value, 1, 16);
+		}
+		if (FParse::Value(Cmd, TEXT("KEY="), Value))
+		{
+			SelfieRingKeyInterval = FMath::Max(Value, 1);
+		}
 
-			// Projectile following wasn't as cool as I wanted it to be
-			/*
-			if (!FollowingProjectile.IsValid())
+		if (bCompressSelfieRing != bWasCompressed || (bCompressSelfieRing && (SelfieRingCompressScale != OldScale || SelfieRingKeyInterval != OldKeyInterval)))
+		{
+			// Same as burst headroom, rings being saved pick it up next time they're resized
+			for (FSelfieCaptureSession* Session : CaptureSessions)
 			{
-				for (TActorIterator<AUTProjectile> It(SelfieWorld); It; ++It)
+				if (Session && Session->SelfieFrameTimes.Num() > 0 && !Session->bStartedAnimatedWritingTask)
 				{
-					if (!It->bFakeClientProjectile)
-					{
-						if (It->Instigator == Pawn && !It->bExploded)
-						{
-							FollowingProjectile = *It;
-						}
-					}
+					Session->ResizeRing(Session->SelfieRingBaseFrames, Session->SelfieSpillFrames);
 				}
 			}
+		}
 
-			if (FollowingProjectile.IsValid())
+		Ar.Logf(TEXT("Selfie ring compression %s, %d frames per frame of memory, key frame every %d"), bCompressSelfieRing ? TEXT("on") : TEXT("off"),
+			SelfieRingCompressScale, SelfieRingKeyInterval);
+		for (FSelfieCaptureSession* Session : CaptureSessions)
+		{
+			if (Session && Session->SelfieSpillFrames > 0 && bCompressSelfieRing)
 			{
-				FVector NewLocation = FollowingProjectile->GetActorLocation();
-				FRotator NewRotation = FollowingProjectile->GetActorRotation();
-				NewLocation += (NewRotation.RotateVector(FVector(-200, 0, 0)));
-				CaptureComponent->SetWorldLocationAndRotation(NewLocation, NewRotation, false);
+				Ar.Logf(TEXT("Player %d has a spill file, its ring stays raw"), Session->PlayerIndex);
 			}
-			else
+			else if (Session)
 			{
-				FVector NewLocation = Pawn->GetActorLocation();
-				FRotator NewRotation = Pawn->GetActorRotation();
-				NewLocation += (NewRotation.RotateVector(FVector(200, 0, 100)));
-				NewRotation.Yaw += 180;
-				NewRotation.Pitch = -20;
-				CaptureComponent->SetWorldLocationAndRotation(NewLocation, NewRotation, false);
-			}*/
-
-			FVector NewLocation = Pawn->GetActorLocation();
-			FRotator NewRotation = Pawn->GetActorRotation();
-			NewLocation += (NewRotation.RotateVector(FVector(200, 0, 100)));
-			NewRotation.Yaw += 180;
-			NewRotation.Pitch = -20;
-			CaptureComponent->SetWorldLocationAndRotation(NewLocation, NewRotation, false);
+				Session->RingCompressor.LogStats(Ar);
+			}
 		}
 
-		SelfieDeltaTimeAccum += DeltaTime;
-
-		if (!bWaitingOnSelfieSurfData && (SelfieFrames == 0 || SelfieDeltaTimeAccum > SelfieFrameDelay))
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIEPACING")))
+	{
+		for (FSelfieCaptureSession* Session : CaptureSessions)
 		{
-			if (!bFirstPerson)
+			if (Session)
 			{
-				FRenderTarget* RenderTarget = CaptureComponent->TextureTarget->GameThread_GetRenderTargetResource();
-				ReadPixelsAsync(RenderTarget);
-				SelfieDeltaTimeAccum = 0;
+				Session->LogStats(Ar);
 			}
 		}
-				
-		// Try to autorecord if you cap the flag
-		AUTCTFGameState* GS = Cast<AUTCTFGameState>(SelfieWorld->GetGameState());
-		if (!bStartedAnimatedWritingTask && GS && UTPC->PlayerState)
+
+		return true;
+	}
+
+	if (FParse::Command(&Cmd, TEXT("SELFIEWRITE")))
+	{
+		// SELFIEWRITE [ALL | PLAYER=n], with ALL every session saves at once across the encode pool
+		if (FParse::Command(&Cmd, TEXT("ALL")))
 		{
-			if (RecordedNumberOfScoringPlayers < GS->GetScoringPlays().Num())
+			for (FSelfieCaptureSession* Session : CaptureSessions)
 			{
-				RecordedNumberOfScoringPlayers++;
-
-				if (GS->GetScoringPlays()[GS->GetScoringPlays().Num() - 1].ScoredBy.GetPlayerName() == UTPC->PlayerState->PlayerName)
+				if (Session && Session->bTakingAnimatedSelfie)
 				{
-					DelayedEventWriteTimer = 2.0f;
+					RequestSave(TEXT("Manual"), Session->PlayerIndex);
 				}
 			}
 		}
-	}
-}
+		else
+		{
+			RequestSave(TEXT("Manual"), ParseSelfiePlayer(Cmd));
+		}
 
-void FLetMeTakeASelfie::WriteWebM()
-{		
-	int32 width = SelfieWidth;
-	int32 height = SelfieHeight;
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIECANCEL")))
+	{
+		// Every save in progress
+		for (FSelfieCaptureSession* Session : CaptureSessions)
+		{
+			if (Session && Session->ActiveSave.IsValid())
+			{
+				Session->ActiveSave->Cancel();
+			}
+		}
 
-	VpxVideoInfo info = { 0 };
-	FILE* file = nullptr;
-	vpx_codec_ctx_t      codec;
-	vpx_codec_enc_cfg_t  cfg;
-	vpx_codec_err_t      res;
-	struct EbmlGlobal    ebml;
-	int                  flags = 0;
+		return true;
+	}
+	else if (FParse::Command(&Cmd, TEXT("SELFIECLIPS")))
+	{
+		// SELFIECLIPS [MAP=name] [TRIGGER=name] [DAYS=n] [LAST=n], newest first
+		FSelfieClipQuery Query;
+		Query.MaxResults = 20;
+		FParse::Value(Cmd, TEXT("MAP="), Query.MapName);
+		FParse::Value(Cmd, TEXT("TRIGGER="), Query.Trigger);
+		FParse::Value(Cmd, TEXT("LAST="), Query.MaxResults);
+		float Days = 0;
+		if (FParse::Value(Cmd, TEXT("DAYS="), Days) && Days > 0)
+		{
+			Query.Since = FDateTime::Now() - FTimespan::FromDays(Days);
+		}
 
-#define interface (vpx_codec_vp8_cx())
+		TArray<FSelfieClipRecord> Clips;
+		ClipCatalog.Query(Query, Clips);
+		Ar.Logf(TEXT("%d of %d clips"), Clips.Num(), ClipCatalog.Num());
+		for (const FSelfieClipRecord& Clip : Clips)
+		{
+			Ar.Logf(TEXT("%5d %s %-12s %-20s %5.1fs %8lldKB %dx%d@%d %dkbps %s"), Clip.Index, *Clip.Time.ToString(), *Clip.Trigger, *Clip.MapName,
+				Clip.DurationSeconds, Clip.SizeBytes / 1024, Clip.Width, Clip.Height, Clip.FrameRate, Clip.TargetBitrate, *Clip.Path);
+		}
 
-	res = vpx_codec_enc_config_default(interface, &cfg, 0);
-	if (res)
-	{
-		return;
+		return true;
 	}
-	UE_LOG(LogUTSelfie, Display, TEXT("Compressing with %s"), ANSI_TO_TCHAR(vpx_codec_iface_name(interface)));
-
-	cfg.rc_target_bitrate = width * height * cfg.rc_target_bitrate / cfg.g_w / cfg.g_h;
-	cfg.g_w = width;
-	cfg.g_h = height;
-	cfg.g_timebase.den = SelfieFrameRate;
+	else if (FParse::Command(&Cmd, TEXT("SELFIEDUMP")))
+	{
+		// Raw ring for the SelfieSweep commandlet or SELFIEDUMP Y4M for Tools/SelfieY4MEncode, keeps the ring as is
+		const bool bY4M = FParse::Command(&Cmd, TEXT("Y4M"));
+		const int32 PlayerIndex = ParseSelfiePlayer(Cmd);
+		const FSelfieCaptureSession* Session = GetSession(PlayerIndex);
+		if (bY4M)
+		{
+			RequestRingDump(GetY4MDumpPath(Session), PlayerIndex);
+		}
+		else
+		{
+			const FString Suffix = Session ? Session->GetFileSuffix() : FString();
+			RequestRingDump(FPaths::ScreenShotDir() / FString::Printf(TEXT("UTSelfieRing_%s%s.selfiering"), *FDateTime::Now().ToString(), *Suffix), PlayerIndex);
+		}
 
-#define VP8_FOURCC 0x30385056
-	info.codec_fourcc = VP8_FOURCC;
-	info.frame_width = width;
-	info.frame_height = height;
-	info.time_base.numerator = cfg.g_timebase.num;
-	info.time_base.denominator = cfg.g_timebase.den;
+		return true;
+	}
 
-	ebml.last_pts_ns = -1;
-	ebml.writer = NULL;
-	ebml.segment = NULL;
+	return false;
+}
 
-	vpx_image_t raw;
-	//if (!vpx_img_alloc(&raw, VPX_IMG_FMT_YV12, width, height, 1))
-	if (!vpx_img_alloc(&raw, VPX_IMG_FMT_I420, width, height, 1))
+bool FLetMeTakeASelfie::IsGameIdleForEncode() const
+{
+	UWorld* CaptureWorld = GetCaptureWorld();
+	if (CaptureWorld == nullptr || CaptureWorld->IsPaused())
 	{
-		return;
+		return true;
 	}
 
-	if (vpx_codec_enc_init(&codec, interface, &cfg, 0))
+	AGameState* GameState = CaptureWorld->GetGameState();
+	if (GameState && GameState->HasMatchEnded())
 	{
-		return;
+		return true;
 	}
-	
-	FString BasePath = FPaths::ScreenShotDir();
-	FString WebMPath = BasePath / TEXT("anim.webm");
-	static int32 WebMIndex = 0;
-	const int32 MaxTestWebMIndex = 65536;
-	for (int32 TestWebMIndex = WebMIndex + 1; TestWebMIndex < MaxTestWebMIndex; ++TestWebMIndex)
+
+	// UT shows the cursor whenever a menu or the scoreboard wants the mouse
+	APlayerController* PC = GEngine->GetFirstLocalPlayerController(CaptureWorld);
+	return PC == nullptr || PC->bShowMouseCursor;
+}
+
+void FLetMeTakeASelfie::ApplyGovernorLevel()
+{
+	for (FSelfieCaptureSession* Session : CaptureSessions)
 	{
-		const FString TestFileName = BasePath / FString::Printf(TEXT("UTSelfie%05i.webm"), TestWebMIndex);
-		if (IFileManager::Get().FileSize(*TestFileName) < 0)
+		if (Session)
 		{
-			WebMIndex = TestWebMIndex;
-			WebMPath = TestFileName;
-			break;
+			Session->ApplyGovernorLevel();
 		}
 	}
+}
 
-	file = fopen(TCHAR_TO_ANSI(*WebMPath), "wb");
-	ebml.stream = file;
-	struct vpx_rational framerate = cfg.g_timebase;
-	write_webm_file_header(&ebml, &cfg, &framerate, STEREO_FORMAT_MONO, VP8_FOURCC);
-	if (!file)
+void FLetMeTakeASelfie::Tick(float DeltaTime)
+{
+	if (GIsEditor)
 	{
 		return;
 	}
 
-	// write some frames
-	int32 frame_cnt = 0;
-	
-	if (SelfieFrames < SelfieFramesMax)
+	// Saves in the background need to know how the game is doing, even while capture is paused for them
+	EncodeThrottle.ReportGameFrame(DeltaTime, CaptureGovernor.FrameBudget, IsGameIdleForEncode());
+
+	// Capture state goes back before completion goes out, so a completion handler can start the next save
+	for (FSelfieCaptureSession* Session : CaptureSessions)
 	{
-		HeadFrame = 0;
+		if (Session && Session->ActiveSave.IsValid() && Session->ActiveSave->IsDone())
+		{
+			Session->FinishSave();
+		}
+	}
+	for (int32 TaskIndex = 0; TaskIndex < SaveTasks.Num(); )
+	{
+		// Hold on to it, a handler may well drop the last outside reference
+		FSelfieSaveHandle Task = SaveTasks[TaskIndex];
+		if (Task->DispatchCallbacks())
+		{
+			SaveTasks.RemoveAt(TaskIndex);
+		}
+		else
+		{
+			TaskIndex++;
+		}
 	}
 
-	for (int i = 0; i < SelfieFrames; i++)
+	// Nothing capturing, saving or recording for a while, so give the memory and GPU resources back
+	for (FSelfieCaptureSession* Session : CaptureSessions)
 	{
-		// Use libyuv to convert from ARGB to YUV
-		libyuv::ARGBToI420((const uint8*)SelfieSurfaceImages[(HeadFrame + i) % SelfieFramesMax].GetData(), width * 4,
-			raw.planes[VPX_PLANE_Y], raw.stride[VPX_PLANE_Y],
-			raw.planes[VPX_PLANE_U], raw.stride[VPX_PLANE_U],
-			raw.planes[VPX_PLANE_V], raw.stride[VPX_PLANE_V], width, height);
+		if (Session == nullptr)
+		{
+			continue;
+		}
 
-		vpx_codec_encode(&codec, &raw, frame_cnt, 1, flags, VPX_DL_GOOD_QUALITY);
-		vpx_codec_iter_t iter = NULL;
-		const vpx_codec_cx_pkt_t *pkt;
-		while ((pkt = vpx_codec_get_cx_data(&codec, &iter)) != NULL)
+		const bool bRecording = Session->SegmentRecorder && Session->SegmentRecorder->IsRecording();
+		if (!Session->bTakingAnimatedSelfie && !Session->bStartedAnimatedWritingTask && !Session->ActiveSave.IsValid() && !bRecording && Session->HasCaptureResources())
 		{
-			switch (pkt->kind) 
+			Session->CaptureIdleTime += DeltaTime;
+			if (SelfieIdleReleaseSeconds > 0 && Session->CaptureIdleTime >= SelfieIdleReleaseSeconds)
 			{
-			case VPX_CODEC_CX_FRAME_PKT: 
-				write_webm_block(&ebml, &cfg, pkt);
-				break;                                                    
-			default:
-				break;
+				Session->ReleaseCaptureResources();
 			}
 		}
-		frame_cnt++;
+		else
+		{
+			Session->CaptureIdleTime = 0;
+		}
+	}
+	
+	if (bCapturingAudio)
+	{
+		ReadAudioLoopback();
 	}
 
-	UE_LOG(LogUTSelfie, Display, TEXT("Writing complete"));
-
-	// write final frame
-	vpx_codec_encode(&codec, nullptr, frame_cnt, 1, flags, VPX_DL_GOOD_QUALITY);
-	vpx_codec_iter_t iter = NULL;
-	const vpx_codec_cx_pkt_t *pkt;
-	pkt = vpx_codec_get_cx_data(&codec, &iter);
-	while ((pkt = vpx_codec_get_cx_data(&codec, &iter)) != NULL)
+	// One governor for every session, it's the one frame they're all paying for.
+	// Whatever capture cost during the frame that just finished shows up in this DeltaTime
+	bool bAnyCapturing = false;
+	bool bCapturedSinceLastTick = false;
+	double CaptureWorkSeconds = 0;
+	for (FSelfieCaptureSession* Session : CaptureSessions)
 	{
-		switch (pkt->kind)
+		if (Session)
 		{
-		case VPX_CODEC_CX_FRAME_PKT:
-			write_webm_block(&ebml, &cfg, pkt);
-			break;
-		default:
-			break;
+			bAnyCapturing |= Session->bTakingAnimatedSelfie && !Session->bStartedAnimatedWritingTask;
+			bCapturedSinceLastTick |= Session->bCapturedSinceLastTick;
+			CaptureWorkSeconds += Session->CaptureWorkSeconds;
+			Session->bCapturedSinceLastTick = false;
+			Session->CaptureWorkSeconds = 0;
 		}
 	}
-
-	vpx_img_free(&raw);                                                       //
-	if (vpx_codec_destroy(&codec))
+	if (bAnyCapturing && CaptureGovernor.Update(DeltaTime, bCapturedSinceLastTick, CaptureWorkSeconds))
 	{
-		// failed to destroy
+		ApplyGovernorLevel();
 	}
 
-	write_webm_file_footer(&ebml);
+	for (FSelfieCaptureSession* Session : CaptureSessions)
+	{
+		if (Session)
+		{
+			Session->Tick(DeltaTime);
+		}
+	}
+}
 
-	UE_LOG(LogUTSelfie, Display, TEXT("Closing file"));
-	fclose(file);
+FSelfieSaveHandle FLetMeTakeASelfie::RequestSave(const FString& Trigger, int32 PlayerIndex)
+{
+	// Still a save as far as the ring goes, it just leaves the encoding to someone else
+	FSelfieCaptureSession* Session = GetSession(PlayerIndex);
+	return StartSaveTask(Session, Trigger, bDeferSelfieEncode ? GetY4MDumpPath(Session) : FString(), false);
+}
 
-	SelfieTimeWaited = 0;
-	bStartedAnimatedWritingTask = false;
-	SelfieFrames = 0;
+FSelfieSaveHandle FLetMeTakeASelfie::RequestRingDump(const FString& DumpPath, int32 PlayerIndex)
+{
+	return StartSaveTask(GetSession(PlayerIndex), TEXT("Dump"), DumpPath, true);
+}
 
-	UE_LOG(LogUTSelfie, Display, TEXT("Selfie complete! %s"), *WebMPath);
+FString FLetMeTakeASelfie::GetY4MDumpPath(const FSelfieCaptureSession* Session) const
+{
+	const FString Suffix = Session ? Session->GetFileSuffix() : FString();
+	return FPaths::ScreenShotDir() / FString::Printf(TEXT("UTSelfieRaw_%s%s.y4m"), *FDateTime::Now().ToString(), *Suffix);
 }
 
-// Borrowed from GameLiveStreaming.cpp
-void FLetMeTakeASelfie::OnSlateWindowRenderedDuringCapture(SWindow& SlateWindow, void* ViewportRHIPtr)
+FSelfieSaveHandle FLetMeTakeASelfie::StartSaveTask(FSelfieCaptureSession* Session, const FString& Trigger, const FString& RingDumpPath, bool bIsDump)
 {
-	UGameViewportClient* GameViewportClient = GEngine->GameViewport;
-	if (!bStartedAnimatedWritingTask && bTakingAnimatedSelfie && bFirstPerson && GameViewportClient != nullptr)
+	FSelfieSaveHandle Task = MakeShareable(new FSelfieSaveTask(Trigger));
+	SaveTasks.Add(Task);
+
+	FSelfieSaveStats FailedStats;
+	if (Session == nullptr || !Session->bTakingAnimatedSelfie)
+	{
+		FailedStats.Error = TEXT("Not capturing, SELFIEANIM starts it");
+	}
+	else if (Session->bStartedAnimatedWritingTask || Session->ActiveSave.IsValid())
 	{
-		if (GameViewportClient->GetWindow() == SlateWindow.AsShared())
+		FailedStats.Error = TEXT("Already saving");
+	}
+	else
+	{
+		// Get whatever is still in flight into the ring first
+		Session->FlushCaptureToRing();
+		if (Session->GetSavedFrameCount() == 0)
 		{
-			if (SelfieDeltaTimeAccum > SelfieFrameDelay)
-			{
-				CopyCurrentFrameToSavedFrames();
-
-				const FViewportRHIRef* ViewportRHI = (const FViewportRHIRef*)ViewportRHIPtr;
-				StartCopyingNextGameFrame(*ViewportRHI);
-				SelfieDeltaTimeAccum = 0;
-			}
+			FailedStats.Error = TEXT("Nothing captured yet");
 		}
 	}
+
+	if (!FailedStats.Error.IsEmpty())
+	{
+		UE_LOG(LogUTSelfie, Warning, TEXT("Selfie %s not started: %s"), *Trigger, *FailedStats.Error);
+		Task->Finish(ESelfieSaveState::Failed, FailedStats);
+		return Task;
+	}
+
+	Session->SelfieSaveMapName = Session->SelfieWorld ? Session->SelfieWorld->GetMapName() : FString();
+
+	Session->ActiveSave = Task;
+	Session->bActiveSaveIsDump = bIsDump;
+	Session->bStartedAnimatedWritingTask = true;
+	// Queued on the session's own worker, an idle one steals it if that one's busy with another player's save
+	EncodePool.Submit(new FSelfieSaveWork(this, Session, Task, RingDumpPath), Session->PlayerIndex);
+
+	return Task;
 }
 
-void FLetMeTakeASelfie::CopyCurrentFrameToSavedFrames()
-{
-	if (ReadbackBuffers[ReadbackBufferIndex] != nullptr)
+void FLetMeTakeASelfie::WriteWebM(FSelfieCaptureSession& Session, FSelfieSaveTask& Task)
+{		
+	int32 width = SelfieWidth;
+	int32 height = SelfieHeight;
+
+	vpx_codec_ctx_t      codec;
+	vpx_codec_enc_cfg_t  cfg;
+
+	FSelfieSaveStats Stats;
+
+#define interface (vpx_codec_vp8_cx())
+
+	if (!FSelfieEncodePipeline::InitConfig(cfg, width, height, SelfieFrameRate))
+	{
+		Stats.Error = TEXT("Bad encoder config");
+		Task.Finish(ESelfieSaveState::Failed, Stats);
+		return;
+	}
+	UE_LOG(LogUTSelfie, Display, TEXT("Compressing with %s"), ANSI_TO_TCHAR(vpx_codec_iface_name(interface)));
+
+	// Fewer encoder threads while a match is on, decided once per save since libvpx can't change it mid stream.
+	// Split between however many saves are encoding so they don't oversubscribe the cores between them,
+	// this one isn't counted until its pipeline starts
+	cfg.g_threads = FMath::Max(EncodeThrottle.GetEncoderThreads() / (EncodeThrottle.GetActiveEncodes() + 1), 1);
+
+	if (vpx_codec_enc_init(&codec, interface, &cfg, 0))
+	{
+		Stats.Error = TEXT("Couldn't start the encoder");
+		Task.Finish(ESelfieSaveState::Failed, Stats);
+		return;
+	}
+	if (bSkipStaticRegions)
+	{
+		vpx_codec_control(&codec, VP8E_SET_STATIC_THRESHOLD, SelfieStaticThreshold);
+	}
+	
+	// Numbers come from the catalog, no probing the directory for a free name
+	int32 ClipIndex = ClipCatalog.ReserveIndex();
+	FString WebMPath = FPaths::ScreenShotDir() / FSelfieClipCatalog::GetClipFileName(ClipIndex) + TEXT(".webm");
+
+	ISelfieOutputSink* Sink = ISelfieOutputSink::Create(SelfieOutputSpec, WebMPath, SelfieOutputCallback, &Session.SelfieMemoryClip);
+	// The file sink won't write over an existing clip, something else put one there since the catalog loaded so take the next number
+	const bool bFileOutput = SelfieOutputSpec.IsEmpty() || SelfieOutputSpec == TEXT("file");
+	for (int32 Attempt = 0; Sink == nullptr && bFileOutput && Attempt < 100 && IFileManager::Get().FileSize(*WebMPath) >= 0; Attempt++)
+	{
+		UE_LOG(LogUTSelfie, Warning, TEXT("%s already exists, skipping clip number %d"), *WebMPath, ClipIndex);
+		ClipIndex = ClipCatalog.ReserveIndex();
+		WebMPath = FPaths::ScreenShotDir() / FSelfieClipCatalog::GetClipFileName(ClipIndex) + TEXT(".webm");
+		Sink = ISelfieOutputSink::Create(SelfieOutputSpec, WebMPath, SelfieOutputCallback, &Session.SelfieMemoryClip);
+	}
+	if (Sink == nullptr)
+	{
+		UE_LOG(LogUTSelfie, Warning, TEXT("Couldn't open selfie output %s"), *SelfieOutputSpec);
+		vpx_codec_destroy(&codec);
+		Stats.Error = FString::Printf(TEXT("Couldn't open selfie output %s"), *WebMPath);
+		Task.Finish(ESelfieSaveState::Failed, Stats);
+		return;
+	}
+	// Thumbnails always go to disk, named after the clip even when the clip itself goes elsewhere
+	const FString ThumbnailBasePath = FPaths::GetPath(WebMPath) / FPaths::GetBaseFilename(WebMPath);
+	WebMPath = Sink->Describe();
+
+	FSelfieWebMMuxer Muxer(Sink);
+	if (!Muxer.Begin(cfg))
 	{
-		// Have a new buffer from the GPU
-		int i = 0;
+		UE_LOG(LogUTSelfie, Warning, TEXT("Couldn't write the WebM header to %s"), *WebMPath);
+		vpx_codec_destroy(&codec);
+		Sink->Close();
+		delete Sink;
+		Stats.Error = TEXT("Output failed");
+		Task.Finish(ESelfieSaveState::Failed, Stats);
+		return;
+	}
+
+	// Oldest frame first, put back afterwards in case the ring outlives this save
+	Session.BeginReadRing();
 
-		if (SelfieSurfaceImages[HeadFrame].Num() < SelfieHeight*SelfieWidth)
+	// Burst frames are in the ring at a higher rate, the clip gets them thinned back to real time and the slowed down copy gets all of them
+	TArray<double> FrameTimes;
+	FrameTimes.Empty(Session.GetSavedFrameCount());
+	for (int32 FrameIndex = 0; FrameIndex < Session.GetSavedFrameCount(); FrameIndex++)
+	{
+		FrameTimes.Add(Session.GetSavedFrameTime(FrameIndex));
+	}
+	FSelfieFrameSelection RealTime(FSelfieGetSourceFrame::CreateRaw(&Session, &FSelfieCaptureSession::GetSavedFrame));
+	Session.BurstTimeline.PlanRealTime(FrameTimes, SelfieFrameDelay, RealTime.Frames);
+	FSelfieFrameSelection SlowMotion(RealTime.Source);
+	TArray<double> SlowMotionPlayTimes;
+	Session.BurstTimeline.PlanSlowMotion(FrameTimes, SelfieSlowMotionLeadIn, (float)SelfieBurstRate / SelfieFrameRate, SlowMotion.Frames, SlowMotionPlayTimes);
+
+	const int32 NumSavedFrames = RealTime.Frames.Num();
+	Task.Begin(NumSavedFrames + SlowMotion.Frames.Num());
+
+	// Reads the same ring frames as the encoder, nothing writes to the ring until the save finishes
+	FSelfieFrameSelection ThumbnailFrames(FSelfieGetSourceFrame::CreateRaw(&Session, &FSelfieCaptureSession::GetSavedThumbnailFrame));
+	ThumbnailFrames.Frames = RealTime.Frames;
+	FSelfieThumbnailExport Thumbnails(ThumbnailBasePath, width, height, NumSavedFrames, ThumbnailFrames.AsSource());
+	if (bExportSelfieThumbnails)
+	{
+		Thumbnails.Start();
+	}
+
+	// Conversion runs on worker threads ahead of the encoder and muxing runs behind it
+	FSelfieEncodePipeline Pipeline(&codec, width, height, VPX_DL_GOOD_QUALITY);
+	// Counted again, reading the ring takes long enough for other saves to have started or finished
+	const int32 NumConcurrentSaves = EncodeThrottle.GetActiveEncodes() + 1;
+	Pipeline.NumConvertWorkers = EncodeThrottle.IsFullSpeed() ? FMath::Clamp((FPlatformMisc::NumberOfCores() - 2) / NumConcurrentSaves, 1, 2) : 1;
+	Pipeline.Throttle = &EncodeThrottle;
+	Pipeline.YUVFormat = SelfieYUVFormat;
+	// Active maps line up with the frame passed in because the default config has no lag
+	FSelfieStaticRegions StaticRegions(width, height);
+	StaticRegions.BlockSADThreshold = SelfieStaticBlockSAD;
+	if (bSkipStaticRegions)
+	{
+		Pipeline.StaticRegions = &StaticRegions;
+	}
+	const bool bEncoded = Pipeline.Run(NumSavedFrames,
+		RealTime.AsSource(),
+		FSelfieMuxPacket::CreateRaw(&Muxer, &FSelfieWebMMuxer::WriteBlock),
+		FSelfieEncodeProgress::CreateRaw(&Task, &FSelfieSaveTask::ReportProgress));
+
+	UE_LOG(LogUTSelfie, Display, TEXT("Writing complete, %d frames in %.2fs (%.2fs encoding)%s"), NumSavedFrames, Pipeline.TotalSeconds, Pipeline.EncodeSeconds,
+		Pipeline.bCancelled ? TEXT(", cancelled") : Pipeline.bMuxFailed ? TEXT(", output failed") : bEncoded ? TEXT("") : TEXT(", encoder failed"));
+	if (bSkipStaticRegions)
+	{
+		UE_LOG(LogUTSelfie, Display, TEXT("%.1f%% of macroblocks skipped as static"), StaticRegions.GetStaticShare() * 100.0f);
+	}
+
+	if (vpx_codec_destroy(&codec))
+	{
+		// failed to destroy
+	}
+
+	const bool bMuxed = Muxer.Finish();
+
+	Thumbnails.Wait();
+
+	UE_LOG(LogUTSelfie, Display, TEXT("Closing file"));
+	Sink->Close();
+	delete Sink;
+
+	FString SlowMotionPath;
+	if (bEncoded && bMuxed && SlowMotion.Frames.Num() > 0)
+	{
+		// Always a file like the thumbnails, whatever the clip went to
+		SlowMotionPath = ThumbnailBasePath + TEXT("_slowmo.webm");
+		if (!WriteSlowMotion(SlowMotion, SlowMotionPlayTimes, SlowMotionPath, cfg, Pipeline.NumConvertWorkers, Task))
 		{
-			SelfieSurfaceImages[HeadFrame].Empty();
-			SelfieSurfaceImages[HeadFrame].AddZeroed(SelfieHeight*SelfieWidth);
+			// The clip itself is done, cancelling now only drops the slowed down copy
+			UE_LOG(LogUTSelfie, Warning, TEXT("Slow motion %s %s"), *SlowMotionPath, Task.IsCancelRequested() ? TEXT("cancelled") : TEXT("failed"));
+			SlowMotionPath.Empty();
 		}
-		for (int y = 0; y < SelfieHeight; y++)
-		for (int x = 0; x < SelfieWidth; x++)
-		{
-			FColor& SurfData = ((FColor*)ReadbackBuffers[ReadbackBufferIndex])[i];
+	}
 
-			SelfieSurfaceImages[HeadFrame][i] = SurfData;
+	Session.EndReadRing();
 
-			i++;
+	Stats.Path = WebMPath;
+	Stats.ClipIndex = ClipIndex;
+	Stats.NumFrames = NumSavedFrames;
+	Stats.SlowMotionPath = SlowMotionPath;
+	Stats.DurationSeconds = (float)NumSavedFrames / SelfieFrameRate;
+	Stats.SizeBytes = Muxer.GetBytesWritten();
+	Stats.SizeKB = (int32)(Stats.SizeBytes / 1024);
+	Stats.EncodeSeconds = Pipeline.EncodeSeconds;
+	Stats.TotalSeconds = Pipeline.TotalSeconds;
+
+	if (Pipeline.bCancelled || !bEncoded || !bMuxed)
+	{
+		// Half a clip is no use to anyone, cancelled or not
+		if (SelfieOutputSpec.IsEmpty() || SelfieOutputSpec == TEXT("file"))
+		{
+			IFileManager::Get().Delete(*WebMPath);
 		}
-		SelfieFrames = FMath::Min(SelfieFrames + 1, SelfieFramesMax);
-		HeadFrame += 1;
-		HeadFrame %= SelfieFramesMax;
+		Thumbnails.DeleteOutputs();
+	}
 
-		// Unmap the buffer now that we've pushed out the frame
+	if (Pipeline.bCancelled)
+	{
+		UE_LOG(LogUTSelfie, Display, TEXT("Selfie cancelled after %d of %d frames"), Task.GetFramesEncoded(), NumSavedFrames);
+		Task.Finish(ESelfieSaveState::Cancelled, Stats);
+	}
+	else if (!bEncoded || !bMuxed)
+	{
+		UE_LOG(LogUTSelfie, Warning, TEXT("Selfie output failed while writing to %s"), *WebMPath);
+		Stats.Error = (bEncoded || Pipeline.bMuxFailed) ? TEXT("Output failed") : TEXT("Encoder failed");
+		Task.Finish(ESelfieSaveState::Failed, Stats);
+	}
+	else
+	{
+		FSelfieClipRecord Record;
+		Record.Index = ClipIndex;
+		Record.Time = FDateTime::Now();
+		Record.MapName = Session.SelfieSaveMapName;
+		Record.Trigger = Task.GetTrigger();
+		Record.Path = WebMPath;
+		Record.NumFrames = NumSavedFrames;
+		Record.DurationSeconds = (float)NumSavedFrames / SelfieFrameRate;
+		Record.SizeBytes = Muxer.GetBytesWritten();
+		Record.Codec = ANSI_TO_TCHAR(vpx_codec_iface_name(interface));
+		Record.Width = width;
+		Record.Height = height;
+		Record.FrameRate = SelfieFrameRate;
+		Record.TargetBitrate = cfg.rc_target_bitrate;
+		Record.Deadline = VPX_DL_GOOD_QUALITY;
+		if (!ClipCatalog.AddClip(Record))
 		{
-			struct FReadbackFromStagingBufferContext
-			{
-				FLetMeTakeASelfie* This;
-			};
-			FReadbackFromStagingBufferContext ReadbackFromStagingBufferContext =
-			{
-				this
-			};
-			ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
-				ReadbackFromStagingBuffer,
-				FReadbackFromStagingBufferContext, Context, ReadbackFromStagingBufferContext,
-				{
-				RHICmdList.UnmapStagingSurface(Context.This->ReadbackTextures[Context.This->ReadbackTextureIndex]);
-			});
+			UE_LOG(LogUTSelfie, Warning, TEXT("Couldn't add %s to the clip catalog"), *WebMPath);
 		}
+
+		UE_LOG(LogUTSelfie, Display, TEXT("Selfie complete! %s"), *WebMPath);
+		Task.Finish(ESelfieSaveState::Succeeded, Stats);
 	}
 }
 
-void FLetMeTakeASelfie::StartCopyingNextGameFrame(const FViewportRHIRef& ViewportRHI)
+/** Slow motion progress counts on from the clip's frames */
+struct FSelfieSlowMotionProgress
 {
-	const FIntPoint ResizeTo(SelfieWidth, SelfieHeight);
+	FSelfieSaveTask* Task;
+	int32 FramesBefore;
 
-	static const FName RendererModuleName("Renderer");
-	IRendererModule& RendererModule = FModuleManager::GetModuleChecked<IRendererModule>(RendererModuleName);
-
-	UGameViewportClient* GameViewportClient = GEngine->GameViewport;
-	check(GameViewportClient != nullptr);
+	bool Report(int32 FramesEncoded)
+	{
+		return Task->ReportProgress(FramesBefore + FramesEncoded);
+	}
+};
 
-	struct FCopyVideoFrame
+bool FLetMeTakeASelfie::WriteSlowMotion(FSelfieFrameSelection& Frames, const TArray<double>& PlayTimes, const FString& Path, const vpx_codec_enc_cfg_t& Cfg, int32 NumConvertWorkers, FSelfieSaveTask& Task)
+{
+	// A stream of its own, frames go on the tick nearest where PlayTimes puts them
+	vpx_codec_ctx_t Codec;
+	if (vpx_codec_enc_init(&Codec, interface, &Cfg, 0))
 	{
-		FViewportRHIRef ViewportRHI;
-		IRendererModule* RendererModule;
-		FIntPoint ResizeTo;
-		FLetMeTakeASelfie* This;
-	};
-	FCopyVideoFrame CopyVideoFrame =
+		return false;
+	}
+	if (bSkipStaticRegions)
 	{
-		ViewportRHI,
-		&RendererModule,
-		ResizeTo,
-		this
-	};
-
-	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
-		ReadSurfaceCommand,
-		FCopyVideoFrame, Context, CopyVideoFrame,
-		{
-		FPooledRenderTargetDesc OutputDesc(FPooledRenderTargetDesc::Create2DDesc(Context.ResizeTo, PF_B8G8R8A8, TexCreate_None, TexCreate_RenderTargetable, false));
-
-		const auto FeatureLevel = GMaxRHIFeatureLevel;
-
-		TRefCountPtr<IPooledRenderTarget> ResampleTexturePooledRenderTarget;
-		Context.RendererModule->RenderTargetPoolFindFreeElement(OutputDesc, ResampleTexturePooledRenderTarget, TEXT("ResampleTexture"));
-		check(ResampleTexturePooledRenderTarget);
+		vpx_codec_control(&Codec, VP8E_SET_STATIC_THRESHOLD, SelfieStaticThreshold);
+	}
 
-		const FSceneRenderTargetItem& DestRenderTarget = ResampleTexturePooledRenderTarget->GetRenderTargetItem();
+	FSelfieFileSink Sink(Path);
+	if (!Sink.IsOpen())
+	{
+		vpx_codec_destroy(&Codec);
+		return false;
+	}
+	FSelfieWebMMuxer Muxer(&Sink);
+	if (!Muxer.Begin(Cfg))
+	{
+		vpx_codec_destroy(&Codec);
+		Sink.Close();
+		IFileManager::Get().Delete(*Path);
+		return false;
+	}
 
-		SetRenderTarget(RHICmdList, DestRenderTarget.TargetableTexture, FTextureRHIRef());
-		RHICmdList.SetViewport(0, 0, 0.0f, Context.ResizeTo.X, Context.ResizeTo.Y, 1.0f);
+	FSelfieEncodePipeline Pipeline(&Codec, SelfieWidth, SelfieHeight, VPX_DL_GOOD_QUALITY);
+	Pipeline.NumConvertWorkers = NumConvertWorkers;
+	Pipeline.Throttle = &EncodeThrottle;
+	Pipeline.YUVFormat = SelfieYUVFormat;
+	Pipeline.FramePts.Empty(PlayTimes.Num());
+	for (const double PlayTime : PlayTimes)
+	{
+		const int64 Pts = FMath::RoundToInt(PlayTime * Cfg.g_timebase.den / Cfg.g_timebase.num);
+		Pipeline.FramePts.Add(Pipeline.FramePts.Num() > 0 ? FMath::Max(Pts, Pipeline.FramePts.Last() + 1) : Pts);
+	}
+	FSelfieStaticRegions StaticRegions(SelfieWidth, SelfieHeight);
+	StaticRegions.BlockSADThreshold = SelfieStaticBlockSAD;
+	if (bSkipStaticRegions)
+	{
+		Pipeline.StaticRegions = &StaticRegions;
+	}
+	FSelfieSlowMotionProgress Progress = { &Task, Task.GetFramesEncoded() };
+	const bool bEncoded = Pipeline.Run(Frames.Frames.Num(), Frames.AsSource(),
+		FSelfieMuxPacket::CreateRaw(&Muxer, &FSelfieWebMMuxer::WriteBlock),
+		FSelfieEncodeProgress::CreateRaw(&Progress, &FSelfieSlowMotionProgress::Report));
 
-		RHICmdList.SetBlendState(TStaticBlendState<>::GetRHI());
-		RHICmdList.SetRasterizerState(TStaticRasterizerState<>::GetRHI());
-		RHICmdList.SetDepthStencilState(TStaticDepthStencilState<false, CF_Always>::GetRHI());
+	vpx_codec_destroy(&Codec);
+	const bool bMuxed = Muxer.Finish();
+	Sink.Close();
 
-		FTexture2DRHIRef ViewportBackBuffer = RHICmdList.GetViewportBackBuffer(Context.ViewportRHI);
+	UE_LOG(LogUTSelfie, Display, TEXT("Slow motion %d frames in %.2fs"), Frames.Frames.Num(), Pipeline.TotalSeconds);
+	if (!bEncoded || !bMuxed)
+	{
+		IFileManager::Get().Delete(*Path);
+		return false;
+	}
+	return true;
+}
 
-		auto ShaderMap = GetGlobalShaderMap(FeatureLevel);
-		TShaderMapRef<FScreenVS> VertexShader(ShaderMap);
-		TShaderMapRef<FScreenPS> PixelShader(ShaderMap);
+void FLetMeTakeASelfie::DumpRing(FSelfieCaptureSession& Session, const FString& DumpPath, FSelfieSaveTask& Task)
+{
+	Session.BeginReadRing();
 
-		static FGlobalBoundShaderState BoundShaderState;
-		SetGlobalBoundShaderState(RHICmdList, FeatureLevel, BoundShaderState, Context.RendererModule->GetFilterVertexDeclaration().VertexDeclarationRHI, *VertexShader, *PixelShader);
+	const int32 NumSavedFrames = Session.GetSavedFrameCount();
+	Task.Begin(NumSavedFrames);
 
-		if (Context.ResizeTo != FIntPoint(ViewportBackBuffer->GetSizeX(), ViewportBackBuffer->GetSizeY()))
-		{
-			// We're scaling down the window, so use bilinear filtering
-			PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Bilinear>::GetRHI(), ViewportBackBuffer);
-		}
-		else
-		{
-			// Drawing 1:1, so no filtering needed
-			PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Point>::GetRHI(), ViewportBackBuffer);
-		}
+	const double StartTime = FPlatformTime::Seconds();
+	bool bDumped = false;
+	if (FPaths::GetExtension(DumpPath) == TEXT("y4m"))
+	{
+		// Whatever WriteWebM would have given libvpx, so the clip comes out the same wherever it's encoded
+		vpx_codec_enc_cfg_t Cfg;
+		FSelfieEncodePipeline::InitConfig(Cfg, SelfieWidth, SelfieHeight, SelfieFrameRate);
+
+		FSelfieY4MSidecar Settings;
+		Settings.Width = SelfieWidth;
+		Settings.Height = SelfieHeight;
+		Settings.FrameRate = SelfieFrameRate;
+		Settings.TargetBitrate = Cfg.rc_target_bitrate;
+		Settings.Deadline = VPX_DL_GOOD_QUALITY;
+		Settings.StaticThreshold = bSkipStaticRegions ? SelfieStaticThreshold : 0;
+		Settings.StaticBlockSAD = bSkipStaticRegions ? SelfieStaticBlockSAD : 0;
+		Settings.YUVFormat = SelfieYUVFormat;
+
+		bDumped = FSelfieY4MDump::Write(DumpPath, Settings, NumSavedFrames, FSelfieGetSourceFrame::CreateRaw(&Session, &FSelfieCaptureSession::GetSavedFrame),
+			FSelfieGetFrameTime::CreateRaw(&Session, &FSelfieCaptureSession::GetSavedFrameTime), FSelfieEncodeProgress::CreateRaw(&Task, &FSelfieSaveTask::ReportProgress));
+	}
+	else
+	{
+		bDumped = FSelfieRingDump::Write(DumpPath, SelfieWidth, SelfieHeight, SelfieFrameRate, NumSavedFrames, FSelfieGetSourceFrame::CreateRaw(&Session, &FSelfieCaptureSession::GetSavedFrame));
+	}
 
-		Context.RendererModule->DrawRectangle(
-			RHICmdList,
-			0, 0,		// Dest X, Y
-			Context.ResizeTo.X, Context.ResizeTo.Y,	// Dest Width, Height
-			0, 0,		// Source U, V
-			1, 1,		// Source USize, VSize
-			Context.ResizeTo,		// Target buffer size
-			FIntPoint(1, 1),		// Source texture size
-			*VertexShader,
-			EDRF_Default);
+	// Capture carries on where it was
+	Session.EndReadRing();
 
-		// Asynchronously copy render target from GPU to CPU
-		const bool bKeepOriginalSurface = false;
-		RHICmdList.CopyToResolveTarget(
-			DestRenderTarget.TargetableTexture,
-			Context.This->ReadbackTextures[Context.This->ReadbackTextureIndex],
-			bKeepOriginalSurface,
-			FResolveParams());
-	});
+	UE_LOG(LogUTSelfie, Display, TEXT("Ring dump %s %s"), bDumped ? TEXT("written to") : TEXT("failed for"), *DumpPath);
 
+	FSelfieSaveStats Stats;
+	Stats.Path = DumpPath;
+	Stats.NumFrames = NumSavedFrames;
+	Stats.DurationSeconds = (float)NumSavedFrames / SelfieFrameRate;
+	Stats.SizeBytes = FMath::Max<int64>(IFileManager::Get().FileSize(*DumpPath), 0);
+	Stats.SizeKB = (int32)(Stats.SizeBytes / 1024);
+	Stats.TotalSeconds = FPlatformTime::Seconds() - StartTime;
+	if (!bDumped && Task.IsCancelRequested())
+	{
+		Task.Finish(ESelfieSaveState::Cancelled, Stats);
+		return;
+	}
+	Task.ReportProgress(NumSavedFrames);
+	if (!bDumped)
+	{
+		Stats.Error = TEXT("Couldn't write the dump");
+	}
+	Task.Finish(bDumped ? ESelfieSaveState::Succeeded : ESelfieSaveState::Failed, Stats);
+}
 
-	// Start mapping the newly-rendered buffer
+// Borrowed from GameLiveStreaming.cpp
+void FLetMeTakeASelfie::OnSlateWindowRenderedDuringCapture(SWindow& SlateWindow, void* ViewportRHIPtr)
+{
+	UGameViewportClient* GameViewportClient = GEngine->GameViewport;
+	if (GameViewportClient != nullptr && GameViewportClient->GetWindow() == SlateWindow.AsShared())
 	{
-		struct FReadbackFromStagingBufferContext
-		{
-			FLetMeTakeASelfie* This;
-		};
-		FReadbackFromStagingBufferContext ReadbackFromStagingBufferContext =
+		// Split-screen players are all in the one backbuffer, each session reads back its own part
+		const FViewportRHIRef* ViewportRHI = (const FViewportRHIRef*)ViewportRHIPtr;
+		for (FSelfieCaptureSession* Session : CaptureSessions)
 		{
-			this
-		};
-		ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
-			ReadbackFromStagingBuffer,
-			FReadbackFromStagingBufferContext, Context, ReadbackFromStagingBufferContext,
+			if (Session)
 			{
-			int32 UnusedWidth = 0;
-			int32 UnusedHeight = 0;
-			RHICmdList.MapStagingSurface(Context.This->ReadbackTextures[Context.This->ReadbackTextureIndex], Context.This->ReadbackBuffers[Context.This->ReadbackBufferIndex], UnusedWidth, UnusedHeight);
-
-			// Ping pong between readback textures
-			Context.This->ReadbackTextureIndex = (Context.This->ReadbackTextureIndex + 1) % 2;
-		});
+				Session->CaptureViewport(*ViewportRHI);
+			}
+		}
 	}
-
-	// Ping pong between readback buffers
-	ReadbackBufferIndex = (ReadbackBufferIndex + 1) % 2;
-}
\ No newline at end of file
+}
@@ -8,6 +8,20 @@
 #include <mmdeviceapi.h>
 #include <audioclient.h>
 
+#include "SelfieCaptureScheduler.h"
+#include "SelfieCaptureGovernor.h"
+#include "SelfieFrameHandoff.h"
+#include "SelfieEncodePipeline.h"
+#include "SelfieOutputSink.h"
+#include "SelfieSegmentRecorder.h"
+#include "SelfieClipCatalog.h"
+#include "SelfieSpillRing.h"
+#include "SelfieRingCompression.h"
+#include "SelfieSaveTask.h"
+#include "SelfieEncodeThrottle.h"
+#include "SelfieEncodePool.h"
+#include "SelfieCaptureSession.h"
+
 #include "LetMeTakeASelfie.generated.h"
 
 UCLASS(Blueprintable, Meta = (ChildCanTick))
@@ -33,53 +47,55 @@ struct FLetMeTakeASelfie : FTickableGameObject, FSelfRegisteringExec
 	/** FSelfRegisteringExec implementation */
 	virtual bool Exec(UWorld* Inworld, const TCHAR* Cmd, FOutputDevice& Ar) override;
 
-	void OnWorldCreated(UWorld* World, const UWorld::InitializationValues IVS);
 	void OnWorldDestroyed(UWorld* World);
 
-	TMap< UWorld*, USceneCaptureComponent2D* > WorldToSceneCaptureComponentMap;
-	UWorld* SelfieWorld;
-	bool bTakingAnimatedSelfie;
-	float SelfieTimeTotal;
-	int32 SelfieFrames;
-	int32 SelfieFramesMax;
+	/** One per local player that's been captured, by player index, nullptr for the rest */
+	enum { MaxCaptureSessions = 4 };
+	TArray<FSelfieCaptureSession*> CaptureSessions;
+	FSelfieCaptureSession* GetSession(int32 PlayerIndex, bool bCreate = false);
+	/** First world any session is capturing */
+	UWorld* GetCaptureWorld() const;
+	bool IsSaving() const;
+	/** Seconds with nothing capturing, saving or recording before a session's resources are released, 0 keeps them forever */
+	float SelfieIdleReleaseSeconds;
 	float SelfieFrameDelay;
-	float SelfieDeltaTimeAccum;
-	bool bStartedAnimatedWritingTask;
+	/** Seconds in the in-memory ring when there's no spill file */
+	float SelfieLength;
+	/** Capture rate for a burst around a trigger, no bursts unless it's above SelfieFrameRate */
+	int32 SelfieBurstRate;
+	float SelfieBurstSeconds;
+	/** Real time frames before the burst in the slowed down copy */
+	float SelfieSlowMotionLeadIn;
+	/** Keeps the in-memory ring compressed, up to SelfieRingCompressScale times the frames in the same memory, see FSelfieRingCompressor */
+	bool bCompressSelfieRing;
+	int32 SelfieRingCompressScale;
+	/** Frames per key frame, a save can lose up to this many minus one off the oldest end */
+	int32 SelfieRingKeyInterval;
+	/** Extra ring frames so a whole burst fits without eating the pre-roll */
+	int32 GetBurstHeadroomFrames() const;
+	/** High rate capture for a player from the next frame, for game code that knows something's about to happen */
+	void RequestBurst(int32 PlayerIndex = 0);
+	/** Steps capture quality down when it's costing the game frames, shared by every session since it's one game frame */
+	FSelfieCaptureGovernor CaptureGovernor;
+	/** Holds saves back while a match is being played */
+	FSelfieEncodeThrottle EncodeThrottle;
+	/** Save workers for every session */
+	FSelfieEncodePool EncodePool;
+	/** Match over, paused or in a menu, saves can go flat out */
+	bool IsGameIdleForEncode() const;
+	/** Resizes every session's scene capture for the governor's current level */
+	void ApplyGovernorLevel();
 	int32 SelfieWidth;
 	int32 SelfieHeight;
 	int32 SelfieFrameRate;
-	bool bFirstPerson;
 	bool bRegisteredSlateDelegate;
+	void RegisterSlateDelegate();
 
-	// Capturing in a ring buffer, this is the current head
-	int32 HeadFrame;
-
-	TWeakObjectPtr<AUTProjectile> FollowingProjectile;
-	int32 RecordedNumberOfScoringPlayers;
-	float DelayedEventWriteTimer;
-	
-	float SelfieTimeWaited;
-
-	TArray< TArray<FColor> > SelfieSurfaceImages;
-
-	TArray<FColor> SelfieSurfData;
-	bool bWaitingOnSelfieSurfData;
-	bool bSelfieSurfDataReady;
-	void ReadPixelsAsync(FRenderTarget* RenderTarget);
-	
-
-
-	/** Static: Readback textures for asynchronously reading the viewport frame buffer back to the CPU.  We ping-pong between the buffers to avoid stalls. */
-	FTexture2DRHIRef ReadbackTextures[2];
-	/** Static: We ping pong between the textures in case the GPU is a frame behind (GSystemSettings.bAllowOneFrameThreadLag) */
-	int32 ReadbackTextureIndex;
-	/** Static: Pointers to mapped system memory readback textures that game frames will be asynchronously copied to */
-	void* ReadbackBuffers[2];
-	/** The current buffer index.  We bounce between them to avoid stalls. */
-	int32 ReadbackBufferIndex;
+	/** Number of staging textures, 2-4, frames come back this many frames minus one after capture */
+	int32 SelfieReadbackDepth;
 	void OnSlateWindowRenderedDuringCapture(SWindow& SlateWindow, void* ViewportRHIPtr);
-	void CopyCurrentFrameToSavedFrames();
-	void StartCopyingNextGameFrame(const FViewportRHIRef& ViewportRHI);
+	/** Whole match recording of one session, see FSelfieCaptureSession::SegmentRecorder */
+	FSelfieSegmentRecorder SegmentRecorder;
 
 	// Audio stuff
 	IMMDevice* MMDevice;
@@ -95,52 +111,45 @@ struct FLetMeTakeASelfie : FTickableGameObject, FSelfRegisteringExec
 	void StopAudioLoopback();
 	void ReadAudioLoopback();
 
-	void WriteWebM();
-};
-
-
-/* Based on https://wiki.unrealengine.com/Multi-Threading:_How_to_Create_Threads_in_UE4 */
-class FWriteWebMSelfieWorker : public FRunnable
-{
-	FWriteWebMSelfieWorker(FLetMeTakeASelfie* InLetMeTakeASelfie)
-	: LetMeTakeASelfie(InLetMeTakeASelfie)
-	{
-		Thread = FRunnableThread::Create(this, TEXT("FWriteWebMSelfieWorker"), 0, TPri_BelowNormal);
-	}
-
-	~FWriteWebMSelfieWorker()
-	{
-		delete Thread;
-		Thread = nullptr;
-
-	}
-
-	uint32 Run()
-	{
-		LetMeTakeASelfie->WriteWebM();
-
-		return 0;
-	}
-
-public:
-	static FWriteWebMSelfieWorker* RunWorkerThread(FLetMeTakeASelfie* InLetMeTakeASelfie)
-	{
-		if (Runnable)
-		{
-			delete Runnable;
-			Runnable = nullptr;
-		}
-
-		if (Runnable == nullptr)
-		{
-			Runnable = new FWriteWebMSelfieWorker(InLetMeTakeASelfie);
-		}
-
-		return Runnable;
-	}
-
-private:
-	FLetMeTakeASelfie* LetMeTakeASelfie;
-	FRunnableThread* Thread;
-	static FWriteWebMSelfieWorker* Runnable;
+	/**
+	 * Flushes a session's readbacks into its ring and saves it on the encode pool, Trigger goes in the clip catalog.
+	 * Always hands back a task, it fails straight away if that player isn't being captured or is already saving.
+	 */
+	FSelfieSaveHandle RequestSave(const FString& Trigger, int32 PlayerIndex = 0);
+	/** Same for a raw ring dump, capture carries on with the ring as it was afterwards. A .y4m path gets an FSelfieY4MDump */
+	FSelfieSaveHandle RequestRingDump(const FString& DumpPath, int32 PlayerIndex = 0);
+	/** Every request whose completion hasn't been dispatched yet */
+	TArray<FSelfieSaveHandle> SaveTasks;
+	FSelfieSaveHandle StartSaveTask(FSelfieCaptureSession* Session, const FString& Trigger, const FString& RingDumpPath, bool bIsDump);
+
+	/** Encode pool thread, for Session's ActiveSave */
+	void WriteWebM(FSelfieCaptureSession& Session, FSelfieSaveTask& Task);
+	/** Encode pool thread. Frames at PlayTimes to a file next to the clip, otherwise the same settings as the clip. False if it was cancelled or failed */
+	bool WriteSlowMotion(FSelfieFrameSelection& Frames, const TArray<double>& PlayTimes, const FString& Path, const vpx_codec_enc_cfg_t& Cfg, int32 NumConvertWorkers, FSelfieSaveTask& Task);
+	/** Raw copy of the ring for offline tools, see FSelfieRingDump, or I420 for encoding elsewhere, see FSelfieY4MDump */
+	void DumpRing(FSelfieCaptureSession& Session, const FString& DumpPath, FSelfieSaveTask& Task);
+
+	/** Where saved clips go, see ISelfieOutputSink::Create. Empty means a file in the screenshot dir */
+	FString SelfieOutputSpec;
+	/** Gets the clip as it's encoded when SelfieOutputSpec is "callback", called on the mux threads, several at once if several sessions save */
+	FSelfieSinkWrite SelfieOutputCallback;
+	/** Poster, contact sheet and scrub strip next to each saved clip, see FSelfieThumbnailExport */
+	bool bExportSelfieThumbnails;
+	/** Saves write a .y4m and sidecar for Tools/SelfieY4MEncode instead of encoding on the client */
+	bool bDeferSelfieEncode;
+	FString GetY4MDumpPath(const FSelfieCaptureSession* Session) const;
+	/** Tells the encoder which macroblocks didn't change, see FSelfieStaticRegions */
+	bool bSkipStaticRegions;
+	uint32 SelfieStaticBlockSAD;
+	/** VP8E_SET_STATIC_THRESHOLD, the encoder's own skip test for the blocks we leave active */
+	uint32 SelfieStaticThreshold;
+	/** Colour conversion for saves and dumps. BT.601 video range unless asked, it's the only thing VP8 players assume */
+	FSelfieYUVFormat SelfieYUVFormat;
+
+	/** Numbers and metadata for every saved clip, safe from every save at once */
+	FSelfieClipCatalog ClipCatalog;
+
+	/** For the Blueprint library, there's only ever the one made by the module */
+	static FLetMeTakeASelfie* Get() { return Instance; }
+	static FLetMeTakeASelfie* Instance;
 };
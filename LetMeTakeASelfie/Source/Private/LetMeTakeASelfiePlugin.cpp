@@ -22,9 +22,7 @@ void FLetMeTakeASelfiePlugin::StartupModule()
 	// Make an actor that ticks
 	FLetMeTakeASelfie* SelfieMachine = new FLetMeTakeASelfie();
 
-	FWorldDelegates::FWorldInitializationEvent::FDelegate OnWorldCreatedDelegate = FWorldDelegates::FWorldInitializationEvent::FDelegate::CreateRaw(SelfieMachine, &FLetMeTakeASelfie::OnWorldCreated);
-	FDelegateHandle OnWorldCreatedDelegateHandle = FWorldDelegates::OnPostWorldInitialization.Add(OnWorldCreatedDelegate);
-
+	// Nothing gets made per world, capture resources come with the first SELFIEANIM
 	FWorldDelegates::FWorldEvent::FDelegate OnWorldDestroyedDelegate = FWorldDelegates::FWorldEvent::FDelegate::CreateRaw(SelfieMachine, &FLetMeTakeASelfie::OnWorldDestroyed);
 	FDelegateHandle OnWorldDestroyedDelegateHandle = FWorldDelegates::OnPreWorldFinishDestroy.Add(OnWorldDestroyedDelegate);
 }
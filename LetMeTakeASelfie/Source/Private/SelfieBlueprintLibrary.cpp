@@ -0,0 +1,76 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieBlueprintLibrary.h"
+
+USelfieSaveProxy::USelfieSaveProxy(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+}
+
+void USelfieSaveProxy::Watch(const FSelfieSaveHandle& InTask)
+{
+	Task = InTask;
+	AddToRoot();
+	Task->OnProgress.AddUObject(this, &USelfieSaveProxy::HandleProgress);
+	Task->OnComplete.AddUObject(this, &USelfieSaveProxy::HandleComplete);
+}
+
+void USelfieSaveProxy::Cancel()
+{
+	if (Task.IsValid())
+	{
+		Task->Cancel();
+	}
+}
+
+float USelfieSaveProxy::GetProgress() const
+{
+	return Task.IsValid() ? Task->GetProgress() : 0.0f;
+}
+
+TEnumAsByte<ESelfieSaveState::Type> USelfieSaveProxy::GetState() const
+{
+	return Task.IsValid() ? Task->GetState() : ESelfieSaveState::Queued;
+}
+
+void USelfieSaveProxy::HandleProgress(FSelfieSaveTask& InTask, int32 FramesEncoded, int32 TotalFrames)
+{
+	OnProgress.Broadcast(FramesEncoded, TotalFrames, InTask.GetProgress());
+}
+
+void USelfieSaveProxy::HandleComplete(FSelfieSaveTask& InTask)
+{
+	OnComplete.Broadcast(InTask.GetState(), InTask.GetStats());
+	RemoveFromRoot();
+}
+
+USelfieBlueprintLibrary::USelfieBlueprintLibrary(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+}
+
+USelfieSaveProxy* USelfieBlueprintLibrary::SaveSelfie(const FString& Trigger, int32 PlayerIndex)
+{
+	USelfieSaveProxy* Proxy = NewObject<USelfieSaveProxy>();
+	if (FLetMeTakeASelfie* Selfie = FLetMeTakeASelfie::Get())
+	{
+		// Completion always comes from a later tick, even for a request that fails straight away, so binding after this returns is fine
+		Proxy->Watch(Selfie->RequestSave(Trigger.IsEmpty() ? TEXT("Blueprint") : *Trigger, PlayerIndex));
+	}
+	return Proxy;
+}
+
+void USelfieBlueprintLibrary::StartSelfieBurst(int32 PlayerIndex)
+{
+	if (FLetMeTakeASelfie* Selfie = FLetMeTakeASelfie::Get())
+	{
+		Selfie->RequestBurst(PlayerIndex);
+	}
+}
+
+bool USelfieBlueprintLibrary::IsSelfieSaving()
+{
+	FLetMeTakeASelfie* Selfie = FLetMeTakeASelfie::Get();
+	return Selfie && Selfie->IsSaving();
+}
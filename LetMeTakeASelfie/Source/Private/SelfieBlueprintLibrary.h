@@ -0,0 +1,60 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieSaveTask.h"
+
+#include "SelfieBlueprintLibrary.generated.h"
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FSelfieSaveProgressDynamic, int32, FramesEncoded, int32, TotalFrames, float, Progress);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FSelfieSaveCompleteDynamic, TEnumAsByte<ESelfieSaveState::Type>, State, const FSelfieSaveStats&, Stats);
+
+/**
+ * Blueprint side of an FSelfieSaveTask. Bind OnProgress and OnComplete on what SaveSelfie returns.
+ * Keeps itself rooted until the save completes so it doesn't need to be stored anywhere.
+ */
+UCLASS(BlueprintType)
+class USelfieSaveProxy : public UObject
+{
+	GENERATED_UCLASS_BODY()
+
+	UPROPERTY(BlueprintAssignable, Category = Selfie)
+	FSelfieSaveProgressDynamic OnProgress;
+
+	UPROPERTY(BlueprintAssignable, Category = Selfie)
+	FSelfieSaveCompleteDynamic OnComplete;
+
+	UFUNCTION(BlueprintCallable, Category = Selfie)
+	void Cancel();
+
+	UFUNCTION(BlueprintPure, Category = Selfie)
+	float GetProgress() const;
+
+	UFUNCTION(BlueprintPure, Category = Selfie)
+	TEnumAsByte<ESelfieSaveState::Type> GetState() const;
+
+	void Watch(const FSelfieSaveHandle& InTask);
+
+private:
+	void HandleProgress(FSelfieSaveTask& InTask, int32 FramesEncoded, int32 TotalFrames);
+	void HandleComplete(FSelfieSaveTask& InTask);
+
+	FSelfieSaveHandle Task;
+};
+
+UCLASS()
+class USelfieBlueprintLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_UCLASS_BODY()
+
+	/** Saves what's in a local player's capture ring, needs SELFIEANIM running for them. Fails straight away if they're already saving */
+	UFUNCTION(BlueprintCallable, Category = Selfie)
+	static USelfieSaveProxy* SaveSelfie(const FString& Trigger, int32 PlayerIndex = 0);
+
+	/** High rate capture for the player from the next frame, for a slow motion copy next to their next clip. Needs SELFIEBURST RATE= */
+	UFUNCTION(BlueprintCallable, Category = Selfie)
+	static void StartSelfieBurst(int32 PlayerIndex = 0);
+
+	/** Any player */
+	UFUNCTION(BlueprintPure, Category = Selfie)
+	static bool IsSelfieSaving();
+};
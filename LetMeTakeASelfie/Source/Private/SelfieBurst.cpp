@@ -0,0 +1,123 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieBurst.h"
+
+float FSelfieBurstTimeline::Begin(double Now, float Seconds)
+{
+	const bool bOngoing = Windows.Num() > 0 && Windows.Last().EndTime >= Now;
+
+	// Burst time the other windows in the ring have already had, past that the extra frames would push out pre-roll
+	double UsedSeconds = 0;
+	for (int32 WindowIndex = 0; WindowIndex < Windows.Num() - (bOngoing ? 1 : 0); WindowIndex++)
+	{
+		UsedSeconds += Windows[WindowIndex].EndTime - Windows[WindowIndex].StartTime;
+	}
+	const double AllowedSeconds = Seconds - UsedSeconds;
+
+	if (bOngoing)
+	{
+		FSelfieBurstWindow& Window = Windows.Last();
+		Window.EndTime = FMath::Max(Window.EndTime, FMath::Min(Now + Seconds, Window.StartTime + AllowedSeconds));
+		return (float)(Window.EndTime - Now);
+	}
+	if (AllowedSeconds <= 0)
+	{
+		return 0;
+	}
+	Windows.Add(FSelfieBurstWindow(Now, Now + FMath::Min<double>(Seconds, AllowedSeconds)));
+	return (float)(Windows.Last().EndTime - Now);
+}
+
+bool FSelfieBurstTimeline::IsBurstTime(double Time) const
+{
+	// Newest first, that's where the frames being asked about usually are
+	for (int32 WindowIndex = Windows.Num() - 1; WindowIndex >= 0; WindowIndex--)
+	{
+		if (Time >= Windows[WindowIndex].StartTime)
+		{
+			return Time <= Windows[WindowIndex].EndTime;
+		}
+	}
+	return false;
+}
+
+void FSelfieBurstTimeline::Prune(double OldestTime)
+{
+	int32 NumExpired = 0;
+	while (NumExpired < Windows.Num() && Windows[NumExpired].EndTime < OldestTime)
+	{
+		NumExpired++;
+	}
+	if (NumExpired > 0)
+	{
+		Windows.RemoveAt(0, NumExpired);
+	}
+}
+
+void FSelfieBurstTimeline::PlanRealTime(const TArray<double>& FrameTimes, float FrameInterval, TArray<int32>& OutFrames) const
+{
+	OutFrames.Empty(FrameTimes.Num());
+
+	// Slots carry on from the last frame kept, burst frames are kept when they're the first one into the next slot.
+	// A little slack so capture jitter doesn't make it skip a slot and keep the frame after
+	const double Slack = FrameInterval * 0.125;
+	double NextSlotTime = -DBL_MAX;
+	for (int32 FrameIndex = 0; FrameIndex < FrameTimes.Num(); FrameIndex++)
+	{
+		const double Time = FrameTimes[FrameIndex];
+		if (!IsBurstTime(Time))
+		{
+			// The scheduler already spaced these
+			OutFrames.Add(FrameIndex);
+			NextSlotTime = Time + FrameInterval;
+		}
+		else if (Time >= NextSlotTime - Slack)
+		{
+			OutFrames.Add(FrameIndex);
+			NextSlotTime = FMath::Max(NextSlotTime + FrameInterval, Time + FrameInterval - Slack);
+		}
+	}
+}
+
+void FSelfieBurstTimeline::PlanSlowMotion(const TArray<double>& FrameTimes, float LeadInSeconds, float Slowdown, TArray<int32>& OutFrames, TArray<double>& OutPlayTimes) const
+{
+	OutFrames.Empty();
+	OutPlayTimes.Empty();
+	if (FrameTimes.Num() == 0)
+	{
+		return;
+	}
+
+	// Newest window with frames in it
+	const FSelfieBurstWindow* Burst = nullptr;
+	for (int32 WindowIndex = Windows.Num() - 1; WindowIndex >= 0 && Burst == nullptr; WindowIndex--)
+	{
+		const FSelfieBurstWindow& Window = Windows[WindowIndex];
+		if (Window.StartTime <= FrameTimes.Last() && Window.EndTime >= FrameTimes[0])
+		{
+			Burst = &Window;
+		}
+	}
+	if (Burst == nullptr)
+	{
+		return;
+	}
+
+	const double StartTime = Burst->StartTime - LeadInSeconds;
+	double PlayTime = 0;
+	for (int32 FrameIndex = 0; FrameIndex < FrameTimes.Num(); FrameIndex++)
+	{
+		if (FrameTimes[FrameIndex] >= StartTime && FrameTimes[FrameIndex] <= Burst->EndTime)
+		{
+			if (OutFrames.Num() > 0)
+			{
+				// The gap up to a burst frame is slowed down, the gaps between lead in frames aren't
+				const double Gap = FrameTimes[FrameIndex] - FrameTimes[OutFrames.Last()];
+				PlayTime += IsBurstTime(FrameTimes[FrameIndex]) ? Gap * Slowdown : Gap;
+			}
+			OutFrames.Add(FrameIndex);
+			OutPlayTimes.Add(PlayTime);
+		}
+	}
+}
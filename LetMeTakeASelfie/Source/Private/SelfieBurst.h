@@ -0,0 +1,64 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieEncodePipeline.h"
+
+/** Stretch of capture time, FPlatformTime::Seconds(), that was sampled at the burst rate */
+struct FSelfieBurstWindow
+{
+	double StartTime;
+	double EndTime;
+
+	FSelfieBurstWindow(double InStartTime, double InEndTime)
+		: StartTime(InStartTime)
+		, EndTime(InEndTime)
+	{
+	}
+};
+
+/**
+ * Which parts of a ring were captured at the burst rate, and the frame lists a save encodes from it.
+ *
+ * The ring itself is just frames with capture times, base rate and burst frames mixed together. Frames are told apart
+ * by time rather than flagged, so the spill file and dumps don't need to know bursts exist. Game thread, except for
+ * the Plan functions which the save worker calls while capture is paused for it.
+ */
+struct FSelfieBurstTimeline
+{
+	TArray<FSelfieBurstWindow> Windows;
+
+	/**
+	 * Starts a window at Now, or stretches the last one if it's still going. The ring's headroom only pays for Seconds
+	 * of burst, so the windows still in it never add up to more than that. Returns how long the burst has left from Now,
+	 * 0 if it's used up until older windows are pruned
+	 */
+	float Begin(double Now, float Seconds);
+	bool IsBurstTime(double Time) const;
+	/** Forgets windows that ended before OldestTime, nothing in the ring is that old */
+	void Prune(double OldestTime);
+
+	/** Real time: base rate frames as they are, burst frames thinned back down to one every FrameInterval */
+	void PlanRealTime(const TArray<double>& FrameTimes, float FrameInterval, TArray<int32>& OutFrames) const;
+	/**
+	 * Slowed down: the newest burst in FrameTimes plus LeadInSeconds of base rate frames before it, every one of them.
+	 * OutPlayTimes is when each one shows in the clip, seconds from the first: the lead in plays in real time and the
+	 * burst by capture time stretched by Slowdown, so it stays smooth when the game couldn't keep up the burst rate.
+	 * Empty when there's no burst in there
+	 */
+	void PlanSlowMotion(const TArray<double>& FrameTimes, float LeadInSeconds, float Slowdown, TArray<int32>& OutFrames, TArray<double>& OutPlayTimes) const;
+};
+
+/** An encode's source frames picked out of a bigger source, e.g. the ring through a burst plan */
+struct FSelfieFrameSelection
+{
+	FSelfieGetSourceFrame Source;
+	TArray<int32> Frames;
+
+	explicit FSelfieFrameSelection(const FSelfieGetSourceFrame& InSource)
+		: Source(InSource)
+	{
+	}
+
+	const FColor* GetFrame(int32 FrameIndex) { return Source.Execute(Frames[FrameIndex]); }
+	FSelfieGetSourceFrame AsSource() { return FSelfieGetSourceFrame::CreateRaw(this, &FSelfieFrameSelection::GetFrame); }
+};
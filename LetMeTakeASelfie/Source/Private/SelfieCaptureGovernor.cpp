@@ -0,0 +1,179 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieCaptureGovernor.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieGovernor, Log, All);
+
+// Cheapest last, each rung should cost noticeably less than the one above it
+static const FSelfieGovernorLevel GSelfieGovernorLevels[] =
+{
+	{ 1.0f, 1, false },
+	{ 0.75f, 1, false },
+	{ 0.5f, 1, false },
+	{ 0.5f, 2, false },
+	{ 0.5f, 2, true },
+};
+
+// Roughly a third of a second to settle at 60fps
+static const float SelfieGovernorSmoothing = 0.05f;
+
+int32 FSelfieCaptureGovernor::GetNumLevels()
+{
+	return ARRAY_COUNT(GSelfieGovernorLevels);
+}
+
+FSelfieCaptureGovernor::FSelfieCaptureGovernor()
+	: bEnabled(true)
+	, FrameBudget(1.0f / 60.0f)
+	, MaxCaptureShare(0.1f)
+	, DownshiftSeconds(0.5f)
+	, UpshiftSeconds(3.0f)
+	, DwellSeconds(2.0f)
+	, MaxLevel(GetNumLevels() - 1)
+{
+	Reset();
+}
+
+void FSelfieCaptureGovernor::Reset()
+{
+	Level = 0;
+	FrameTimeAverage = 0;
+	CaptureFrameTimeAverage = 0;
+	PlainFrameTimeAverage = 0;
+	CaptureWorkAverage = 0;
+	CapturedFraction = 0;
+	bHaveCaptureFrame = false;
+	bHavePlainFrame = false;
+	LevelCost.Init(-1.0f, GetNumLevels());
+	OverBudgetTime = 0;
+	HeadroomTime = 0;
+	TimeOnLevel = 0;
+	Downshifts = 0;
+	Upshifts = 0;
+}
+
+const FSelfieGovernorLevel& FSelfieCaptureGovernor::GetCurrentLevel() const
+{
+	return GSelfieGovernorLevels[Level];
+}
+
+float FSelfieCaptureGovernor::GetCaptureShare() const
+{
+	if (FrameTimeAverage <= 0)
+	{
+		return 0;
+	}
+
+	// Render and GPU cost only shows up as the difference between the two kinds of frame. Capturing every frame leaves
+	// nothing to compare against, then the game thread part is all we can see
+	float Cost = CaptureWorkAverage;
+	if (bHaveCaptureFrame && bHavePlainFrame)
+	{
+		Cost = FMath::Max(Cost, (CaptureFrameTimeAverage - PlainFrameTimeAverage) * CapturedFraction);
+	}
+	return FMath::Clamp(Cost / FrameTimeAverage, 0.0f, 1.0f);
+}
+
+bool FSelfieCaptureGovernor::Update(float DeltaTime, bool bCapturedLastFrame, double CaptureWorkSeconds)
+{
+	if (!bEnabled || DeltaTime <= 0)
+	{
+		return false;
+	}
+
+	// Hitches like level loads would throw everything off for seconds
+	DeltaTime = FMath::Min(DeltaTime, 0.25f);
+
+	const float Alpha = SelfieGovernorSmoothing;
+	FrameTimeAverage = FrameTimeAverage > 0 ? FMath::Lerp(FrameTimeAverage, DeltaTime, Alpha) : DeltaTime;
+	CaptureWorkAverage = FMath::Lerp(CaptureWorkAverage, (float)CaptureWorkSeconds, Alpha);
+	CapturedFraction = FMath::Lerp(CapturedFraction, bCapturedLastFrame ? 1.0f : 0.0f, Alpha);
+	if (bCapturedLastFrame)
+	{
+		CaptureFrameTimeAverage = bHaveCaptureFrame ? FMath::Lerp(CaptureFrameTimeAverage, DeltaTime, Alpha) : DeltaTime;
+		bHaveCaptureFrame = true;
+	}
+	else
+	{
+		PlainFrameTimeAverage = bHavePlainFrame ? FMath::Lerp(PlainFrameTimeAverage, DeltaTime, Alpha) : DeltaTime;
+		bHavePlainFrame = true;
+	}
+
+	TimeOnLevel += DeltaTime;
+	if (TimeOnLevel < DwellSeconds)
+	{
+		return false;
+	}
+
+	const float Share = GetCaptureShare();
+	const float Cost = Share * FrameTimeAverage;
+	LevelCost[Level] = Cost;
+
+	// Down when the game misses its budget and capture is taking more than its share
+	if (FrameTimeAverage > FrameBudget && Share > MaxCaptureShare && Level < MaxLevel)
+	{
+		OverBudgetTime += DeltaTime;
+		HeadroomTime = 0;
+		if (OverBudgetTime >= DownshiftSeconds)
+		{
+			Downshifts++;
+			SetLevel(Level + 1);
+			return true;
+		}
+		return false;
+	}
+	OverBudgetTime = 0;
+
+	// Up when the rung above, at what it cost last time, would still leave us inside both limits. Never measured
+	// means assume it costs twice what this one does
+	if (Level > 0)
+	{
+		const float AboveCost = LevelCost[Level - 1] >= 0 ? LevelCost[Level - 1] : Cost * 2.0f;
+		const float ProjectedFrameTime = FrameTimeAverage - Cost + AboveCost;
+		if (ProjectedFrameTime <= FrameBudget * 0.95f && AboveCost <= MaxCaptureShare * ProjectedFrameTime)
+		{
+			HeadroomTime += DeltaTime;
+			if (HeadroomTime >= UpshiftSeconds)
+			{
+				Upshifts++;
+				SetLevel(Level - 1);
+				return true;
+			}
+			return false;
+		}
+	}
+	HeadroomTime = 0;
+
+	return false;
+}
+
+void FSelfieCaptureGovernor::SetLevel(int32 NewLevel)
+{
+	Level = FMath::Clamp(NewLevel, 0, MaxLevel);
+	OverBudgetTime = 0;
+	HeadroomTime = 0;
+	TimeOnLevel = 0;
+
+	// The capture frame numbers belong to the old rung
+	bHaveCaptureFrame = false;
+	bHavePlainFrame = false;
+
+	const FSelfieGovernorLevel& NewSettings = GetCurrentLevel();
+	UE_LOG(LogUTSelfieGovernor, Display, TEXT("Selfie governor level %d: %.0f%% scene capture, scene every %d samples%s"), Level,
+		NewSettings.ResolutionScale * 100.0f, NewSettings.SceneRenderDivisor, NewSettings.bForceFirstPerson ? TEXT(", first person") : TEXT(""));
+}
+
+void FSelfieCaptureGovernor::LogStats(FOutputDevice& Ar) const
+{
+	Ar.Logf(TEXT("Selfie governor %s, level %d of %d, frame %.2fms (budget %.2fms), capture %.1f%% of frame (max %.1f%%), %d down %d up"),
+		bEnabled ? TEXT("on") : TEXT("off"), Level, MaxLevel, FrameTimeAverage * 1000.0f, FrameBudget * 1000.0f,
+		GetCaptureShare() * 100.0f, MaxCaptureShare * 100.0f, Downshifts, Upshifts);
+	for (int32 LevelIndex = 0; LevelIndex < LevelCost.Num(); LevelIndex++)
+	{
+		if (LevelCost[LevelIndex] >= 0)
+		{
+			Ar.Logf(TEXT("  level %d last cost %.2fms"), LevelIndex, LevelCost[LevelIndex] * 1000.0f);
+		}
+	}
+}
@@ -0,0 +1,84 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+/** One rung of the governor ladder, the clip itself stays at the same size and rate on every rung */
+struct FSelfieGovernorLevel
+{
+	/** Scene capture render size relative to the clip, resampled up on the GPU */
+	float ResolutionScale;
+	/** Scene capture is rendered every Nth sample, the samples in between read back the last render again */
+	int32 SceneRenderDivisor;
+	/** Give up on the third person camera and take the back buffer instead */
+	bool bForceFirstPerson;
+};
+
+/**
+ * Keeps selfie capture from costing the game its frame budget.
+ *
+ * Frame times are tracked separately for frames that rendered the scene capture and frames that didn't, the difference
+ * plus the game thread time spent on capture is what capture costs. When the game is over budget and capture is over
+ * its share of the frame for a while, it steps down the ladder (smaller scene capture, fewer scene renders, then first
+ * person). It steps back up once the cost last measured for the rung above would fit, again only after a while, and never
+ * straight after a change, so it doesn't flap.
+ */
+class FSelfieCaptureGovernor
+{
+public:
+	FSelfieCaptureGovernor();
+
+	/** Back to the top rung and forget the measurements */
+	void Reset();
+
+	/**
+	 * Once per game frame. DeltaTime is the frame that just finished, bCapturedLastFrame whether that frame rendered the
+	 * scene capture, CaptureWorkSeconds the game thread time spent in capture code during it. True if the level changed
+	 */
+	bool Update(float DeltaTime, bool bCapturedLastFrame, double CaptureWorkSeconds);
+
+	int32 GetLevel() const { return Level; }
+	const FSelfieGovernorLevel& GetCurrentLevel() const;
+
+	/** Estimated share of the frame spent on capture, 0 to 1 */
+	float GetCaptureShare() const;
+
+	void LogStats(FOutputDevice& Ar) const;
+
+	bool bEnabled;
+	/** Frame time the game is meant to hit */
+	float FrameBudget;
+	/** Capture may take up to this share of the frame */
+	float MaxCaptureShare;
+	/** How long things have to be bad before stepping down, and good before stepping up */
+	float DownshiftSeconds;
+	float UpshiftSeconds;
+	/** Minimum time on a rung after any change, the measurements need that long to settle */
+	float DwellSeconds;
+	/** Lowest rung allowed, the first person rung is no use if we're already first person */
+	int32 MaxLevel;
+
+	static int32 GetNumLevels();
+
+private:
+	void SetLevel(int32 NewLevel);
+
+	int32 Level;
+
+	// Smoothed frame times
+	float FrameTimeAverage;
+	float CaptureFrameTimeAverage;
+	float PlainFrameTimeAverage;
+	float CaptureWorkAverage;
+	float CapturedFraction;
+	bool bHaveCaptureFrame;
+	bool bHavePlainFrame;
+
+	/** Capture cost last measured on each rung, negative if never */
+	TArray<float> LevelCost;
+
+	float OverBudgetTime;
+	float HeadroomTime;
+	float TimeOnLevel;
+
+	int32 Downshifts;
+	int32 Upshifts;
+};
@@ -0,0 +1,96 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieCaptureScheduler.h"
+
+FSelfieCaptureScheduler::FSelfieCaptureScheduler()
+{
+	Reset(1.0f / 30.0f);
+}
+
+void FSelfieCaptureScheduler::Reset(float InInterval)
+{
+	Interval = InInterval;
+	BurstInterval = InInterval;
+	BurstTimeLeft = 0;
+	// Start a full slot in so the first frame gets sampled right away
+	Budget = Interval;
+	ElapsedTime = 0;
+	SampledFrames = 0;
+	BurstFrames = 0;
+	bLastSampleBurst = false;
+	SkippedSlots = 0;
+	MissedSlots = 0;
+	TotalLateness = 0;
+	MaxLateness = 0;
+}
+
+void FSelfieCaptureScheduler::BeginBurst(float InBurstInterval, float Seconds)
+{
+	BurstInterval = FMath::Min(InBurstInterval, Interval);
+	BurstTimeLeft = FMath::Max<double>(BurstTimeLeft, Seconds);
+	// Time owed towards the next base slot would count as skipped burst slots, one burst slot of it is plenty to start on
+	Budget = FMath::Min<double>(Budget, BurstInterval);
+}
+
+bool FSelfieCaptureScheduler::Advance(float DeltaTime)
+{
+	const bool bBurst = BurstTimeLeft > 0;
+	const float SlotInterval = bBurst ? BurstInterval : Interval;
+	BurstTimeLeft = FMath::Max<double>(BurstTimeLeft - DeltaTime, 0);
+
+	ElapsedTime += DeltaTime;
+	Budget += DeltaTime;
+
+	if (Budget < SlotInterval)
+	{
+		return false;
+	}
+
+	// Only take away one slot so the remainder counts towards the next sample
+	Budget -= SlotInterval;
+
+	if (Budget >= SlotInterval)
+	{
+		// Hitch longer than a slot, those slots are gone, don't try to catch up with a burst of samples.
+		// Bursts faster than the game's frame rate end up here every frame, they just get one sample per frame
+		const int32 Skipped = FMath::FloorToInt(Budget / SlotInterval);
+		SkippedSlots += Skipped;
+		Budget -= Skipped * SlotInterval;
+	}
+
+	TotalLateness += Budget;
+	MaxLateness = FMath::Max(MaxLateness, (float)Budget);
+	SampledFrames++;
+	BurstFrames += bBurst ? 1 : 0;
+	bLastSampleBurst = bBurst;
+
+	return true;
+}
+
+void FSelfieCaptureScheduler::MarkMissed()
+{
+	SampledFrames--;
+	BurstFrames -= bLastSampleBurst ? 1 : 0;
+	bLastSampleBurst = false;
+	MissedSlots++;
+}
+
+float FSelfieCaptureScheduler::GetEffectiveRate() const
+{
+	return ElapsedTime > 0 ? SampledFrames / ElapsedTime : 0;
+}
+
+float FSelfieCaptureScheduler::GetAverageLateness() const
+{
+	const int32 DueSlots = SampledFrames + MissedSlots;
+	return DueSlots > 0 ? TotalLateness / DueSlots : 0;
+}
+
+void FSelfieCaptureScheduler::LogStats(FOutputDevice& Ar) const
+{
+	Ar.Logf(TEXT("Selfie pacing: target %.2fhz, effective %.2fhz over %.1fs"), 1.0f / Interval, GetEffectiveRate(), ElapsedTime);
+	Ar.Logf(TEXT("  sampled %d (%d in bursts at up to %.0fhz), skipped %d (long frames), missed %d (readback busy)"), SampledFrames, BurstFrames,
+		1.0f / BurstInterval, SkippedSlots, MissedSlots);
+	Ar.Logf(TEXT("  lateness avg %.2fms, max %.2fms"), GetAverageLateness() * 1000.0f, MaxLateness * 1000.0f);
+}
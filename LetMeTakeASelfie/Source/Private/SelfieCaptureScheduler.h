@@ -0,0 +1,53 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+/**
+ * Decides which game frames get sampled into the selfie ring.
+ * Time owed is carried over between samples instead of being thrown away, so the capture rate doesn't drift below the target.
+ */
+struct FSelfieCaptureScheduler
+{
+	FSelfieCaptureScheduler();
+
+	/** Start a new capture timeline, the first frame after a reset is always sampled */
+	void Reset(float InInterval);
+
+	/** Advance by one game frame, returns true if this frame should be sampled */
+	bool Advance(float DeltaTime);
+
+	/** Samples every InBurstInterval instead for the next Seconds, starting with the next frame. A burst still going gets longer */
+	void BeginBurst(float InBurstInterval, float Seconds);
+	bool IsBursting() const { return BurstTimeLeft > 0; }
+
+	/** Call when a frame was due but couldn't be sampled (readback still in flight, etc) */
+	void MarkMissed();
+
+	/** Achieved sample rate over the whole timeline */
+	float GetEffectiveRate() const;
+
+	/** Average amount of time a sample lands after its ideal slot */
+	float GetAverageLateness() const;
+
+	void LogStats(FOutputDevice& Ar) const;
+
+	float Interval;
+	float BurstInterval;
+	double BurstTimeLeft;
+
+	// Time owed since the last ideal sample slot, always kept in [0, Interval) after a sample
+	double Budget;
+	double ElapsedTime;
+
+	int32 SampledFrames;
+	// Of which sampled at the burst rate
+	int32 BurstFrames;
+	// The last sample Advance handed out was a burst one, so MarkMissed takes it back off BurstFrames too
+	bool bLastSampleBurst;
+	// Slots that passed without a sample because a game frame was longer than the interval
+	int32 SkippedSlots;
+	// Slots that were due but had to be dropped by the caller
+	int32 MissedSlots;
+
+	double TotalLateness;
+	float MaxLateness;
+};
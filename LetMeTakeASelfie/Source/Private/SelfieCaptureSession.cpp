@@ -0,0 +1,673 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieCaptureSession.h"
+#include "UTPlayerController.h"
+#include "UTCTFGameState.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieSession, Log, All);
+
+FSelfieCaptureSession::FSelfieCaptureSession(FLetMeTakeASelfie* InOwner, int32 InPlayerIndex)
+	: PlayerIndex(InPlayerIndex)
+	, SelfieWorld(nullptr)
+	, bTakingAnimatedSelfie(false)
+	, bFirstPerson(false)
+	, CaptureComponent(nullptr)
+	, CaptureIdleTime(0)
+	, bSampleThisFrame(false)
+	, SceneRenderCounter(0)
+	, bCapturedSinceLastTick(false)
+	, CaptureWorkSeconds(0)
+	, HeadFrame(0)
+	, SelfieFrames(0)
+	, SelfieFramesMax(0)
+	, SelfieRingBaseFrames(0)
+	, SelfieCompressedBytes(0)
+	, SelfieRingCompressScale(1)
+	, NumBurstFramesInRing(0)
+	, SegmentRecorder(nullptr)
+	, SelfieSpillFrames(0)
+	, bActiveSaveIsDump(false)
+	, bStartedAnimatedWritingTask(false)
+	, RecordedNumberOfScoringPlayers(0)
+	, DelayedEventWriteTimer(0)
+	, SelfieTimeWaited(0)
+	, Owner(InOwner)
+	, SavedHeadFrame(0)
+	, LastRecordedFrameTime(0)
+	, RingDecoder(nullptr)
+	, ThumbnailDecoder(nullptr)
+{
+	SelfieRingBaseFrames = Owner->SelfieLength / Owner->SelfieFrameDelay;
+	SelfieFramesMax = SelfieRingBaseFrames;
+	CaptureScheduler.Reset(Owner->SelfieFrameDelay);
+}
+
+FSelfieCaptureSession::~FSelfieCaptureSession()
+{
+	if (HasCaptureResources())
+	{
+		ReleaseCaptureResources();
+	}
+}
+
+AUTPlayerController* FSelfieCaptureSession::GetPlayerController() const
+{
+	if (SelfieWorld == nullptr || PlayerIndex >= GEngine->GetNumGamePlayers(SelfieWorld))
+	{
+		return nullptr;
+	}
+
+	ULocalPlayer* LocalPlayer = GEngine->GetGamePlayer(SelfieWorld, PlayerIndex);
+	return LocalPlayer ? Cast<AUTPlayerController>(LocalPlayer->PlayerController) : nullptr;
+}
+
+void FSelfieCaptureSession::GetViewportRect(FVector2D& OutOrigin, FVector2D& OutSize) const
+{
+	OutOrigin = FVector2D(0.0f, 0.0f);
+	OutSize = FVector2D(1.0f, 1.0f);
+
+	// Split-screen layout, the whole window otherwise
+	if (SelfieWorld != nullptr && PlayerIndex < GEngine->GetNumGamePlayers(SelfieWorld))
+	{
+		ULocalPlayer* LocalPlayer = GEngine->GetGamePlayer(SelfieWorld, PlayerIndex);
+		if (LocalPlayer && LocalPlayer->Size.X > 0 && LocalPlayer->Size.Y > 0)
+		{
+			OutOrigin = LocalPlayer->Origin;
+			OutSize = LocalPlayer->Size;
+		}
+	}
+}
+
+bool FSelfieCaptureSession::IsCapturingFirstPerson() const
+{
+	return bFirstPerson || Owner->CaptureGovernor.GetCurrentLevel().bForceFirstPerson;
+}
+
+void FSelfieCaptureSession::EnsureCaptureResources(UWorld* World)
+{
+	if (CaptureComponent == nullptr)
+	{
+		CaptureComponent = NewObject<USceneCaptureComponent2D>();
+		CaptureComponent->UpdateBounds();
+		CaptureComponent->AddToRoot();
+		CaptureComponent->TextureTarget = NewObject<UTextureRenderTarget2D>();
+		CaptureComponent->TextureTarget->InitCustomFormat(Owner->SelfieWidth, Owner->SelfieHeight, PF_B8G8R8A8, false);
+		CaptureComponent->TextureTarget->ClearColor = FLinearColor::Black;
+		CaptureComponent->SetVisibility(false);
+	}
+
+	// Follows the capture from world to world rather than having one per world
+	if (CaptureComponent->IsRegistered() && CaptureComponent->GetWorld() != World)
+	{
+		CaptureComponent->UnregisterComponent();
+	}
+	if (!CaptureComponent->IsRegistered() && World->Scene != nullptr)
+	{
+		CaptureComponent->RegisterComponentWithWorld(World);
+	}
+
+	if (!FrameHandoff.IsInitialized())
+	{
+		FrameHandoff.Init(Owner->SelfieWidth, Owner->SelfieHeight, Owner->SelfieReadbackDepth);
+	}
+
+	// Ring images themselves come from the readbacks as they're swapped in, this is just the slots
+	if (SelfieFrameTimes.Num() == 0)
+	{
+		ResizeRing(SelfieRingBaseFrames, SelfieSpillFrames);
+	}
+
+	CaptureIdleTime = 0;
+}
+
+void FSelfieCaptureSession::ReleaseCaptureResources()
+{
+	UE_LOG(LogUTSelfieSession, Display, TEXT("Releasing selfie capture resources for player %d after %.0fs idle"), PlayerIndex, CaptureIdleTime);
+
+	if (CaptureComponent)
+	{
+		if (CaptureComponent->IsRegistered())
+		{
+			CaptureComponent->UnregisterComponent();
+		}
+		// The render target goes with it at the next GC
+		CaptureComponent->RemoveFromRoot();
+		CaptureComponent = nullptr;
+	}
+
+	// Anything still in the spill file's or compressor's queues is freed by their Release
+	FlushCaptureToRing();
+	ConsumeReadbackFrames();
+	FrameHandoff.Release();
+	SpillRing.Release();
+	RingCompressor.Release();
+
+	SelfieSurfaceImages.Empty();
+	SelfieCompressedFrames.Empty();
+	SelfieCompressedBytes = 0;
+	SelfieFrameTimes.Empty();
+	SelfieFrames = 0;
+	HeadFrame = 0;
+	NumBurstFramesInRing = 0;
+	BurstTimeline.Windows.Empty();
+
+	CaptureIdleTime = 0;
+}
+
+void FSelfieCaptureSession::OnWorldDestroyed(UWorld* World)
+{
+	// Can't stay registered with a world that's going away, it gets registered again with the next one captured
+	if (CaptureComponent && CaptureComponent->IsRegistered() && CaptureComponent->GetWorld() == World)
+	{
+		CaptureComponent->UnregisterComponent();
+	}
+
+	if (SelfieWorld == World)
+	{
+		bTakingAnimatedSelfie = false;
+		RecordedNumberOfScoringPlayers = 0;
+		SelfieWorld = nullptr;
+	}
+}
+
+void FSelfieCaptureSession::ApplyGovernorLevel()
+{
+	SceneRenderCounter = 0;
+
+	if (SelfieWorld == nullptr || CaptureComponent == nullptr)
+	{
+		return;
+	}
+
+	const float Scale = Owner->CaptureGovernor.GetCurrentLevel().ResolutionScale;
+	const int32 CaptureWidth = FMath::Max(FMath::RoundToInt(Owner->SelfieWidth * Scale), 16);
+	const int32 CaptureHeight = FMath::Max(FMath::RoundToInt(Owner->SelfieHeight * Scale), 16);
+	UTextureRenderTarget2D* TextureTarget = CaptureComponent->TextureTarget;
+	if (TextureTarget->SizeX != CaptureWidth || TextureTarget->SizeY != CaptureHeight)
+	{
+		// Readback resamples to the clip size, so the clip itself never changes
+		TextureTarget->InitCustomFormat(CaptureWidth, CaptureHeight, PF_B8G8R8A8, false);
+	}
+}
+
+void FSelfieCaptureSession::Tick(float DeltaTime)
+{
+	// A sample that the slate callback didn't get to last frame is stale now
+	bSampleThisFrame = false;
+
+	// The ring sits still while it's being saved and for a moment after, the match recording carries on regardless
+	bool bRingPaused = bStartedAnimatedWritingTask;
+	if (SelfieTimeWaited < 0.5f)
+	{
+		SelfieTimeWaited += DeltaTime;
+		bRingPaused = true;
+	}
+
+	if (!bRingPaused && DelayedEventWriteTimer > 0)
+	{
+		DelayedEventWriteTimer -= DeltaTime;
+		if (DelayedEventWriteTimer < 0)
+		{
+			Owner->RequestSave(TEXT("FlagCapture"), PlayerIndex);
+			bRingPaused = bStartedAnimatedWritingTask;
+		}
+	}
+
+	// Readbacks keep draining while the ring is paused, ConsumeReadbackFrames only hands them to the recorder then
+	const double ConsumeStartTime = FPlatformTime::Seconds();
+	FrameHandoff.Tick();
+	ConsumeReadbackFrames();
+	CaptureWorkSeconds += FPlatformTime::Seconds() - ConsumeStartTime;
+
+	if (!bTakingAnimatedSelfie || SelfieWorld == nullptr)
+	{
+		return;
+	}
+
+	if (bRingPaused && !IsRecordingMatch())
+	{
+		return;
+	}
+
+	AUTPlayerController* UTPC = GetPlayerController();
+	if (UTPC && UTPC->GetPawn() && CaptureComponent)
+	{
+		APawn* Pawn = UTPC->GetPawn();
+
+		FVector NewLocation = Pawn->GetActorLocation();
+		FRotator NewRotation = Pawn->GetActorRotation();
+		NewLocation += (NewRotation.RotateVector(FVector(200, 0, 100)));
+		NewRotation.Yaw += 180;
+		NewRotation.Pitch = -20;
+		CaptureComponent->SetWorldLocationAndRotation(NewLocation, NewRotation, false);
+	}
+
+	bSampleThisFrame = CaptureScheduler.Advance(DeltaTime);
+
+	if (bSampleThisFrame && !IsCapturingFirstPerson() && CaptureComponent)
+	{
+		if (FrameHandoff.CanSubmit())
+		{
+			const double CaptureStartTime = FPlatformTime::Seconds();
+
+			// The governor may only want the scene rendered every few samples, the ones in between read back the last render again
+			if (SceneRenderCounter++ % Owner->CaptureGovernor.GetCurrentLevel().SceneRenderDivisor == 0)
+			{
+				// Render the scene capture just for this frame instead of leaving it visible and paying for it every frame
+				CaptureComponent->SetVisibility(true);
+				CaptureComponent->UpdateContent();
+				CaptureComponent->SetVisibility(false);
+				bCapturedSinceLastTick = true;
+			}
+
+			FRenderTarget* RenderTarget = CaptureComponent->TextureTarget->GameThread_GetRenderTargetResource();
+			FrameHandoff.SubmitRenderTarget(RenderTarget, CaptureStartTime);
+
+			CaptureWorkSeconds += FPlatformTime::Seconds() - CaptureStartTime;
+		}
+		else
+		{
+			CaptureScheduler.MarkMissed();
+		}
+		bSampleThisFrame = false;
+	}
+
+	// Try to autorecord if this session's player caps the flag, caps while the ring's paused get picked up after
+	AUTCTFGameState* GS = Cast<AUTCTFGameState>(SelfieWorld->GetGameState());
+	if (!bRingPaused && GS && UTPC && UTPC->PlayerState)
+	{
+		if (RecordedNumberOfScoringPlayers < GS->GetScoringPlays().Num())
+		{
+			RecordedNumberOfScoringPlayers++;
+
+			if (GS->GetScoringPlays()[GS->GetScoringPlays().Num() - 1].ScoredBy.GetPlayerName() == UTPC->PlayerState->PlayerName)
+			{
+				// The celebration gets the high rate, the save waits for it to finish
+				BeginBurst();
+				DelayedEventWriteTimer = FMath::Max(2.0f, Owner->SelfieBurstSeconds + 0.5f);
+			}
+		}
+	}
+}
+
+void FSelfieCaptureSession::CaptureViewport(const FViewportRHIRef& ViewportRHI)
+{
+	// Tick only asks for samples the ring or the match recording wants
+	if (!bTakingAnimatedSelfie || !IsCapturingFirstPerson() || !bSampleThisFrame)
+	{
+		return;
+	}
+
+	if (FrameHandoff.CanSubmit())
+	{
+		const double CaptureStartTime = FPlatformTime::Seconds();
+		FVector2D ViewOrigin;
+		FVector2D ViewSize;
+		GetViewportRect(ViewOrigin, ViewSize);
+		FrameHandoff.SubmitViewport(ViewportRHI, CaptureStartTime, ViewOrigin, ViewSize);
+		CaptureWorkSeconds += FPlatformTime::Seconds() - CaptureStartTime;
+		bCapturedSinceLastTick = true;
+	}
+	else
+	{
+		CaptureScheduler.MarkMissed();
+	}
+	bSampleThisFrame = false;
+}
+
+bool FSelfieCaptureSession::IsRecordingMatch() const
+{
+	return SegmentRecorder != nullptr && SegmentRecorder->IsRecording();
+}
+
+void FSelfieCaptureSession::ConsumeReadbackFrames()
+{
+	// Spilled frames are on disk now, they can go back to the render thread
+	while (FSelfieReadbackFrame* Spilled = SpillRing.DequeueWritten())
+	{
+		FrameHandoff.Recycle(Spilled);
+	}
+
+	while (FSelfieReadbackFrame* Frame = FrameHandoff.Dequeue())
+	{
+		const bool bBurstFrame = BurstTimeline.IsBurstTime(Frame->CaptureTime);
+
+		// The match recording is fixed rate, it only gets burst frames that land on a base rate slot
+		if (IsRecordingMatch() && (!bBurstFrame || Frame->CaptureTime >= LastRecordedFrameTime + Owner->SelfieFrameDelay * 0.875))
+		{
+			SegmentRecorder->PushFrame(Frame->Pixels, Frame->CaptureTime);
+			LastRecordedFrameTime = Frame->CaptureTime;
+		}
+
+		if (bStartedAnimatedWritingTask)
+		{
+			// The save worker is reading the ring, this one was only for the recording
+			FrameHandoff.Recycle(Frame);
+		}
+		else if (IsRingCompressed())
+		{
+			// Into the ring once the ingest thread has coded it, below
+			RingCompressor.Push(Frame);
+		}
+		else
+		{
+			AddToRing(Frame);
+		}
+	}
+
+	// Left queued while a save is reading the ring, they go in after it
+	while (!bStartedAnimatedWritingTask)
+	{
+		FSelfieReadbackFrame* Compressed = RingCompressor.DequeueCompressed();
+		if (Compressed == nullptr)
+		{
+			break;
+		}
+		AddToRing(Compressed);
+	}
+
+	if (SelfieFrames > 0 && BurstTimeline.Windows.Num() > 0)
+	{
+		// Spilled frame times aren't safe to look at while the spill thread is writing, give those a generous guess
+		const double OldestTime = SpillRing.IsActive() ? FPlatformTime::Seconds() - 2.0 * (SelfieFramesMax + SpillRing.GetCapacity()) * Owner->SelfieFrameDelay :
+			SelfieFrameTimes[GetRingSlot(0)];
+		BurstTimeline.Prune(OldestTime);
+	}
+}
+
+void FSelfieCaptureSession::AddToRing(FSelfieReadbackFrame* Frame)
+{
+	const bool bCompressed = IsRingCompressed();
+	if (!SpillRing.IsActive())
+	{
+		const bool bBurstFrame = BurstTimeline.IsBurstTime(Frame->CaptureTime);
+
+		// Slots past the base ring are only used while there are burst frames in it to pay for them, so a burst
+		// doesn't eat into the pre-roll and the memory goes back once it's aged out
+		bool bEvictedAny = false;
+		while (SelfieFrames > 0)
+		{
+			const int32 NumBurstFrames = NumBurstFramesInRing + (bBurstFrame ? 1 : 0);
+			const int32 Oldest = GetRingSlot(0);
+			const bool bOverSlots = SelfieFrames + 1 > FMath::Min(SelfieRingBaseFrames * SelfieRingCompressScale + NumBurstFrames, SelfieFramesMax);
+			// Compressed frames hold as many as fit in the raw ring's memory, and the deltas after an aged out key frame go with it
+			const bool bOverBudget = bCompressed && SelfieCompressedBytes + Frame->Compressed.Num() > GetCompressedBudget(NumBurstFrames);
+			const bool bOrphaned = bCompressed && bEvictedAny && !FSelfieFrameCodec::IsKeyFrame(SelfieCompressedFrames[Oldest]);
+			if (!bOverSlots && !bOverBudget && !bOrphaned)
+			{
+				break;
+			}
+
+			if (BurstTimeline.IsBurstTime(SelfieFrameTimes[Oldest]))
+			{
+				NumBurstFramesInRing--;
+			}
+			if (bCompressed)
+			{
+				SelfieCompressedBytes -= SelfieCompressedFrames[Oldest].Num();
+				SelfieCompressedFrames[Oldest].Empty();
+			}
+			else if (!bEvictedAny)
+			{
+				// Into the head slot so it goes back to the render thread below, same as a full ring
+				Exchange(SelfieSurfaceImages[Oldest], SelfieSurfaceImages[HeadFrame]);
+			}
+			else
+			{
+				SelfieSurfaceImages[Oldest].Empty();
+			}
+			bEvictedAny = true;
+			SelfieFrames--;
+		}
+
+		if (bCompressed && SelfieFrames == 0 && !FSelfieFrameCodec::IsKeyFrame(Frame->Compressed))
+		{
+			// Nothing to decode it from, the ring starts again at the next key frame
+			FrameHandoff.Recycle(Frame);
+			return;
+		}
+		NumBurstFramesInRing += bBurstFrame ? 1 : 0;
+	}
+
+	if (bCompressed)
+	{
+		// The readback keeps its pixels for the render thread, the ring only wants the compressed copy
+		Exchange(SelfieCompressedFrames[HeadFrame], Frame->Compressed);
+		SelfieCompressedBytes += SelfieCompressedFrames[HeadFrame].Num();
+	}
+	else
+	{
+		// Swap rather than copy, the frame goes back to the render thread holding the oldest ring image
+		Exchange(SelfieSurfaceImages[HeadFrame], Frame->Pixels);
+	}
+	Exchange(SelfieFrameTimes[HeadFrame], Frame->CaptureTime);
+	if (SpillRing.IsActive() && SelfieFrames == SelfieFramesMax)
+	{
+		// Unless there's a spill file, then the oldest image goes there first. If the disk is behind it's lost instead
+		if (!SpillRing.Push(Frame))
+		{
+			FrameHandoff.Recycle(Frame);
+		}
+	}
+	else
+	{
+		FrameHandoff.Recycle(Frame);
+	}
+
+	SelfieFrames = FMath::Min(SelfieFrames + 1, SelfieFramesMax);
+	HeadFrame += 1;
+	HeadFrame %= SelfieFramesMax;
+}
+
+int64 FSelfieCaptureSession::GetCompressedBudget(int32 NumBurstFrames) const
+{
+	const int32 BurstHeadroom = SelfieFramesMax / SelfieRingCompressScale - SelfieRingBaseFrames;
+	return (int64)(SelfieRingBaseFrames + FMath::Min(NumBurstFrames, BurstHeadroom)) * Owner->SelfieWidth * Owner->SelfieHeight * sizeof(FColor);
+}
+
+void FSelfieCaptureSession::BeginBurst()
+{
+	if (Owner->SelfieBurstRate <= Owner->SelfieFrameRate || !bTakingAnimatedSelfie || bStartedAnimatedWritingTask)
+	{
+		return;
+	}
+
+	// Readbacks already in flight were captured before now, they stay base rate frames
+	const float BurstSeconds = BurstTimeline.Begin(FPlatformTime::Seconds(), Owner->SelfieBurstSeconds);
+	if (BurstSeconds > 0)
+	{
+		CaptureScheduler.BeginBurst(1.0f / Owner->SelfieBurstRate, BurstSeconds);
+	}
+}
+
+void FSelfieCaptureSession::FlushCaptureToRing()
+{
+	FrameHandoff.Flush();
+	ConsumeReadbackFrames();
+}
+
+void FSelfieCaptureSession::ResizeRing(int32 HotFrames, int32 SpillFrames)
+{
+	ConsumeReadbackFrames();
+
+	// Burst headroom goes in the spill file when there is one, disk is cheap and the hot ring there is only a second or so
+	const int32 BurstHeadroom = Owner->GetBurstHeadroomFrames();
+	SelfieRingBaseFrames = FMath::Max(HotFrames, 1);
+	SelfieFramesMax = SelfieRingBaseFrames + (SpillFrames > 0 ? 0 : BurstHeadroom);
+
+	// Compression needs a thread and the spill file wants raw frames anyway, so it's one or the other
+	if (Owner->bCompressSelfieRing && SpillFrames == 0)
+	{
+		SelfieRingCompressScale = FMath::Max(Owner->SelfieRingCompressScale, 1);
+		SelfieFramesMax *= SelfieRingCompressScale;
+		SelfieSurfaceImages.Empty();
+		SelfieCompressedFrames.Empty(SelfieFramesMax);
+		SelfieCompressedFrames.SetNum(SelfieFramesMax);
+		RingCompressor.Init(Owner->SelfieWidth, Owner->SelfieHeight, Owner->SelfieRingKeyInterval);
+	}
+	else
+	{
+		SelfieRingCompressScale = 1;
+		SelfieSurfaceImages.SetNum(SelfieFramesMax);
+		SelfieCompressedFrames.Empty();
+		RingCompressor.Release();
+	}
+	SelfieCompressedBytes = 0;
+	SelfieFrameTimes.Init(0, SelfieFramesMax);
+	SelfieFrames = 0;
+	HeadFrame = 0;
+	NumBurstFramesInRing = 0;
+	SelfieSpillFrames = SpillFrames;
+
+	if (SpillFrames > 0)
+	{
+		const FString SpillPath = FPaths::GameSavedDir() / TEXT("Selfie") / FString::Printf(TEXT("SelfieSpill%s.bin"), *GetFileSuffix());
+		SpillRing.Init(SpillPath, Owner->SelfieWidth, Owner->SelfieHeight, SpillFrames + BurstHeadroom);
+	}
+	else
+	{
+		SpillRing.Release();
+	}
+}
+
+void FSelfieCaptureSession::BeginReadRing()
+{
+	SavedHeadFrame = HeadFrame;
+	HeadFrame = GetRingSlot(0);
+
+	// Whatever is on disk by now, frames still waiting to be written sit it out
+	if (SpillRing.IsActive())
+	{
+		SpillRing.BeginRead();
+	}
+
+	if (IsRingCompressed())
+	{
+		RingDecoder = new FSelfieRingDecoder(Owner->SelfieWidth, Owner->SelfieHeight, FSelfieGetCompressedFrame::CreateRaw(this, &FSelfieCaptureSession::GetSavedCompressedFrame));
+		// The thumbnails copy each frame out as soon as they have it, the target and the two decoded on the way are plenty
+		ThumbnailDecoder = new FSelfieRingDecoder(Owner->SelfieWidth, Owner->SelfieHeight, FSelfieGetCompressedFrame::CreateRaw(this, &FSelfieCaptureSession::GetSavedCompressedFrame), 3);
+	}
+}
+
+void FSelfieCaptureSession::EndReadRing()
+{
+	if (RingDecoder)
+	{
+		UE_LOG(LogUTSelfieSession, Display, TEXT("Decoded %d ring frames for player %d, %.2fms each"), RingDecoder->GetFramesDecoded(), PlayerIndex,
+			RingDecoder->GetFramesDecoded() > 0 ? RingDecoder->GetDecodeSeconds() * 1000.0 / RingDecoder->GetFramesDecoded() : 0.0);
+		delete RingDecoder;
+		RingDecoder = nullptr;
+		delete ThumbnailDecoder;
+		ThumbnailDecoder = nullptr;
+	}
+
+	if (SpillRing.IsActive())
+	{
+		SpillRing.EndRead();
+	}
+
+	// Capture carries on where it was
+	HeadFrame = SavedHeadFrame;
+}
+
+const FColor* FSelfieCaptureSession::GetSavedFrame(int32 FrameIndex)
+{
+	return GetSavedFrameWith(RingDecoder, FrameIndex);
+}
+
+const FColor* FSelfieCaptureSession::GetSavedThumbnailFrame(int32 FrameIndex)
+{
+	return GetSavedFrameWith(ThumbnailDecoder, FrameIndex);
+}
+
+const FColor* FSelfieCaptureSession::GetSavedFrameWith(FSelfieRingDecoder* Decoder, int32 FrameIndex)
+{
+	// Spilled frames are all older than anything in the hot ring
+	const int32 NumSpilledFrames = SpillRing.GetNumFrames();
+	if (FrameIndex < NumSpilledFrames)
+	{
+		return SpillRing.GetFrame(FrameIndex);
+	}
+	FrameIndex -= NumSpilledFrames;
+
+	if (Decoder)
+	{
+		return Decoder->GetFrame(FrameIndex);
+	}
+	return SelfieSurfaceImages[(HeadFrame + FrameIndex) % SelfieFramesMax].GetData();
+}
+
+const TArray<uint8>* FSelfieCaptureSession::GetSavedCompressedFrame(int32 FrameIndex)
+{
+	return &SelfieCompressedFrames[(HeadFrame + FrameIndex) % SelfieFramesMax];
+}
+
+double FSelfieCaptureSession::GetSavedFrameTime(int32 FrameIndex)
+{
+	const int32 NumSpilledFrames = SpillRing.GetNumFrames();
+	if (FrameIndex < NumSpilledFrames)
+	{
+		return SpillRing.GetFrameTime(FrameIndex);
+	}
+	FrameIndex -= NumSpilledFrames;
+
+	return SelfieFrameTimes[(HeadFrame + FrameIndex) % SelfieFramesMax];
+}
+
+void FSelfieCaptureSession::FinishSave()
+{
+	// Only a finished clip empties the ring, after a failed or cancelled save it's still there to try again
+	if (!bActiveSaveIsDump && ActiveSave->GetState() == ESelfieSaveState::Succeeded)
+	{
+		SpillRing.Reset();
+		if (IsRingCompressed())
+		{
+			// The budget only counts what's in the ring, and the next frame has nothing before it to be a delta against
+			for (TArray<uint8>& Compressed : SelfieCompressedFrames)
+			{
+				Compressed.Empty();
+			}
+			SelfieCompressedBytes = 0;
+			RingCompressor.ForceKeyFrame();
+
+			// Compressed while the save was reading, older than anything the ring gets now
+			while (FSelfieReadbackFrame* Stale = RingCompressor.DequeueCompressed())
+			{
+				FrameHandoff.Recycle(Stale);
+			}
+		}
+		SelfieFrames = 0;
+		HeadFrame = 0;
+		NumBurstFramesInRing = 0;
+		BurstTimeline.Windows.Empty();
+	}
+
+	SelfieTimeWaited = 0;
+	bStartedAnimatedWritingTask = false;
+	ActiveSave.Reset();
+}
+
+FString FSelfieCaptureSession::GetFileSuffix() const
+{
+	return PlayerIndex > 0 ? FString::Printf(TEXT("_P%d"), PlayerIndex + 1) : FString();
+}
+
+void FSelfieCaptureSession::LogStats(FOutputDevice& Ar) const
+{
+	Ar.Logf(TEXT("Player %d: %s%s, %d of %d frames in the ring%s"), PlayerIndex, bTakingAnimatedSelfie ? TEXT("capturing") : TEXT("stopped"),
+		bTakingAnimatedSelfie ? (IsCapturingFirstPerson() ? TEXT(" first person") : TEXT(" third person")) : TEXT(""),
+		SelfieFrames, SelfieFramesMax, bStartedAnimatedWritingTask ? TEXT(", saving") : TEXT(""));
+	if (SelfieFramesMax > SelfieRingBaseFrames || NumBurstFramesInRing > 0)
+	{
+		Ar.Logf(TEXT("  %d base frames, %d burst frames in the ring"), SelfieRingBaseFrames, NumBurstFramesInRing);
+	}
+	if (IsRingCompressed())
+	{
+		Ar.Logf(TEXT("  Compressed ring %.1f of %.1f MB, %.1fs held"), SelfieCompressedBytes / (1024.0 * 1024.0), GetCompressedBudget(NumBurstFramesInRing) / (1024.0 * 1024.0),
+			SelfieFrames > 0 ? SelfieFrameTimes[(HeadFrame - 1 + SelfieFramesMax) % SelfieFramesMax] - SelfieFrameTimes[GetRingSlot(0)] : 0.0);
+		RingCompressor.LogStats(Ar);
+	}
+	CaptureScheduler.LogStats(Ar);
+	SpillRing.LogStats(Ar);
+}
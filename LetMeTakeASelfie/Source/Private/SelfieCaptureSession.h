@@ -0,0 +1,158 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieCaptureScheduler.h"
+#include "SelfieFrameHandoff.h"
+#include "SelfieSpillRing.h"
+#include "SelfieRingCompression.h"
+#include "SelfieSaveTask.h"
+#include "SelfieBurst.h"
+
+struct FLetMeTakeASelfie;
+class FSelfieSegmentRecorder;
+class AUTPlayerController;
+
+/**
+ * Everything that's captured for one viewpoint: a local player's first person view or a camera following their pawn,
+ * its own scene capture, readbacks, ring and spill file, its own pacing and flag cap trigger, and the save running
+ * from its ring. Split-screen gets a session per player, and they all save through the module's shared encode pool.
+ *
+ * Clip size, frame rate and encoder settings are the module's and the same for every session. Game thread unless
+ * it says otherwise, the save worker only reads the ring while ActiveSave is running.
+ */
+class FSelfieCaptureSession
+{
+public:
+	FSelfieCaptureSession(FLetMeTakeASelfie* InOwner, int32 InPlayerIndex);
+	~FSelfieCaptureSession();
+
+	/** Index into the world's local players, 0 is the only one outside split-screen */
+	int32 PlayerIndex;
+	AUTPlayerController* GetPlayerController() const;
+	/** Part of the viewport the player's view covers, 0-1 */
+	void GetViewportRect(FVector2D& OutOrigin, FVector2D& OutSize) const;
+
+	UWorld* SelfieWorld;
+	bool bTakingAnimatedSelfie;
+	bool bFirstPerson;
+	/** The governor can fall back to first person even when third person was asked for */
+	bool IsCapturingFirstPerson() const;
+
+	/** This session's scene capture, registered with whichever world it's capturing */
+	USceneCaptureComponent2D* CaptureComponent;
+	/** Makes whatever capture in World needs that isn't there yet, so map loads and idle sessions pay for none of it */
+	void EnsureCaptureResources(UWorld* World);
+	/** Frees the scene capture, staging textures, ring and spill file, the next SELFIEANIM makes them again */
+	void ReleaseCaptureResources();
+	bool HasCaptureResources() const { return CaptureComponent != nullptr || FrameHandoff.IsInitialized() || SelfieFrameTimes.Num() > 0; }
+	float CaptureIdleTime;
+	void OnWorldDestroyed(UWorld* World);
+
+	FSelfieCaptureScheduler CaptureScheduler;
+	// Set by Tick when the scheduler wants this frame, consumed by whichever capture path is active
+	bool bSampleThisFrame;
+	int32 SceneRenderCounter;
+	/** Resizes the scene capture for the governor's current level */
+	void ApplyGovernorLevel();
+	// What capture did since the module last asked, summed over sessions for the governor
+	bool bCapturedSinceLastTick;
+	double CaptureWorkSeconds;
+
+	/** Moves the camera, samples and watches for a flag cap, after the module has ticked the governor */
+	void Tick(float DeltaTime);
+	/** Slate callback for the first person path, Viewport is the whole game window */
+	void CaptureViewport(const FViewportRHIRef& ViewportRHI);
+
+	// Capturing in a ring buffer, this is the current head
+	int32 HeadFrame;
+	int32 SelfieFrames;
+	/** Slots, the base ring plus burst headroom when there's no spill file */
+	int32 SelfieFramesMax;
+	/** Frames the ring holds at the base rate, the rest of the slots only fill up with a burst in the ring. Frames of memory when it's compressed */
+	int32 SelfieRingBaseFrames;
+	TArray< TArray<FColor> > SelfieSurfaceImages;
+	/** Instead of SelfieSurfaceImages when the ring is compressed, the oldest one is always a key frame */
+	TArray< TArray<uint8> > SelfieCompressedFrames;
+	int64 SelfieCompressedBytes;
+	/** Slots per frame of memory, 1 for a raw ring */
+	int32 SelfieRingCompressScale;
+	bool IsRingCompressed() const { return RingCompressor.IsActive(); }
+	/** FPlatformTime::Seconds() each ring image was captured at */
+	TArray<double> SelfieFrameTimes;
+	/** Ring slot for the frame Age frames after the oldest */
+	int32 GetRingSlot(int32 Age) const { return (HeadFrame - SelfieFrames + Age + SelfieFramesMax) % SelfieFramesMax; }
+
+	/** When the ring was sampled at the burst rate */
+	FSelfieBurstTimeline BurstTimeline;
+	/** Hot ring frames inside BurstTimeline, each one buys a headroom slot */
+	int32 NumBurstFramesInRing;
+	/** Samples at the module's burst rate for its burst length, from the next frame. Nothing while saving or with bursts off */
+	void BeginBurst();
+
+	/** Staging readbacks in flight for both the first person and scene capture paths */
+	FSelfieFrameHandoff FrameHandoff;
+	/** Whole match recording when it's following this session, fed from the same readbacks as the ring */
+	FSelfieSegmentRecorder* SegmentRecorder;
+	bool IsRecordingMatch() const;
+	/** Moves finished readbacks into the ring and the match recording, only the recording while a save is reading the ring */
+	void ConsumeReadbackFrames();
+	/** Gets everything captured so far into the ring, used before reading the ring back. The spill file and compressor aren't waited on, a save reads what they've finished */
+	void FlushCaptureToRing();
+
+	/** Codes frames for SelfieCompressedFrames, only with no spill file since the spill file wants them raw */
+	FSelfieRingCompressor RingCompressor;
+	/** Bytes the compressed ring may hold with NumBurstFrames in it, what the raw ring would have had */
+	int64 GetCompressedBudget(int32 NumBurstFrames) const;
+
+	/** Optional disk tier behind SelfieSurfaceImages, frames leaving the hot ring land here */
+	FSelfieSpillRing SpillRing;
+	/** Rebuilds the ring as HotFrames in memory plus SpillFrames on disk, drops whatever was captured */
+	void ResizeRing(int32 HotFrames, int32 SpillFrames);
+	/** Last SpillFrames, so the spill file comes back after a release */
+	int32 SelfieSpillFrames;
+	/** Hot plus spilled frames */
+	int32 GetSavedFrameCount() const { return SelfieFrames + SpillRing.GetNumFrames(); }
+
+	/** Save worker. Ring frame by age, 0 is the oldest frame being saved */
+	const FColor* GetSavedFrame(int32 FrameIndex);
+	/** Save worker. Same as GetSavedFrame with a decoder of its own, for the thumbnails that pick frames from all over */
+	const FColor* GetSavedThumbnailFrame(int32 FrameIndex);
+	double GetSavedFrameTime(int32 FrameIndex);
+	/** Save worker. Points the ring at its oldest frame for GetSavedFrame and back again afterwards, and decodes it if it's compressed */
+	void BeginReadRing();
+	void EndReadRing();
+
+	/** The save running from this ring, cleared by FinishSave */
+	FSelfieSaveHandle ActiveSave;
+	bool bActiveSaveIsDump;
+	bool bStartedAnimatedWritingTask;
+	// Grabbed on the game thread when a save starts, WriteWebM puts it in the catalog
+	FString SelfieSaveMapName;
+	/** Last clip when SelfieOutputSpec is "memory", don't touch while a save is running */
+	TArray<uint8> SelfieMemoryClip;
+	/** Puts the capture state back once ActiveSave is done, the worker leaves it alone */
+	void FinishSave();
+
+	/** Flag cap trigger */
+	int32 RecordedNumberOfScoringPlayers;
+	float DelayedEventWriteTimer;
+	float SelfieTimeWaited;
+
+	/** Appended to dump and spill file names so sessions don't trip over each other, empty for player 0 */
+	FString GetFileSuffix() const;
+
+	void LogStats(FOutputDevice& Ar) const;
+
+private:
+	FLetMeTakeASelfie* Owner;
+	int32 SavedHeadFrame;
+	double LastRecordedFrameTime;
+
+	/** Takes a readback into the head of the ring, aging out what it has to */
+	void AddToRing(FSelfieReadbackFrame* Frame);
+	/** Only while a compressed ring is being read */
+	FSelfieRingDecoder* RingDecoder;
+	FSelfieRingDecoder* ThumbnailDecoder;
+	const TArray<uint8>* GetSavedCompressedFrame(int32 FrameIndex);
+	const FColor* GetSavedFrameWith(FSelfieRingDecoder* Decoder, int32 FrameIndex);
+};
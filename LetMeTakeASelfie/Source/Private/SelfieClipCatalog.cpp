@@ -0,0 +1,234 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieClipCatalog.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieCatalog, Log, All);
+
+FSelfieClipRecord::FSelfieClipRecord()
+	: Index(0)
+	, Time(0)
+	, DurationSeconds(0)
+	, NumFrames(0)
+	, SizeBytes(0)
+	, Width(0)
+	, Height(0)
+	, FrameRate(0)
+	, TargetBitrate(0)
+	, Deadline(0)
+{
+}
+
+FArchive& operator<<(FArchive& Ar, FSelfieClipRecord& Record)
+{
+	Ar << Record.Index;
+	Ar << Record.Time;
+	Ar << Record.MapName;
+	Ar << Record.Trigger;
+	Ar << Record.Path;
+	Ar << Record.DurationSeconds;
+	Ar << Record.NumFrames;
+	Ar << Record.SizeBytes;
+	Ar << Record.Codec;
+	Ar << Record.Width;
+	Ar << Record.Height;
+	Ar << Record.FrameRate;
+	Ar << Record.TargetBitrate;
+	Ar << Record.Deadline;
+	return Ar;
+}
+
+FSelfieClipCatalog::FSelfieClipCatalog()
+	: bLoaded(false)
+	, NextIndex(1)
+{
+}
+
+void FSelfieClipCatalog::SetPath(const FString& InPath)
+{
+	FScopeLock Lock(&CatalogLock);
+	Path = InPath;
+	bLoaded = false;
+}
+
+void FSelfieClipCatalog::LoadIfNeeded()
+{
+	if (bLoaded)
+	{
+		return;
+	}
+	bLoaded = true;
+
+	if (Path.IsEmpty())
+	{
+		Path = FPaths::ScreenShotDir() / TEXT("UTSelfieCatalog.bin");
+	}
+
+	Clips.Empty();
+	NextIndex = 1;
+
+	TArray<uint8> Contents;
+	if (!FFileHelper::LoadFileToArray(Contents, *Path, FILEREAD_Silent))
+	{
+		ScanClipFiles();
+		return;
+	}
+
+	FMemoryReader Reader(Contents);
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	Reader << Magic;
+	Reader << Version;
+	if (Reader.IsError() || Magic != CatalogMagic || Version != CatalogVersion)
+	{
+		UE_LOG(LogUTSelfieCatalog, Warning, TEXT("Ignoring unreadable clip catalog %s"), *Path);
+		IFileManager::Get().Move(*(Path + TEXT(".bad")), *Path);
+		ScanClipFiles();
+		return;
+	}
+
+	int64 GoodLength = Reader.Tell();
+	while (Reader.Tell() + 5 <= Contents.Num())
+	{
+		uint8 RecordType = 0;
+		uint32 PayloadSize = 0;
+		Reader << RecordType;
+		Reader << PayloadSize;
+		if (Reader.Tell() + PayloadSize > Contents.Num())
+		{
+			break;
+		}
+
+		const int64 PayloadStart = Reader.Tell();
+		if (RecordType == RecordType_Reserve)
+		{
+			int32 Index = 0;
+			Reader << Index;
+			NextIndex = FMath::Max(NextIndex, Index + 1);
+		}
+		else if (RecordType == RecordType_Clip)
+		{
+			FSelfieClipRecord& Record = Clips[Clips.AddDefaulted()];
+			Reader << Record;
+			NextIndex = FMath::Max(NextIndex, Record.Index + 1);
+		}
+
+		// Skip whatever a newer version might have tacked on
+		Reader.Seek(PayloadStart + PayloadSize);
+		GoodLength = Reader.Tell();
+	}
+
+	if (GoodLength < Contents.Num())
+	{
+		UE_LOG(LogUTSelfieCatalog, Warning, TEXT("Clip catalog had %d bytes of torn record at the end, trimming"), (int32)(Contents.Num() - GoodLength));
+		Contents.SetNum(GoodLength);
+		FFileHelper::SaveArrayToFile(Contents, *Path);
+	}
+}
+
+void FSelfieClipCatalog::ScanClipFiles()
+{
+	// Clips already on disk still own their numbers, they mustn't start over just because the catalog did
+	TArray<FString> ClipFiles;
+	IFileManager::Get().FindFiles(ClipFiles, *(FPaths::ScreenShotDir() / TEXT("UTSelfie*.webm")), true, false);
+	for (const FString& ClipFile : ClipFiles)
+	{
+		const FString Number = ClipFile.Mid(8);
+		if (Number.Len() > 0 && FChar::IsDigit(Number[0]))
+		{
+			NextIndex = FMath::Max(NextIndex, FCString::Atoi(*Number) + 1);
+		}
+	}
+}
+
+bool FSelfieClipCatalog::AppendRecord(uint8 RecordType, TArray<uint8>& Payload)
+{
+	const bool bNewFile = IFileManager::Get().FileSize(*Path) <= 0;
+
+	FArchive* Writer = IFileManager::Get().CreateFileWriter(*Path, FILEWRITE_Append);
+	if (Writer == nullptr)
+	{
+		return false;
+	}
+
+	if (bNewFile)
+	{
+		uint32 Magic = CatalogMagic;
+		uint32 Version = CatalogVersion;
+		*Writer << Magic;
+		*Writer << Version;
+	}
+
+	uint32 PayloadSize = Payload.Num();
+	*Writer << RecordType;
+	*Writer << PayloadSize;
+	Writer->Serialize(Payload.GetData(), Payload.Num());
+
+	const bool bSuccess = !Writer->IsError();
+	delete Writer;
+
+	return bSuccess;
+}
+
+int32 FSelfieClipCatalog::ReserveIndex()
+{
+	FScopeLock Lock(&CatalogLock);
+	LoadIfNeeded();
+
+	int32 Index = NextIndex++;
+
+	TArray<uint8> Payload;
+	FMemoryWriter Writer(Payload);
+	Writer << Index;
+	if (!AppendRecord(RecordType_Reserve, Payload))
+	{
+		UE_LOG(LogUTSelfieCatalog, Warning, TEXT("Couldn't write to clip catalog %s"), *Path);
+	}
+
+	return Index;
+}
+
+bool FSelfieClipCatalog::AddClip(const FSelfieClipRecord& Record)
+{
+	FScopeLock Lock(&CatalogLock);
+	LoadIfNeeded();
+
+	FSelfieClipRecord& Added = Clips[Clips.Add(Record)];
+	NextIndex = FMath::Max(NextIndex, Added.Index + 1);
+
+	TArray<uint8> Payload;
+	FMemoryWriter Writer(Payload);
+	Writer << Added;
+
+	return AppendRecord(RecordType_Clip, Payload);
+}
+
+void FSelfieClipCatalog::Query(const FSelfieClipQuery& Query, TArray<FSelfieClipRecord>& OutRecords)
+{
+	FScopeLock Lock(&CatalogLock);
+	LoadIfNeeded();
+
+	OutRecords.Empty();
+	for (int32 i = Clips.Num() - 1; i >= 0; i--)
+	{
+		const FSelfieClipRecord& Record = Clips[i];
+		if ((Query.MapName.IsEmpty() || Record.MapName == Query.MapName)
+			&& (Query.Trigger.IsEmpty() || Record.Trigger == Query.Trigger)
+			&& Record.Time >= Query.Since)
+		{
+			OutRecords.Add(Record);
+			if (Query.MaxResults > 0 && OutRecords.Num() >= Query.MaxResults)
+			{
+				break;
+			}
+		}
+	}
+}
+
+int32 FSelfieClipCatalog::Num()
+{
+	FScopeLock Lock(&CatalogLock);
+	LoadIfNeeded();
+
+	return Clips.Num();
+}
@@ -0,0 +1,86 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+/** Everything we know about a saved clip */
+struct FSelfieClipRecord
+{
+	int32 Index;
+	FDateTime Time;
+	FString MapName;
+	/** What kicked off the save, Manual or FlagCapture so far */
+	FString Trigger;
+	FString Path;
+	float DurationSeconds;
+	int32 NumFrames;
+	int64 SizeBytes;
+
+	// Encoder settings
+	FString Codec;
+	int32 Width;
+	int32 Height;
+	int32 FrameRate;
+	int32 TargetBitrate;
+	int32 Deadline;
+
+	FSelfieClipRecord();
+
+	friend FArchive& operator<<(FArchive& Ar, FSelfieClipRecord& Record);
+};
+
+/** Empty fields match everything */
+struct FSelfieClipQuery
+{
+	FString MapName;
+	FString Trigger;
+	FDateTime Since;
+	/** 0 for no limit */
+	int32 MaxResults;
+
+	FSelfieClipQuery() : Since(0), MaxResults(0) {}
+};
+
+/**
+ * Append-only catalog of saved clips, replaces probing the screenshot dir for a free UTSelfie%05i.webm.
+ *
+ * The file is a short header followed by size prefixed records. Reserving an index appends a tiny record so the
+ * number survives a crash mid-save, finishing a clip appends the full metadata. The whole thing is read once on first
+ * use and kept in memory, so allocating is a counter bump and listing never touches the directory. The directory is
+ * listed once at load so a lost catalog doesn't start the numbers over the top of clips that are still there.
+ * A torn record at the end from a crash gets cut off on load.
+ */
+class FSelfieClipCatalog
+{
+public:
+	FSelfieClipCatalog();
+
+	/** Defaults to UTSelfieCatalog.bin in the screenshot dir, call before first use */
+	void SetPath(const FString& InPath);
+
+	/** Next clip number past everything in the catalog and the screenshot dir, persisted before returning */
+	int32 ReserveIndex();
+
+	/** Appends a finished clip */
+	bool AddClip(const FSelfieClipRecord& Record);
+
+	/** Newest first */
+	void Query(const FSelfieClipQuery& Query, TArray<FSelfieClipRecord>& OutRecords);
+
+	int32 Num();
+
+	static FString GetClipFileName(int32 Index) { return FString::Printf(TEXT("UTSelfie%05i"), Index); }
+
+private:
+	enum { CatalogMagic = 0x43464c53 /* SLFC */, CatalogVersion = 1 };
+	enum ERecordType { RecordType_Reserve = 0, RecordType_Clip = 1 };
+
+	void LoadIfNeeded();
+	/** Catalog missing or thrown away, NextIndex has to come from the clips on disk instead */
+	void ScanClipFiles();
+	bool AppendRecord(uint8 RecordType, TArray<uint8>& Payload);
+
+	FCriticalSection CatalogLock;
+	FString Path;
+	bool bLoaded;
+	int32 NextIndex;
+	TArray<FSelfieClipRecord> Clips;
+};
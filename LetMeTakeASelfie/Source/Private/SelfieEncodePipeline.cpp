@@ -0,0 +1,387 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieEncodePipeline.h"
+#include "SelfieEncodeThrottle.h"
+#include "SelfieStaticRegions.h"
+
+#include "vpx/vp8cx.h"
+
+class FSelfieConvertWorker : public FRunnable
+{
+public:
+	FSelfieConvertWorker(FSelfieEncodePipeline* InPipeline, int32 InWorkerIndex)
+		: Pipeline(InPipeline)
+		, WorkerIndex(InWorkerIndex)
+	{
+		Thread = FRunnableThread::Create(this, *FString::Printf(TEXT("FSelfieConvertWorker%d"), WorkerIndex), 0, TPri_BelowNormal);
+	}
+
+	~FSelfieConvertWorker()
+	{
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	uint32 Run()
+	{
+		if (Pipeline->Throttle)
+		{
+			Pipeline->Throttle->ApplyAffinity();
+		}
+		Pipeline->ConvertFrames(WorkerIndex);
+		return 0;
+	}
+
+	FRunnableThread* Thread;
+
+private:
+	FSelfieEncodePipeline* Pipeline;
+	int32 WorkerIndex;
+};
+
+class FSelfieMuxWorker : public FRunnable
+{
+public:
+	FSelfieMuxWorker(FSelfieEncodePipeline* InPipeline)
+		: Pipeline(InPipeline)
+	{
+		Thread = FRunnableThread::Create(this, TEXT("FSelfieMuxWorker"), 0, TPri_BelowNormal);
+	}
+
+	~FSelfieMuxWorker()
+	{
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	uint32 Run()
+	{
+		if (Pipeline->Throttle)
+		{
+			Pipeline->Throttle->ApplyAffinity();
+		}
+		Pipeline->MuxPackets();
+		return 0;
+	}
+
+	FRunnableThread* Thread;
+
+private:
+	FSelfieEncodePipeline* Pipeline;
+};
+
+FSelfieEncodePipeline::FSelfieEncodePipeline(vpx_codec_ctx_t* InCodec, int32 InWidth, int32 InHeight, unsigned long InDeadline)
+	: QueueDepth(4)
+	, NumConvertWorkers(2)
+	, Throttle(nullptr)
+	, StaticRegions(nullptr)
+	, EncodeSeconds(0)
+	, TotalSeconds(0)
+	, bCancelled(false)
+	, bMuxFailed(false)
+	, Codec(InCodec)
+	, Width(InWidth)
+	, Height(InHeight)
+	, Deadline(InDeadline)
+	, NumFrames(0)
+	, ConvertKernel(nullptr)
+	, PacketEvent(nullptr)
+{
+}
+
+FSelfieEncodePipeline::~FSelfieEncodePipeline()
+{
+	for (FImageSlot* Slot : Slots)
+	{
+		vpx_img_free(&Slot->Image);
+		delete Slot->WritableEvent;
+		delete Slot->ReadyEvent;
+		delete Slot;
+	}
+	Slots.Empty();
+
+	FEncodedPacket* Packet = nullptr;
+	while (EncodedPackets.Dequeue(Packet))
+	{
+		delete Packet;
+	}
+	while (FreePackets.Dequeue(Packet))
+	{
+		delete Packet;
+	}
+
+	delete PacketEvent;
+	PacketEvent = nullptr;
+}
+
+bool FSelfieEncodePipeline::InitConfig(vpx_codec_enc_cfg_t& Cfg, int32 Width, int32 Height, int32 FrameRate)
+{
+	if (vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &Cfg, 0))
+	{
+		return false;
+	}
+
+	Cfg.rc_target_bitrate = Width * Height * Cfg.rc_target_bitrate / Cfg.g_w / Cfg.g_h;
+	Cfg.g_w = Width;
+	Cfg.g_h = Height;
+	Cfg.g_timebase.den = FrameRate;
+
+	return true;
+}
+
+bool FSelfieEncodePipeline::Run(int32 InNumFrames, const FSelfieGetSourceFrame& InGetFrame, const FSelfieMuxPacket& InMux, const FSelfieEncodeProgress& Progress)
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	NumFrames = InNumFrames;
+	GetFrame = InGetFrame;
+	Mux = InMux;
+	YUVFormat.Layout = ESelfieYUVLayout::I420;
+	ConvertKernel = FSelfieYUV::GetKernel(YUVFormat);
+	bEncoderFinished.Reset();
+	bAbort.Reset();
+	MuxFailedCounter.Reset();
+	bCancelled = false;
+	bMuxFailed = false;
+
+	QueueDepth = FMath::Max(QueueDepth, 1);
+	NumConvertWorkers = FMath::Clamp(NumConvertWorkers, 1, QueueDepth);
+
+	for (int32 SlotIndex = 0; SlotIndex < QueueDepth; SlotIndex++)
+	{
+		FImageSlot* Slot = new FImageSlot();
+		if (!vpx_img_alloc(&Slot->Image, VPX_IMG_FMT_I420, Width, Height, 1))
+		{
+			delete Slot;
+			return false;
+		}
+		Slot->WritableFrame.Set(SlotIndex);
+		Slot->ReadyFrame.Set(-1);
+		Slot->WritableEvent = FPlatformProcess::CreateSynchEvent();
+		Slot->ReadyEvent = FPlatformProcess::CreateSynchEvent();
+		Slots.Add(Slot);
+	}
+	PacketEvent = FPlatformProcess::CreateSynchEvent();
+
+	FSelfieMuxWorker* MuxWorker = new FSelfieMuxWorker(this);
+	TArray<FSelfieConvertWorker*> ConvertWorkers;
+	for (int32 WorkerIndex = 0; WorkerIndex < NumConvertWorkers; WorkerIndex++)
+	{
+		ConvertWorkers.Add(new FSelfieConvertWorker(this, WorkerIndex));
+	}
+
+	if (Throttle)
+	{
+		Throttle->BeginEncode();
+	}
+
+	bool bSuccess = true;
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		FImageSlot* Slot = Slots[FrameIndex % Slots.Num()];
+
+		// Works on the BGRA source so it overlaps the conversion of this frame, the map applies to the next encode only
+		if (StaticRegions)
+		{
+			StaticRegions->Analyze(FrameIndex > 0 ? GetFrame.Execute(FrameIndex - 1) : nullptr, GetFrame.Execute(FrameIndex));
+			vpx_codec_control(Codec, VP8E_SET_ACTIVEMAP, StaticRegions->GetActiveMap());
+		}
+
+		// Timeout is only a safety net against a missed wakeup, the counter is what we actually wait on
+		while (Slot->ReadyFrame.GetValue() != FrameIndex)
+		{
+			Slot->ReadyEvent->Wait(2);
+		}
+
+		// A frame lasts until the next one, the last one as long as the one before it
+		int64 Pts = FrameIndex;
+		unsigned long Duration = 1;
+		if (FramePts.Num() == NumFrames)
+		{
+			Pts = FramePts[FrameIndex];
+			const int64 Gap = FrameIndex + 1 < NumFrames ? FramePts[FrameIndex + 1] - Pts : (FrameIndex > 0 ? Pts - FramePts[FrameIndex - 1] : 1);
+			Duration = (unsigned long)FMath::Max<int64>(Gap, 1);
+		}
+
+		const double EncodeStartTime = FPlatformTime::Seconds();
+		const vpx_codec_err_t Result = vpx_codec_encode(Codec, &Slot->Image, Pts, Duration, 0, Deadline);
+		const double FrameEncodeSeconds = FPlatformTime::Seconds() - EncodeStartTime;
+		EncodeSeconds += FrameEncodeSeconds;
+
+		// Encoder copies the image internally so the slot can be refilled straight away
+		Slot->WritableFrame.Set(FrameIndex + Slots.Num());
+		Slot->WritableEvent->Trigger();
+
+		if (Result != VPX_CODEC_OK)
+		{
+			bSuccess = false;
+			break;
+		}
+
+		QueueEncodedPackets();
+
+		// No point encoding the rest for a sink that's stopped taking it
+		if (MuxFailedCounter.GetValue())
+		{
+			bSuccess = false;
+			break;
+		}
+
+		if (Progress.IsBound() && !Progress.Execute(FrameIndex + 1))
+		{
+			bCancelled = true;
+			bSuccess = false;
+			break;
+		}
+
+		if (Throttle)
+		{
+			Throttle->Throttle(FrameEncodeSeconds);
+		}
+	}
+
+	if (Throttle)
+	{
+		Throttle->EndEncode();
+	}
+
+	if (bSuccess)
+	{
+		// Flush, the encoder keeps handing back packets until it's drained
+		do
+		{
+			if (vpx_codec_encode(Codec, nullptr, NumFrames, 1, 0, Deadline) != VPX_CODEC_OK)
+			{
+				bSuccess = false;
+				break;
+			}
+		}
+		while (QueueEncodedPackets() > 0);
+	}
+	else
+	{
+		bAbort.Set(1);
+		for (FImageSlot* Slot : Slots)
+		{
+			Slot->WritableEvent->Trigger();
+		}
+	}
+
+	bEncoderFinished.Set(1);
+	PacketEvent->Trigger();
+
+	for (FSelfieConvertWorker* Worker : ConvertWorkers)
+	{
+		Worker->Thread->WaitForCompletion();
+		delete Worker;
+	}
+	MuxWorker->Thread->WaitForCompletion();
+	delete MuxWorker;
+
+	// Could have been refused anywhere up to the last packet of the flush
+	bMuxFailed = MuxFailedCounter.GetValue() != 0;
+	if (bMuxFailed)
+	{
+		bSuccess = false;
+	}
+
+	TotalSeconds = FPlatformTime::Seconds() - StartTime;
+
+	return bSuccess;
+}
+
+void FSelfieEncodePipeline::ConvertFrames(int32 WorkerIndex)
+{
+	for (int32 FrameIndex = WorkerIndex; FrameIndex < NumFrames; FrameIndex += NumConvertWorkers)
+	{
+		FImageSlot* Slot = Slots[FrameIndex % Slots.Num()];
+
+		while (Slot->WritableFrame.GetValue() != FrameIndex)
+		{
+			if (bAbort.GetValue())
+			{
+				return;
+			}
+			Slot->WritableEvent->Wait(2);
+		}
+
+		vpx_image_t& Image = Slot->Image;
+		const FSelfieYUVPlanes Planes = { Image.planes[VPX_PLANE_Y], Image.stride[VPX_PLANE_Y], Image.planes[VPX_PLANE_U], Image.stride[VPX_PLANE_U],
+			Image.planes[VPX_PLANE_V], Image.stride[VPX_PLANE_V] };
+		ConvertKernel(GetFrame.Execute(FrameIndex), Width, Width, Height, Planes);
+
+		Slot->ReadyFrame.Set(FrameIndex);
+		Slot->ReadyEvent->Trigger();
+	}
+}
+
+int32 FSelfieEncodePipeline::QueueEncodedPackets()
+{
+	int32 NumQueued = 0;
+
+	vpx_codec_iter_t Iter = nullptr;
+	const vpx_codec_cx_pkt_t* Pkt = nullptr;
+	while ((Pkt = vpx_codec_get_cx_data(Codec, &Iter)) != nullptr)
+	{
+		if (Pkt->kind != VPX_CODEC_CX_FRAME_PKT)
+		{
+			continue;
+		}
+
+		// Packet memory belongs to the encoder and is gone on the next encode call, so take a copy for the mux thread
+		FEncodedPacket* Encoded = nullptr;
+		if (!FreePackets.Dequeue(Encoded))
+		{
+			Encoded = new FEncodedPacket();
+		}
+
+		const int32 PacketSize = Pkt->data.frame.sz;
+		Encoded->Data.Empty(FMath::Max(Encoded->Data.Max(), PacketSize));
+		Encoded->Data.AddUninitialized(PacketSize);
+		FMemory::Memcpy(Encoded->Data.GetData(), Pkt->data.frame.buf, PacketSize);
+
+		Encoded->Packet = *Pkt;
+		Encoded->Packet.data.frame.buf = Encoded->Data.GetData();
+
+		EncodedPackets.Enqueue(Encoded);
+		NumQueued++;
+	}
+
+	if (NumQueued > 0)
+	{
+		PacketEvent->Trigger();
+	}
+
+	return NumQueued;
+}
+
+void FSelfieEncodePipeline::MuxPackets()
+{
+	for (;;)
+	{
+		FEncodedPacket* Encoded = nullptr;
+		if (EncodedPackets.Dequeue(Encoded))
+		{
+			// Once the sink has failed the rest are only drained so the encoder side isn't left waiting
+			if (Mux.IsBound() && MuxFailedCounter.GetValue() == 0 && !Mux.Execute(&Encoded->Packet))
+			{
+				MuxFailedCounter.Set(1);
+			}
+			FreePackets.Enqueue(Encoded);
+			continue;
+		}
+
+		// Finished is only set after the last enqueue, so an empty queue now really is the end
+		if (bEncoderFinished.GetValue())
+		{
+			if (EncodedPackets.IsEmpty())
+			{
+				break;
+			}
+			continue;
+		}
+
+		PacketEvent->Wait(2);
+	}
+}
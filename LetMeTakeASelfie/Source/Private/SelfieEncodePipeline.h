@@ -0,0 +1,112 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "vpx/vpx_encoder.h"
+#include "SelfieYUV.h"
+
+class FSelfieEncodeThrottle;
+class FSelfieStaticRegions;
+
+/** Returns the BGRA pixels for a frame index, the pointer has to stay valid until the pipeline is done with it */
+DECLARE_DELEGATE_RetVal_OneParam(const FColor*, FSelfieGetSourceFrame, int32);
+
+/** Called on the mux thread for every compressed packet, in encode order. False once the output has failed */
+DECLARE_DELEGATE_RetVal_OneParam(bool, FSelfieMuxPacket, const vpx_codec_cx_pkt_t*);
+
+/** Called on the encoding thread after each frame goes into the encoder. Return false to cancel the encode */
+DECLARE_DELEGATE_RetVal_OneParam(bool, FSelfieEncodeProgress, int32 /*FramesEncoded*/);
+
+/**
+ * Bounded producer/consumer pipeline for saving a clip.
+ *
+ * Conversion workers fill a small ring of reusable I420 images ahead of the encoder, the encoder runs on the calling thread,
+ * and compressed packets are copied onto a queue for the mux thread. Colour conversion is pure memory bandwidth so
+ * it hides behind the encode, and the total time approaches the time of the encoder alone.
+ */
+class FSelfieEncodePipeline
+{
+public:
+	FSelfieEncodePipeline(vpx_codec_ctx_t* InCodec, int32 InWidth, int32 InHeight, unsigned long InDeadline);
+	~FSelfieEncodePipeline();
+
+	/** The encoder settings every selfie clip starts from, bitrate scaled from libvpx's default to the clip size */
+	static bool InitConfig(vpx_codec_enc_cfg_t& Cfg, int32 Width, int32 Height, int32 FrameRate);
+
+	/**
+	 * Encodes NumFrames and flushes the encoder, blocks until the last packet has been muxed. False if the encoder failed
+	 * or Progress cancelled, in which case it stops after the frame in flight and skips the flush
+	 */
+	bool Run(int32 NumFrames, const FSelfieGetSourceFrame& InGetFrame, const FSelfieMuxPacket& InMux, const FSelfieEncodeProgress& Progress = FSelfieEncodeProgress());
+
+	/** Converted images kept ahead of the encoder */
+	int32 QueueDepth;
+	/** Colour conversion threads */
+	int32 NumConvertWorkers;
+	/** Optional, rests the encoder between frames and pins the pipeline threads */
+	FSelfieEncodeThrottle* Throttle;
+	/** Optional, marks unchanged macroblocks inactive before each frame. Needs an encoder without lag */
+	FSelfieStaticRegions* StaticRegions;
+	/** Matrix and range for the conversion, always I420 since that's what the images are */
+	FSelfieYUVFormat YUVFormat;
+	/** Optional, a timestamp per frame in the encoder's timebase. Empty puts frame i at i, one frame per tick */
+	TArray<int64> FramePts;
+
+	/** Seconds spent inside vpx_codec_encode, to compare against the total */
+	double EncodeSeconds;
+	double TotalSeconds;
+	/** Set when Progress asked to stop */
+	bool bCancelled;
+	/** Set when the mux delegate refused a packet, the sink's gone (disk full, socket closed) and Run stopped */
+	bool bMuxFailed;
+
+private:
+	friend class FSelfieConvertWorker;
+	friend class FSelfieMuxWorker;
+
+	struct FImageSlot
+	{
+		vpx_image_t Image;
+		// Frame index the converter may write into this slot next
+		FThreadSafeCounter WritableFrame;
+		// Frame index that is sitting converted in this slot, -1 if none
+		FThreadSafeCounter ReadyFrame;
+		FEvent* WritableEvent;
+		FEvent* ReadyEvent;
+	};
+
+	struct FEncodedPacket
+	{
+		vpx_codec_cx_pkt_t Packet;
+		TArray<uint8> Data;
+	};
+
+	/** Converter side, called from the worker threads */
+	void ConvertFrames(int32 WorkerIndex);
+
+	/** Mux side, drains packets until the encoder is finished, only handing them on until one is refused */
+	void MuxPackets();
+
+	/** Copies everything the encoder has ready onto the mux queue */
+	int32 QueueEncodedPackets();
+
+	vpx_codec_ctx_t* Codec;
+	int32 Width;
+	int32 Height;
+	unsigned long Deadline;
+	int32 NumFrames;
+
+	FSelfieGetSourceFrame GetFrame;
+	FSelfieMuxPacket Mux;
+	FSelfieYUVKernel ConvertKernel;
+
+	TArray<FImageSlot*> Slots;
+
+	// Encoder -> mux thread, and the spent packets back again
+	TQueue<FEncodedPacket*, EQueueMode::Spsc> EncodedPackets;
+	TQueue<FEncodedPacket*, EQueueMode::Spsc> FreePackets;
+	FEvent* PacketEvent;
+	FThreadSafeCounter bEncoderFinished;
+	FThreadSafeCounter bAbort;
+	// Mux thread -> encoder, latched on the first refused packet
+	FThreadSafeCounter MuxFailedCounter;
+};
@@ -0,0 +1,204 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieEncodePool.h"
+
+class FSelfieEncodePoolWorker : public FRunnable
+{
+public:
+	FSelfieEncodePoolWorker(FSelfieEncodePool* InPool, int32 InWorkerIndex)
+		: Pool(InPool)
+		, WorkerIndex(InWorkerIndex)
+	{
+		WakeEvent = FPlatformProcess::CreateSynchEvent();
+		Thread = FRunnableThread::Create(this, *FString::Printf(TEXT("FSelfieEncodePoolWorker%d"), WorkerIndex), 0, TPri_BelowNormal);
+	}
+
+	~FSelfieEncodePoolWorker()
+	{
+		delete Thread;
+		delete WakeEvent;
+	}
+
+	uint32 Run()
+	{
+		while (StopTaskCounter.GetValue() == 0)
+		{
+			IQueuedWork* Work = Pool->TakeWork(WorkerIndex);
+			if (Work == nullptr)
+			{
+				// Timeout in case a job landed on a busy worker's queue and nobody told us
+				WakeEvent->Wait(100);
+				continue;
+			}
+
+			bBusy.Set(1);
+			Pool->NumBusy.Increment();
+			Work->DoThreadedWork();
+			Pool->NumBusy.Decrement();
+			Pool->NumCompleted.Increment();
+			bBusy.Set(0);
+		}
+		return 0;
+	}
+
+	void Stop()
+	{
+		StopTaskCounter.Increment();
+		WakeEvent->Trigger();
+	}
+
+	FSelfieEncodePool* Pool;
+	int32 WorkerIndex;
+	FEvent* WakeEvent;
+	FThreadSafeCounter bBusy;
+	FThreadSafeCounter StopTaskCounter;
+	FRunnableThread* Thread;
+};
+
+FSelfieEncodePool::FSelfieEncodePool()
+	: NumWorkers(0)
+{
+}
+
+FSelfieEncodePool::~FSelfieEncodePool()
+{
+	Shutdown();
+}
+
+int32 FSelfieEncodePool::GetDesiredWorkers() const
+{
+	// Every save has its own libvpx and conversion threads as well, so half the cores is already plenty
+	return NumWorkers > 0 ? NumWorkers : FMath::Clamp(FPlatformMisc::NumberOfCores() / 2, 1, 4);
+}
+
+void FSelfieEncodePool::SetNumWorkers(int32 InNumWorkers)
+{
+	if (InNumWorkers != NumWorkers)
+	{
+		// Restarts on the next Submit, anything already queued waits for the running jobs and is abandoned
+		Shutdown();
+		NumWorkers = FMath::Max(InNumWorkers, 0);
+	}
+}
+
+void FSelfieEncodePool::StartWorkers()
+{
+	const int32 DesiredWorkers = GetDesiredWorkers();
+	for (int32 WorkerIndex = 0; WorkerIndex < DesiredWorkers; WorkerIndex++)
+	{
+		Queues.Add(new FWorkQueue());
+	}
+	for (int32 WorkerIndex = 0; WorkerIndex < DesiredWorkers; WorkerIndex++)
+	{
+		Workers.Add(new FSelfieEncodePoolWorker(this, WorkerIndex));
+	}
+}
+
+void FSelfieEncodePool::Submit(IQueuedWork* Work, int32 Queue)
+{
+	if (Workers.Num() == 0)
+	{
+		StartWorkers();
+	}
+
+	const int32 WorkerIndex = FMath::Abs(Queue) % Workers.Num();
+	{
+		FScopeLock Lock(&Queues[WorkerIndex]->Lock);
+		Queues[WorkerIndex]->Work.Add(Work);
+		Queues[WorkerIndex]->Length.Increment();
+	}
+
+	Workers[WorkerIndex]->WakeEvent->Trigger();
+	if (Workers[WorkerIndex]->bBusy.GetValue())
+	{
+		// Its own worker won't get to it for a while, so wake everyone that's idle to come and take it
+		for (FSelfieEncodePoolWorker* Worker : Workers)
+		{
+			if (!Worker->bBusy.GetValue())
+			{
+				Worker->WakeEvent->Trigger();
+			}
+		}
+	}
+}
+
+IQueuedWork* FSelfieEncodePool::TakeWork(int32 WorkerIndex)
+{
+	{
+		FWorkQueue& Own = *Queues[WorkerIndex];
+		FScopeLock Lock(&Own.Lock);
+		if (Own.Work.Num() > 0)
+		{
+			IQueuedWork* Work = Own.Work[0];
+			Own.Work.RemoveAt(0);
+			Own.Length.Decrement();
+			return Work;
+		}
+	}
+
+	// Lengths are only a hint, the one picked is locked again before taking anything from it
+	int32 Victim = INDEX_NONE;
+	int32 VictimLength = 0;
+	for (int32 QueueIndex = 0; QueueIndex < Queues.Num(); QueueIndex++)
+	{
+		const int32 Length = Queues[QueueIndex]->Length.GetValue();
+		if (QueueIndex != WorkerIndex && Length > VictimLength)
+		{
+			Victim = QueueIndex;
+			VictimLength = Length;
+		}
+	}
+	if (Victim == INDEX_NONE)
+	{
+		return nullptr;
+	}
+
+	FWorkQueue& Other = *Queues[Victim];
+	FScopeLock Lock(&Other.Lock);
+	if (Other.Work.Num() == 0)
+	{
+		return nullptr;
+	}
+	IQueuedWork* Work = Other.Work[0];
+	Other.Work.RemoveAt(0);
+	Other.Length.Decrement();
+	NumStolen.Increment();
+	return Work;
+}
+
+void FSelfieEncodePool::Shutdown()
+{
+	for (FSelfieEncodePoolWorker* Worker : Workers)
+	{
+		Worker->Stop();
+	}
+	for (FSelfieEncodePoolWorker* Worker : Workers)
+	{
+		Worker->Thread->WaitForCompletion();
+		delete Worker;
+	}
+	Workers.Empty();
+
+	for (FWorkQueue* Queue : Queues)
+	{
+		for (IQueuedWork* Work : Queue->Work)
+		{
+			Work->Abandon();
+		}
+		delete Queue;
+	}
+	Queues.Empty();
+}
+
+void FSelfieEncodePool::LogStats(FOutputDevice& Ar) const
+{
+	int32 NumQueued = 0;
+	for (FWorkQueue* Queue : Queues)
+	{
+		FScopeLock Lock(&Queue->Lock);
+		NumQueued += Queue->Work.Num();
+	}
+	Ar.Logf(TEXT("Selfie encode pool %d workers%s, %d busy, %d queued, %d done, %d stolen"), GetNumWorkers(), Workers.Num() > 0 ? TEXT("") : TEXT(" (not started)"),
+		NumBusy.GetValue(), NumQueued, NumCompleted.GetValue(), NumStolen.GetValue());
+}
@@ -0,0 +1,63 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+class FSelfieEncodePoolWorker;
+
+/**
+ * Save workers shared by every capture session, so two to four viewpoints saving at once spread over the cores
+ * instead of queueing behind one thread.
+ *
+ * Each worker has its own queue and a session always submits to the same one. A worker that runs out takes the oldest
+ * job off whichever other queue is longest, so sessions that happen to share a worker don't wait on each other while
+ * another one sits idle. The unit of work is a whole save, a VP8 stream is one long dependency chain so there's nothing
+ * finer worth stealing.
+ *
+ * Jobs are IQueuedWork like on GThreadPool, but saves hold a thread for seconds at a time and the y4m dump itself waits
+ * on GThreadPool, so they get threads of their own.
+ */
+class FSelfieEncodePool
+{
+public:
+	FSelfieEncodePool();
+	~FSelfieEncodePool();
+
+	/** Game thread. Workers are started on the first Submit, NumWorkers 0 picks from the core count */
+	void SetNumWorkers(int32 InNumWorkers);
+	int32 GetNumWorkers() const { return Workers.Num() > 0 ? Workers.Num() : GetDesiredWorkers(); }
+
+	/** Any thread. Queues Work on Queue's worker, modulo the number of workers */
+	void Submit(IQueuedWork* Work, int32 Queue);
+
+	/** Jobs running right now, including ones still reading the ring. FSelfieEncodeThrottle counts the ones encoding */
+	int32 GetNumBusy() const { return NumBusy.GetValue(); }
+
+	/** Game thread. Waits for running jobs and abandons anything still queued */
+	void Shutdown();
+
+	void LogStats(FOutputDevice& Ar) const;
+
+private:
+	friend class FSelfieEncodePoolWorker;
+
+	struct FWorkQueue
+	{
+		FCriticalSection Lock;
+		TArray<IQueuedWork*> Work;
+		/** Work.Num(), kept up to date under Lock so other workers can look without taking it */
+		FThreadSafeCounter Length;
+	};
+
+	int32 GetDesiredWorkers() const;
+	void StartWorkers();
+
+	/** Worker thread. Own queue first, then the longest other one */
+	IQueuedWork* TakeWork(int32 WorkerIndex);
+
+	int32 NumWorkers;
+	TArray<FSelfieEncodePoolWorker*> Workers;
+	TArray<FWorkQueue*> Queues;
+
+	FThreadSafeCounter NumBusy;
+	FThreadSafeCounter NumCompleted;
+	FThreadSafeCounter NumStolen;
+};
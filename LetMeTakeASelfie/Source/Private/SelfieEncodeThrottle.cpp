@@ -0,0 +1,92 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieEncodeThrottle.h"
+
+FSelfieEncodeThrottle::FSelfieEncodeThrottle()
+	: bEnabled(true)
+	, CpuBudget(0.5f)
+	, BackgroundEncoderThreads(1)
+	, AffinityMask(0)
+{
+	// Until the first report, assume the game is fine
+	bGameIdle.Set(1);
+}
+
+void FSelfieEncodeThrottle::ReportGameFrame(float DeltaTime, float FrameBudget, bool bInGameIdle)
+{
+	GameFrameMicros.Set(FMath::RoundToInt(DeltaTime * 1000000.0f));
+	FrameBudgetMicros.Set(FMath::RoundToInt(FrameBudget * 1000000.0f));
+	bGameIdle.Set(bInGameIdle ? 1 : 0);
+}
+
+bool FSelfieEncodeThrottle::IsFullSpeed() const
+{
+	return !bEnabled || bGameIdle.GetValue() != 0;
+}
+
+int32 FSelfieEncodeThrottle::GetEncoderThreads() const
+{
+	// Leave a core each for the game and render threads when running flat out
+	const int32 FullSpeedThreads = FMath::Clamp(FPlatformMisc::NumberOfCores() - 2, 1, 4);
+	if (IsFullSpeed())
+	{
+		return FullSpeedThreads;
+	}
+
+	// libvpx makes its own worker threads that would ignore the mask, so with one it gets none and encodes on our thread
+	return AffinityMask != 0 ? 1 : FMath::Clamp(BackgroundEncoderThreads, 1, FullSpeedThreads);
+}
+
+void FSelfieEncodeThrottle::ApplyAffinity() const
+{
+	if (AffinityMask != 0 && !IsFullSpeed())
+	{
+		FPlatformProcess::SetThreadAffinityMask(AffinityMask);
+	}
+}
+
+void FSelfieEncodeThrottle::Throttle(double FrameEncodeSeconds)
+{
+	if (IsFullSpeed() || CpuBudget >= 1.0f)
+	{
+		return;
+	}
+
+	// Work E then rest E * (1 - B) / B and the thread averages B of a core
+	const float Budget = FMath::Max(CpuBudget / FMath::Max(ActiveEncodes.GetValue(), 1), 0.05f);
+	double SleepSeconds = FrameEncodeSeconds * (1.0f - Budget) / Budget;
+
+	// Back off harder while the game is missing its budget, ease up when it has slack to spare
+	const int32 BudgetMicros = FrameBudgetMicros.GetValue();
+	if (BudgetMicros > 0)
+	{
+		const float Slack = (float)(BudgetMicros - GameFrameMicros.GetValue()) / BudgetMicros;
+		SleepSeconds *= Slack < 0 ? 1.0f + FMath::Min(-Slack * 4.0f, 3.0f) : FMath::Max(1.0f - Slack, 0.25f);
+	}
+
+	// Long sleeps in slices so a switch to full speed is picked up quickly
+	SleepSeconds = FMath::Min(SleepSeconds, 0.25);
+	const double StartTime = FPlatformTime::Seconds();
+	const double WakeTime = StartTime + SleepSeconds;
+	while (!IsFullSpeed())
+	{
+		const double Remaining = WakeTime - FPlatformTime::Seconds();
+		if (Remaining <= 0)
+		{
+			break;
+		}
+		FPlatformProcess::Sleep((float)FMath::Min(Remaining, 0.01));
+	}
+
+	// What was actually slept, cut short by going full speed or stretched by the scheduler
+	SleptMs.Add(FMath::RoundToInt((FPlatformTime::Seconds() - StartTime) * 1000.0));
+	ThrottledFrames.Increment();
+}
+
+void FSelfieEncodeThrottle::LogStats(FOutputDevice& Ar) const
+{
+	Ar.Logf(TEXT("Selfie encode throttle %s, %s now, %.0f%% of a core over %d saves, %d background threads, affinity 0x%llx, %d frames throttled for %.2fs"),
+		bEnabled ? TEXT("on") : TEXT("off"), IsFullSpeed() ? TEXT("full speed") : TEXT("background"), CpuBudget * 100.0f, ActiveEncodes.GetValue(),
+		BackgroundEncoderThreads, AffinityMask, ThrottledFrames.GetValue(), SleptMs.GetValue() / 1000.0f);
+}
@@ -0,0 +1,62 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+/**
+ * Keeps a save from competing with the game while a match is on.
+ *
+ * The game thread reports every frame how long it took against its budget and whether the player is actually playing.
+ * While they are, a save gets a limited number of libvpx threads and the encoding thread rests after each frame so it
+ * averages CpuBudget of a core, resting longer when the game is over budget and less when there's slack. The
+ * pipeline's own conversion and muxing threads can also be pinned to chosen cores. Once the match is over, paused or in a menu the brakes come off,
+ * including part way through a save. Saves running at the same time split CpuBudget between them.
+ */
+class FSelfieEncodeThrottle
+{
+public:
+	FSelfieEncodeThrottle();
+
+	bool bEnabled;
+	/** Share of one core the encoding thread may average while the game is running */
+	float CpuBudget;
+	/** libvpx threads for a save started while the game is running */
+	int32 BackgroundEncoderThreads;
+	/** Cores the pipeline threads are pinned to, 0 leaves it to the OS */
+	uint64 AffinityMask;
+
+	/** Game thread, every tick */
+	void ReportGameFrame(float DeltaTime, float FrameBudget, bool bGameIdle);
+
+	/** True if nothing needs holding back right now */
+	bool IsFullSpeed() const;
+
+	/** libvpx threads for a save starting now */
+	int32 GetEncoderThreads() const;
+
+	/**
+	 * Pins the calling thread to AffinityMask, if there is one and the save is being held back. Only for threads the
+	 * pipeline creates itself, nothing puts the mask back so a pool thread would stay pinned for whatever it runs next
+	 */
+	void ApplyAffinity() const;
+
+	/** Encoding thread, around the encode so concurrent saves know to share the budget */
+	void BeginEncode() { ActiveEncodes.Increment(); }
+	void EndEncode() { ActiveEncodes.Decrement(); }
+	/** Saves between BeginEncode and EndEncode right now */
+	int32 GetActiveEncodes() const { return ActiveEncodes.GetValue(); }
+
+	/** Encoding thread, after each frame. Sleeps to keep the encoder inside its share of the budget */
+	void Throttle(double FrameEncodeSeconds);
+
+	void LogStats(FOutputDevice& Ar) const;
+
+private:
+	// Written by the game thread, read by the encoding thread
+	FThreadSafeCounter GameFrameMicros;
+	FThreadSafeCounter FrameBudgetMicros;
+	FThreadSafeCounter bGameIdle;
+
+	FThreadSafeCounter ActiveEncodes;
+	// Any encoding thread
+	FThreadSafeCounter SleptMs;
+	FThreadSafeCounter ThrottledFrames;
+};
@@ -0,0 +1,363 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieFrameHandoff.h"
+
+#include "ScreenRendering.h"
+#include "RenderCore.h"
+#include "RHIStaticStates.h"
+#include "RendererInterface.h"
+
+FSelfieFrameHandoff::FSelfieFrameHandoff()
+	: Width(0)
+	, Height(0)
+	, NextSlot(0)
+{
+}
+
+FSelfieFrameHandoff::~FSelfieFrameHandoff()
+{
+	Release();
+}
+
+void FSelfieFrameHandoff::Init(int32 InWidth, int32 InHeight, int32 InDepth)
+{
+	check(IsInGameThread());
+
+	Release();
+
+	Width = InWidth;
+	Height = InHeight;
+	NextSlot = 0;
+
+	const int32 Depth = FMath::Clamp<int32>(InDepth, MinDepth, MaxDepth);
+	StagingSlots.AddZeroed(Depth);
+	for (int32 SlotIndex = 0; SlotIndex < Depth; ++SlotIndex)
+	{
+		FStagingSlot& Slot = StagingSlots[SlotIndex];
+		FRHIResourceCreateInfo CreateInfo;
+		Slot.Texture = RHICreateTexture2D(Width, Height, PF_B8G8R8A8, 1, 1, TexCreate_CPUReadback, CreateInfo);
+		Slot.State = ESlotState::Free;
+		Slot.SubmitFrameNumber = 0;
+		Slot.CaptureTime = 0;
+	}
+
+	// One spare so the render thread doesn't have to allocate while the game thread is still holding a frame
+	for (int32 i = 0; i < Depth + 1; i++)
+	{
+		FSelfieReadbackFrame* Frame = new FSelfieReadbackFrame();
+		Frame->Pixels.Empty(Width * Height);
+		Frame->Pixels.AddUninitialized(Width * Height);
+		FreeFrames.Enqueue(Frame);
+	}
+}
+
+void FSelfieFrameHandoff::Release()
+{
+	if (!IsInitialized())
+	{
+		return;
+	}
+
+	check(IsInGameThread());
+
+	Flush();
+
+	FSelfieReadbackFrame* Frame = nullptr;
+	while (CompletedFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+	while (FreeFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+
+	// Staging textures get released with the last reference, render thread is idle after the flush
+	StagingSlots.Empty();
+}
+
+bool FSelfieFrameHandoff::CanSubmit() const
+{
+	// Strictly round robin so staging textures retire in capture order
+	return IsInitialized() && StagingSlots[NextSlot].State == ESlotState::Free;
+}
+
+int32 FSelfieFrameHandoff::AcquireSlot()
+{
+	check(CanSubmit());
+
+	const int32 SlotIndex = NextSlot;
+	NextSlot = (NextSlot + 1) % StagingSlots.Num();
+
+	FStagingSlot& Slot = StagingSlots[SlotIndex];
+	Slot.State = ESlotState::Submitted;
+	Slot.SubmitFrameNumber = GFrameCounter;
+
+	return SlotIndex;
+}
+
+/** Render thread. Bilinear resample of the SourceUV rect of Source into a pooled target of ResizeTo, then copied into the staging texture */
+static void SelfieResampleToStaging(FRHICommandListImmediate& RHICmdList, IRendererModule* RendererModule, FTexture2DRHIRef Source, FIntPoint ResizeTo, FTexture2DRHIRef StagingTexture,
+	FVector2D SourceUV = FVector2D(0.0f, 0.0f), FVector2D SourceUVSize = FVector2D(1.0f, 1.0f))
+{
+	FPooledRenderTargetDesc OutputDesc(FPooledRenderTargetDesc::Create2DDesc(ResizeTo, PF_B8G8R8A8, TexCreate_None, TexCreate_RenderTargetable, false));
+
+	const auto FeatureLevel = GMaxRHIFeatureLevel;
+
+	TRefCountPtr<IPooledRenderTarget> ResampleTexturePooledRenderTarget;
+	RendererModule->RenderTargetPoolFindFreeElement(OutputDesc, ResampleTexturePooledRenderTarget, TEXT("ResampleTexture"));
+	check(ResampleTexturePooledRenderTarget);
+
+	const FSceneRenderTargetItem& DestRenderTarget = ResampleTexturePooledRenderTarget->GetRenderTargetItem();
+
+	SetRenderTarget(RHICmdList, DestRenderTarget.TargetableTexture, FTextureRHIRef());
+	RHICmdList.SetViewport(0, 0, 0.0f, ResizeTo.X, ResizeTo.Y, 1.0f);
+
+	RHICmdList.SetBlendState(TStaticBlendState<>::GetRHI());
+	RHICmdList.SetRasterizerState(TStaticRasterizerState<>::GetRHI());
+	RHICmdList.SetDepthStencilState(TStaticDepthStencilState<false, CF_Always>::GetRHI());
+
+	auto ShaderMap = GetGlobalShaderMap(FeatureLevel);
+	TShaderMapRef<FScreenVS> VertexShader(ShaderMap);
+	TShaderMapRef<FScreenPS> PixelShader(ShaderMap);
+
+	static FGlobalBoundShaderState BoundShaderState;
+	SetGlobalBoundShaderState(RHICmdList, FeatureLevel, BoundShaderState, RendererModule->GetFilterVertexDeclaration().VertexDeclarationRHI, *VertexShader, *PixelShader);
+
+	const bool bWholeSource = SourceUV.IsZero() && SourceUVSize == FVector2D(1.0f, 1.0f);
+	if (!bWholeSource || ResizeTo != FIntPoint(Source->GetSizeX(), Source->GetSizeY()))
+	{
+		// Different size either way, so use bilinear filtering
+		PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Bilinear>::GetRHI(), Source);
+	}
+	else
+	{
+		// Drawing 1:1, so no filtering needed
+		PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Point>::GetRHI(), Source);
+	}
+
+	RendererModule->DrawRectangle(
+		RHICmdList,
+		0, 0,		// Dest X, Y
+		ResizeTo.X, ResizeTo.Y,	// Dest Width, Height
+		SourceUV.X, SourceUV.Y,		// Source U, V
+		SourceUVSize.X, SourceUVSize.Y,		// Source USize, VSize
+		ResizeTo,		// Target buffer size
+		FIntPoint(1, 1),		// Source texture size
+		*VertexShader,
+		EDRF_Default);
+
+	// Asynchronously copy render target from GPU to CPU
+	const bool bKeepOriginalSurface = false;
+	RHICmdList.CopyToResolveTarget(
+		DestRenderTarget.TargetableTexture,
+		StagingTexture,
+		bKeepOriginalSurface,
+		FResolveParams());
+}
+
+void FSelfieFrameHandoff::SubmitViewport(const FViewportRHIRef& ViewportRHI, double CaptureTime, FVector2D SourceOrigin, FVector2D SourceSize)
+{
+	const int32 SlotIndex = AcquireSlot();
+	FStagingSlot& Slot = StagingSlots[SlotIndex];
+	Slot.CaptureTime = CaptureTime;
+
+	static const FName RendererModuleName("Renderer");
+	IRendererModule& RendererModule = FModuleManager::GetModuleChecked<IRendererModule>(RendererModuleName);
+
+	// Borrowed from GameLiveStreaming.cpp
+	struct FCopyVideoFrame
+	{
+		FViewportRHIRef ViewportRHI;
+		IRendererModule* RendererModule;
+		FIntPoint ResizeTo;
+		FTexture2DRHIRef StagingTexture;
+		FVector2D SourceOrigin;
+		FVector2D SourceSize;
+	};
+	FCopyVideoFrame CopyVideoFrame =
+	{
+		ViewportRHI,
+		&RendererModule,
+		FIntPoint(Width, Height),
+		Slot.Texture,
+		SourceOrigin,
+		SourceSize
+	};
+
+	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
+		SelfieCopyViewport,
+		FCopyVideoFrame, Context, CopyVideoFrame,
+		{
+		FTexture2DRHIRef ViewportBackBuffer = RHICmdList.GetViewportBackBuffer(Context.ViewportRHI);
+		SelfieResampleToStaging(RHICmdList, Context.RendererModule, ViewportBackBuffer, Context.ResizeTo, Context.StagingTexture, Context.SourceOrigin, Context.SourceSize);
+	});
+
+	Slot.CopyFence.BeginFence();
+}
+
+void FSelfieFrameHandoff::SubmitRenderTarget(FRenderTarget* RenderTarget, double CaptureTime)
+{
+	const int32 SlotIndex = AcquireSlot();
+	FStagingSlot& Slot = StagingSlots[SlotIndex];
+	Slot.CaptureTime = CaptureTime;
+
+	if (RenderTarget->GetSizeXY() != FIntPoint(Width, Height))
+	{
+		// Smaller scene capture from the governor, scale it back up to the clip size on the way out
+		static const FName RendererModuleName("Renderer");
+		IRendererModule* RendererModule = &FModuleManager::GetModuleChecked<IRendererModule>(RendererModuleName);
+		const FIntPoint ClipSize(Width, Height);
+
+		ENQUEUE_UNIQUE_RENDER_COMMAND_FOURPARAMETER(
+			SelfieResampleRenderTarget,
+			FRenderTarget*, SrcRenderTarget, RenderTarget,
+			IRendererModule*, Renderer, RendererModule,
+			FIntPoint, ResizeTo, ClipSize,
+			FTexture2DRHIRef, StagingTexture, Slot.Texture,
+			{
+			SelfieResampleToStaging(RHICmdList, Renderer, SrcRenderTarget->GetRenderTargetTexture(), ResizeTo, StagingTexture);
+		});
+	}
+	else
+	{
+		ENQUEUE_UNIQUE_RENDER_COMMAND_TWOPARAMETER(
+			SelfieCopyRenderTarget,
+			FRenderTarget*, SrcRenderTarget, RenderTarget,
+			FTexture2DRHIRef, StagingTexture, Slot.Texture,
+			{
+			const bool bKeepOriginalSurface = false;
+			RHICmdList.CopyToResolveTarget(
+				SrcRenderTarget->GetRenderTargetTexture(),
+				StagingTexture,
+				bKeepOriginalSurface,
+				FResolveParams());
+		});
+	}
+
+	Slot.CopyFence.BeginFence();
+}
+
+void FSelfieFrameHandoff::Tick()
+{
+	RetireReadySlots(false);
+}
+
+void FSelfieFrameHandoff::Flush()
+{
+	if (!IsInitialized())
+	{
+		return;
+	}
+
+	RetireReadySlots(true);
+
+	FRenderCommandFence Fence;
+	Fence.BeginFence();
+	Fence.Wait();
+}
+
+void FSelfieFrameHandoff::RetireReadySlots(bool bForce)
+{
+	// Copies were issued in slot order starting after NextSlot, so walk them oldest first
+	const int32 Depth = StagingSlots.Num();
+	const uint64 Latency = Depth - 1;
+	for (int32 i = 0; i < Depth; i++)
+	{
+		const int32 SlotIndex = (NextSlot + i) % Depth;
+		FStagingSlot& Slot = StagingSlots[SlotIndex];
+		if (Slot.State != ESlotState::Submitted)
+		{
+			continue;
+		}
+
+		if (!bForce && (!Slot.CopyFence.IsFenceComplete() || GFrameCounter - Slot.SubmitFrameNumber < Latency))
+		{
+			// Anything newer isn't ready either
+			break;
+		}
+
+		RetireSlot(SlotIndex);
+	}
+}
+
+void FSelfieFrameHandoff::RetireSlot(int32 SlotIndex)
+{
+	StagingSlots[SlotIndex].State = ESlotState::Retiring;
+
+	ENQUEUE_UNIQUE_RENDER_COMMAND_TWOPARAMETER(
+		SelfieReadbackStaging,
+		FSelfieFrameHandoff*, Handoff, this,
+		int32, SlotIndex, SlotIndex,
+		{
+		Handoff->RenderThread_ReadbackSlot(RHICmdList, SlotIndex);
+	});
+}
+
+void FSelfieFrameHandoff::RenderThread_ReadbackSlot(FRHICommandListImmediate& RHICmdList, int32 SlotIndex)
+{
+	check(IsInRenderingThread());
+
+	// Only the texture and capture time are read here, the game thread doesn't touch either while the slot is retiring
+	const FStagingSlot& Slot = StagingSlots[SlotIndex];
+
+	FSelfieReadbackFrame* Frame = nullptr;
+	if (!FreeFrames.Dequeue(Frame))
+	{
+		Frame = new FSelfieReadbackFrame();
+	}
+
+	if (Frame->Pixels.Num() != Width * Height)
+	{
+		Frame->Pixels.Empty(Width * Height);
+		Frame->Pixels.AddUninitialized(Width * Height);
+	}
+	Frame->CaptureTime = Slot.CaptureTime;
+	Frame->SlotIndex = SlotIndex;
+
+	void* MappedData = nullptr;
+	int32 MappedWidth = 0;
+	int32 MappedHeight = 0;
+	RHICmdList.MapStagingSurface(Slot.Texture, MappedData, MappedWidth, MappedHeight);
+	if (MappedData)
+	{
+		// Mapped width is the row pitch in pixels, which may be padded
+		const FColor* Src = (const FColor*)MappedData;
+		const int32 SrcPitch = FMath::Max(MappedWidth, Width);
+		FColor* Dest = Frame->Pixels.GetData();
+		for (int32 y = 0; y < Height; y++)
+		{
+			FMemory::Memcpy(Dest + y * Width, Src + y * SrcPitch, Width * sizeof(FColor));
+		}
+	}
+	RHICmdList.UnmapStagingSurface(Slot.Texture);
+
+	CompletedFrames.Enqueue(Frame);
+}
+
+FSelfieReadbackFrame* FSelfieFrameHandoff::Dequeue()
+{
+	FSelfieReadbackFrame* Frame = nullptr;
+	if (CompletedFrames.Dequeue(Frame))
+	{
+		// The slot stayed retiring until its pixels showed up here
+		StagingSlots[Frame->SlotIndex].State = ESlotState::Free;
+	}
+	return Frame;
+}
+
+void FSelfieFrameHandoff::Recycle(FSelfieReadbackFrame* Frame)
+{
+	FreeFrames.Enqueue(Frame);
+}
+
+int32 FSelfieFrameHandoff::GetFramesInFlight() const
+{
+	int32 InFlight = 0;
+	for (const FStagingSlot& Slot : StagingSlots)
+	{
+		InFlight += Slot.State != ESlotState::Free ? 1 : 0;
+	}
+	return InFlight;
+}
@@ -0,0 +1,101 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "RHI.h"
+
+/** A frame read back from the GPU, owned by exactly one side of the handoff at a time */
+struct FSelfieReadbackFrame
+{
+	TArray<FColor> Pixels;
+	/** Pixels as the ring compressor coded them, see FSelfieRingCompressor */
+	TArray<uint8> Compressed;
+	double CaptureTime;
+	int32 SlotIndex;
+};
+
+/**
+ * Moves captured frames from the render thread to the game thread.
+ *
+ * The game thread owns a small set of CPU readback staging textures. Each capture copies into the next free one,
+ * a render command fence tracks when the copy has been issued, and the staging texture only gets mapped once it is
+ * a few frames old so the GPU is done with it and the render thread never blocks in Map.
+ * Mapped frames come back through a lock-free single producer/single consumer queue, empty frames go the other way.
+ */
+class FSelfieFrameHandoff
+{
+public:
+	FSelfieFrameHandoff();
+	~FSelfieFrameHandoff();
+
+	enum { MinDepth = 2, MaxDepth = 4 };
+
+	/** Game thread. Depth is the number of staging textures, frames are mapped Depth - 1 frames after capture */
+	void Init(int32 InWidth, int32 InHeight, int32 InDepth);
+
+	/** Game thread. Waits for anything in flight, then frees the staging textures and frames */
+	void Release();
+
+	bool IsInitialized() const { return StagingSlots.Num() > 0; }
+	int32 GetDepth() const { return StagingSlots.Num(); }
+
+	/** Game thread. False if every staging texture is still in flight */
+	bool CanSubmit() const;
+
+	/**
+	 * Game thread. Resamples the viewport back buffer to the capture size and copies it into the next staging texture.
+	 * SourceOrigin and SourceSize pick out part of it, 0-1, for one player's view in split-screen
+	 */
+	void SubmitViewport(const FViewportRHIRef& ViewportRHI, double CaptureTime, FVector2D SourceOrigin = FVector2D(0.0f, 0.0f), FVector2D SourceSize = FVector2D(1.0f, 1.0f));
+
+	/** Game thread. Copies a render target into the next staging texture, resampled to the capture size if it's any other size */
+	void SubmitRenderTarget(FRenderTarget* RenderTarget, double CaptureTime);
+
+	/** Game thread. Starts mapping staging textures that are old enough, call once per frame */
+	void Tick();
+
+	/** Game thread. Starts mapping everything in flight regardless of age and waits for it, used before saving */
+	void Flush();
+
+	/** Game thread. Oldest completed frame or nullptr, hand it back with Recycle once the pixels are taken */
+	FSelfieReadbackFrame* Dequeue();
+	void Recycle(FSelfieReadbackFrame* Frame);
+
+	int32 GetFramesInFlight() const;
+
+private:
+	enum class ESlotState : uint8
+	{
+		Free,
+		// Copy into the staging texture has been enqueued
+		Submitted,
+		// Map has been enqueued, slot comes back when its frame shows up in CompletedFrames
+		Retiring,
+	};
+
+	struct FStagingSlot
+	{
+		FTexture2DRHIRef Texture;
+		FRenderCommandFence CopyFence;
+		ESlotState State;
+		uint64 SubmitFrameNumber;
+		double CaptureTime;
+	};
+
+	int32 AcquireSlot();
+	void RetireSlot(int32 SlotIndex);
+	void RetireReadySlots(bool bForce);
+
+	/** Render thread. Maps a staging texture and pushes the pixels onto CompletedFrames */
+	void RenderThread_ReadbackSlot(FRHICommandListImmediate& RHICmdList, int32 SlotIndex);
+
+	int32 Width;
+	int32 Height;
+	int32 NextSlot;
+
+	TArray<FStagingSlot> StagingSlots;
+
+	// Render thread -> game thread
+	TQueue<FSelfieReadbackFrame*, EQueueMode::Spsc> CompletedFrames;
+	// Game thread -> render thread
+	TQueue<FSelfieReadbackFrame*, EQueueMode::Spsc> FreeFrames;
+};
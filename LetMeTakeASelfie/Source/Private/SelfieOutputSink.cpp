@@ -0,0 +1,233 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieOutputSink.h"
+
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "IPAddress.h"
+
+ISelfieOutputSink* ISelfieOutputSink::Create(const FString& Spec, const FString& FilePath, const FSelfieSinkWrite& Callback, TArray<uint8>* MemoryBuffer)
+{
+	FString Kind = Spec;
+	FString Arg;
+	Spec.Split(TEXT(":"), &Kind, &Arg);
+
+	if (Kind.IsEmpty() || Kind == TEXT("file"))
+	{
+		// Never over the top of something already there, that's an earlier clip
+		if (IFileManager::Get().FileSize(*FilePath) >= 0)
+		{
+			return nullptr;
+		}
+		FSelfieFileSink* Sink = new FSelfieFileSink(FilePath);
+		if (Sink->IsOpen())
+		{
+			return Sink;
+		}
+		delete Sink;
+	}
+	else if (Kind == TEXT("pipe") && !Arg.IsEmpty())
+	{
+		FSelfiePipeSink* Sink = new FSelfiePipeSink(Arg);
+		if (Sink->IsOpen())
+		{
+			return Sink;
+		}
+		delete Sink;
+	}
+	else if (Kind == TEXT("tcp") && Arg.IsNumeric())
+	{
+		FSelfieSocketSink* Sink = new FSelfieSocketSink(FCString::Atoi(*Arg));
+		if (Sink->IsOpen())
+		{
+			return Sink;
+		}
+		delete Sink;
+	}
+	else if (Kind == TEXT("callback") && Callback.IsBound())
+	{
+		return new FSelfieCallbackSink(Callback);
+	}
+	else if (Kind == TEXT("memory") && MemoryBuffer != nullptr)
+	{
+		return new FSelfieMemorySink(*MemoryBuffer);
+	}
+
+	return nullptr;
+}
+
+FSelfieFileSink::FSelfieFileSink(const FString& InPath)
+	: Path(InPath)
+{
+	FileHandle = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path);
+}
+
+FSelfieFileSink::~FSelfieFileSink()
+{
+	Close();
+}
+
+bool FSelfieFileSink::Write(const void* Data, int64 Length)
+{
+	return FileHandle && FileHandle->Write((const uint8*)Data, Length);
+}
+
+int64 FSelfieFileSink::Position() const
+{
+	return FileHandle ? FileHandle->Tell() : 0;
+}
+
+bool FSelfieFileSink::Seek(int64 NewPosition)
+{
+	return FileHandle && FileHandle->Seek(NewPosition);
+}
+
+void FSelfieFileSink::Close()
+{
+	delete FileHandle;
+	FileHandle = nullptr;
+}
+
+FSelfieMemorySink::FSelfieMemorySink(TArray<uint8>& InBuffer)
+	: Buffer(InBuffer)
+	, Offset(0)
+{
+	Buffer.Empty();
+}
+
+bool FSelfieMemorySink::Write(const void* Data, int64 Length)
+{
+	// The muxer seeks back to patch sizes, so this may overwrite as well as append
+	const int64 End = Offset + Length;
+	if (End > Buffer.Num())
+	{
+		Buffer.AddUninitialized(End - Buffer.Num());
+	}
+	FMemory::Memcpy(Buffer.GetData() + Offset, Data, Length);
+	Offset = End;
+	return true;
+}
+
+bool FSelfieMemorySink::Seek(int64 NewPosition)
+{
+	if (NewPosition < 0 || NewPosition > Buffer.Num())
+	{
+		return false;
+	}
+	Offset = NewPosition;
+	return true;
+}
+
+FSelfieCallbackSink::FSelfieCallbackSink(const FSelfieSinkWrite& InCallback)
+	: Callback(InCallback)
+	, BytesWritten(0)
+{
+}
+
+bool FSelfieCallbackSink::Write(const void* Data, int64 Length)
+{
+	BytesWritten += Length;
+	return Callback.Execute((const uint8*)Data, Length);
+}
+
+FSelfiePipeSink::FSelfiePipeSink(const FString& InPipeName)
+	: PipePath(FString(TEXT("\\\\.\\pipe\\")) + InPipeName)
+	, BytesWritten(0)
+{
+	// The uploader owns the pipe, we just connect to it as a client
+	PipeHandle = CreateFileW(*PipePath, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+}
+
+FSelfiePipeSink::~FSelfiePipeSink()
+{
+	Close();
+}
+
+bool FSelfiePipeSink::IsOpen() const
+{
+	return PipeHandle != INVALID_HANDLE_VALUE;
+}
+
+bool FSelfiePipeSink::Write(const void* Data, int64 Length)
+{
+	const uint8* Bytes = (const uint8*)Data;
+	while (Length > 0 && IsOpen())
+	{
+		DWORD Written = 0;
+		if (!WriteFile(PipeHandle, Bytes, (DWORD)FMath::Min<int64>(Length, MAXDWORD), &Written, nullptr))
+		{
+			return false;
+		}
+		Bytes += Written;
+		Length -= Written;
+		BytesWritten += Written;
+	}
+	return Length == 0;
+}
+
+void FSelfiePipeSink::Close()
+{
+	if (IsOpen())
+	{
+		FlushFileBuffers(PipeHandle);
+		CloseHandle(PipeHandle);
+		PipeHandle = INVALID_HANDLE_VALUE;
+	}
+}
+
+FSelfieSocketSink::FSelfieSocketSink(int32 InPort)
+	: Port(InPort)
+	, Socket(nullptr)
+	, BytesWritten(0)
+{
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	if (SocketSubsystem == nullptr)
+	{
+		return;
+	}
+
+	TSharedRef<FInternetAddr> Addr = SocketSubsystem->CreateInternetAddr(0x7f000001, Port);
+	Socket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("SelfieSocketSink"), false);
+	if (Socket)
+	{
+		// Blocking connect is fine, we're on the save thread and it's loopback
+		if (!Socket->Connect(*Addr))
+		{
+			SocketSubsystem->DestroySocket(Socket);
+			Socket = nullptr;
+		}
+	}
+}
+
+FSelfieSocketSink::~FSelfieSocketSink()
+{
+	Close();
+}
+
+bool FSelfieSocketSink::Write(const void* Data, int64 Length)
+{
+	const uint8* Bytes = (const uint8*)Data;
+	while (Length > 0 && Socket)
+	{
+		int32 Sent = 0;
+		if (!Socket->Send(Bytes, (int32)FMath::Min<int64>(Length, MAX_int32), Sent))
+		{
+			return false;
+		}
+		Bytes += Sent;
+		Length -= Sent;
+		BytesWritten += Sent;
+	}
+	return Length == 0;
+}
+
+void FSelfieSocketSink::Close()
+{
+	if (Socket)
+	{
+		Socket->Close();
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+		Socket = nullptr;
+	}
+}
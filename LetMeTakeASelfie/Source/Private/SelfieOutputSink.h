@@ -0,0 +1,124 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+/** Receives the encoded clip as it's written, Data is only valid during the call */
+DECLARE_DELEGATE_RetVal_TwoParams(bool, FSelfieSinkWrite, const uint8* /*Data*/, int64 /*Length*/);
+
+/**
+ * Where the WebM bytes go.
+ * Streaming sinks aren't seekable, the muxer writes a live stream with unknown sizes for those instead of going back to patch the header.
+ */
+class ISelfieOutputSink
+{
+public:
+	virtual ~ISelfieOutputSink() {}
+
+	/** False on failure, the save gets abandoned */
+	virtual bool Write(const void* Data, int64 Length) = 0;
+	virtual int64 Position() const = 0;
+	virtual bool IsSeekable() const { return false; }
+	virtual bool Seek(int64 NewPosition) { return false; }
+	virtual void Close() {}
+
+	/** For the log */
+	virtual FString Describe() const = 0;
+
+	/**
+	 * Builds a sink from a console style spec:
+	 *   file            - FilePath on disk, the default. Fails if FilePath already exists
+	 *   pipe:<name>     - \\.\pipe\<name>, the pipe server has to exist already
+	 *   tcp:<port>      - TCP connection to 127.0.0.1:<port>
+	 *   callback        - Callback gets every block
+	 *   memory          - appended to MemoryBuffer
+	 * Returns nullptr if the spec is bad or the connection couldn't be made.
+	 */
+	static ISelfieOutputSink* Create(const FString& Spec, const FString& FilePath, const FSelfieSinkWrite& Callback, TArray<uint8>* MemoryBuffer);
+};
+
+class FSelfieFileSink : public ISelfieOutputSink
+{
+public:
+	FSelfieFileSink(const FString& InPath);
+	virtual ~FSelfieFileSink();
+
+	bool IsOpen() const { return FileHandle != nullptr; }
+
+	virtual bool Write(const void* Data, int64 Length) override;
+	virtual int64 Position() const override;
+	virtual bool IsSeekable() const override { return true; }
+	virtual bool Seek(int64 NewPosition) override;
+	virtual void Close() override;
+	virtual FString Describe() const override { return Path; }
+
+private:
+	FString Path;
+	IFileHandle* FileHandle;
+};
+
+class FSelfieMemorySink : public ISelfieOutputSink
+{
+public:
+	FSelfieMemorySink(TArray<uint8>& InBuffer);
+
+	virtual bool Write(const void* Data, int64 Length) override;
+	virtual int64 Position() const override { return Offset; }
+	virtual bool IsSeekable() const override { return true; }
+	virtual bool Seek(int64 NewPosition) override;
+	virtual FString Describe() const override { return FString::Printf(TEXT("memory (%d bytes)"), Buffer.Num()); }
+
+private:
+	TArray<uint8>& Buffer;
+	int64 Offset;
+};
+
+class FSelfieCallbackSink : public ISelfieOutputSink
+{
+public:
+	FSelfieCallbackSink(const FSelfieSinkWrite& InCallback);
+
+	virtual bool Write(const void* Data, int64 Length) override;
+	virtual int64 Position() const override { return BytesWritten; }
+	virtual FString Describe() const override { return TEXT("callback"); }
+
+private:
+	FSelfieSinkWrite Callback;
+	int64 BytesWritten;
+};
+
+class FSelfiePipeSink : public ISelfieOutputSink
+{
+public:
+	FSelfiePipeSink(const FString& InPipeName);
+	virtual ~FSelfiePipeSink();
+
+	bool IsOpen() const;
+
+	virtual bool Write(const void* Data, int64 Length) override;
+	virtual int64 Position() const override { return BytesWritten; }
+	virtual void Close() override;
+	virtual FString Describe() const override { return PipePath; }
+
+private:
+	FString PipePath;
+	HANDLE PipeHandle;
+	int64 BytesWritten;
+};
+
+class FSelfieSocketSink : public ISelfieOutputSink
+{
+public:
+	FSelfieSocketSink(int32 InPort);
+	virtual ~FSelfieSocketSink();
+
+	bool IsOpen() const { return Socket != nullptr; }
+
+	virtual bool Write(const void* Data, int64 Length) override;
+	virtual int64 Position() const override { return BytesWritten; }
+	virtual void Close() override;
+	virtual FString Describe() const override { return FString::Printf(TEXT("127.0.0.1:%d"), Port); }
+
+private:
+	int32 Port;
+	class FSocket* Socket;
+	int64 BytesWritten;
+};
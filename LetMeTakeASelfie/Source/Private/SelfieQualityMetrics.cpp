@@ -0,0 +1,186 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieQualityMetrics.h"
+
+#include <emmintrin.h>
+
+uint64 FSelfieQualityMetrics::SumSquaredErrorScalar(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height)
+{
+	uint64 Total = 0;
+	for (int32 y = 0; y < Height; y++)
+	{
+		for (int32 x = 0; x < Width; x++)
+		{
+			const int32 Diff = (int32)A[x] - (int32)B[x];
+			Total += Diff * Diff;
+		}
+		A += StrideA;
+		B += StrideB;
+	}
+	return Total;
+}
+
+uint64 FSelfieQualityMetrics::SumSquaredError(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const int32 VectorWidth = Width & ~15;
+
+	uint64 Total = 0;
+	for (int32 y = 0; y < Height; y++)
+	{
+		// 16 pixels a step, each 32 bit lane gets at most 4 * 255^2 per step so a row of any sane width can't overflow
+		__m128i RowSum = _mm_setzero_si128();
+		for (int32 x = 0; x < VectorWidth; x += 16)
+		{
+			const __m128i VA = _mm_loadu_si128((const __m128i*)(A + x));
+			const __m128i VB = _mm_loadu_si128((const __m128i*)(B + x));
+
+			const __m128i DiffLo = _mm_sub_epi16(_mm_unpacklo_epi8(VA, Zero), _mm_unpacklo_epi8(VB, Zero));
+			const __m128i DiffHi = _mm_sub_epi16(_mm_unpackhi_epi8(VA, Zero), _mm_unpackhi_epi8(VB, Zero));
+
+			RowSum = _mm_add_epi32(RowSum, _mm_madd_epi16(DiffLo, DiffLo));
+			RowSum = _mm_add_epi32(RowSum, _mm_madd_epi16(DiffHi, DiffHi));
+		}
+
+		// Widen to 64 bits once per row
+		const __m128i Sum64 = _mm_add_epi64(_mm_unpacklo_epi32(RowSum, Zero), _mm_unpackhi_epi32(RowSum, Zero));
+		uint64 Lanes[2];
+		_mm_storeu_si128((__m128i*)Lanes, Sum64);
+		Total += Lanes[0] + Lanes[1];
+
+		for (int32 x = VectorWidth; x < Width; x++)
+		{
+			const int32 Diff = (int32)A[x] - (int32)B[x];
+			Total += Diff * Diff;
+		}
+
+		A += StrideA;
+		B += StrideB;
+	}
+	return Total;
+}
+
+struct FSelfieSSIMSums
+{
+	uint32 SumA;
+	uint32 SumB;
+	uint32 SumSqA;
+	uint32 SumSqB;
+	uint32 SumAB;
+};
+
+static double SelfieSSIMFromSums(const FSelfieSSIMSums& Sums)
+{
+	// Standard constants for 8 bit, K1 = 0.01 and K2 = 0.03
+	const double C1 = 6.5025;
+	const double C2 = 58.5225;
+	const double Count = 64.0;
+
+	const double MeanA = Sums.SumA / Count;
+	const double MeanB = Sums.SumB / Count;
+	const double VarA = Sums.SumSqA / Count - MeanA * MeanA;
+	const double VarB = Sums.SumSqB / Count - MeanB * MeanB;
+	const double Covariance = Sums.SumAB / Count - MeanA * MeanB;
+
+	return ((2.0 * MeanA * MeanB + C1) * (2.0 * Covariance + C2)) / ((MeanA * MeanA + MeanB * MeanB + C1) * (VarA + VarB + C2));
+}
+
+static void SelfieSSIMBlockScalar(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, FSelfieSSIMSums& Sums)
+{
+	FMemory::Memzero(Sums);
+	for (int32 y = 0; y < 8; y++)
+	{
+		for (int32 x = 0; x < 8; x++)
+		{
+			const uint32 PA = A[x];
+			const uint32 PB = B[x];
+			Sums.SumA += PA;
+			Sums.SumB += PB;
+			Sums.SumSqA += PA * PA;
+			Sums.SumSqB += PB * PB;
+			Sums.SumAB += PA * PB;
+		}
+		A += StrideA;
+		B += StrideB;
+	}
+}
+
+static FORCEINLINE uint32 SelfieHorizontalSum32(__m128i V)
+{
+	V = _mm_add_epi32(V, _mm_shuffle_epi32(V, _MM_SHUFFLE(1, 0, 3, 2)));
+	V = _mm_add_epi32(V, _mm_shuffle_epi32(V, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32)_mm_cvtsi128_si32(V);
+}
+
+static void SelfieSSIMBlockSSE2(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, FSelfieSSIMSums& Sums)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	__m128i SumA = _mm_setzero_si128();
+	__m128i SumB = _mm_setzero_si128();
+	__m128i SumSqA = _mm_setzero_si128();
+	__m128i SumSqB = _mm_setzero_si128();
+	__m128i SumAB = _mm_setzero_si128();
+
+	for (int32 y = 0; y < 8; y++)
+	{
+		// 8 pixels a row, widened to 16 bits
+		const __m128i VA = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)A), Zero);
+		const __m128i VB = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)B), Zero);
+
+		SumA = _mm_add_epi16(SumA, VA);
+		SumB = _mm_add_epi16(SumB, VB);
+		SumSqA = _mm_add_epi32(SumSqA, _mm_madd_epi16(VA, VA));
+		SumSqB = _mm_add_epi32(SumSqB, _mm_madd_epi16(VB, VB));
+		SumAB = _mm_add_epi32(SumAB, _mm_madd_epi16(VA, VB));
+
+		A += StrideA;
+		B += StrideB;
+	}
+
+	// 16 bit sums top out at 8 * 255, widen them with a multiply by one
+	const __m128i One = _mm_set1_epi16(1);
+	Sums.SumA = SelfieHorizontalSum32(_mm_madd_epi16(SumA, One));
+	Sums.SumB = SelfieHorizontalSum32(_mm_madd_epi16(SumB, One));
+	Sums.SumSqA = SelfieHorizontalSum32(SumSqA);
+	Sums.SumSqB = SelfieHorizontalSum32(SumSqB);
+	Sums.SumAB = SelfieHorizontalSum32(SumAB);
+}
+
+template<void (*BlockSums)(const uint8*, int32, const uint8*, int32, FSelfieSSIMSums&)>
+static double SelfieSSIMImpl(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height)
+{
+	double Total = 0;
+	int32 NumBlocks = 0;
+	for (int32 y = 0; y + 8 <= Height; y += 4)
+	{
+		for (int32 x = 0; x + 8 <= Width; x += 4)
+		{
+			FSelfieSSIMSums Sums;
+			BlockSums(A + y * StrideA + x, StrideA, B + y * StrideB + x, StrideB, Sums);
+			Total += SelfieSSIMFromSums(Sums);
+			NumBlocks++;
+		}
+	}
+	return NumBlocks > 0 ? Total / NumBlocks : 1.0;
+}
+
+double FSelfieQualityMetrics::SSIM(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height)
+{
+	return SelfieSSIMImpl<SelfieSSIMBlockSSE2>(A, StrideA, B, StrideB, Width, Height);
+}
+
+double FSelfieQualityMetrics::SSIMScalar(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height)
+{
+	return SelfieSSIMImpl<SelfieSSIMBlockScalar>(A, StrideA, B, StrideB, Width, Height);
+}
+
+double FSelfieQualityMetrics::PSNR(uint64 SumSquaredError, uint64 NumSamples)
+{
+	if (SumSquaredError == 0 || NumSamples == 0)
+	{
+		return 100.0;
+	}
+	const double MSE = (double)SumSquaredError / NumSamples;
+	return FMath::Min(100.0, 10.0 * log10(255.0 * 255.0 / MSE));
+}
@@ -0,0 +1,20 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+/**
+ * Objective quality metrics for 8 bit planes, used to pick encoder settings.
+ * The SSE2 kernels give the same results as the scalar versions, which are kept around as the reference.
+ */
+struct FSelfieQualityMetrics
+{
+	/** Sum of squared differences between two planes */
+	static uint64 SumSquaredError(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height);
+	static uint64 SumSquaredErrorScalar(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height);
+
+	/** Mean SSIM over 8x8 windows stepped by 4 pixels, same windowing as libvpx's vpx_ssim */
+	static double SSIM(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height);
+	static double SSIMScalar(const uint8* A, int32 StrideA, const uint8* B, int32 StrideB, int32 Width, int32 Height);
+
+	/** PSNR in dB from a squared error total, capped at 100 for identical planes */
+	static double PSNR(uint64 SumSquaredError, uint64 NumSamples);
+};
@@ -0,0 +1,165 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieRingBenchCommandlet.h"
+#include "SelfieRingDump.h"
+#include "SelfieRingCompression.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieRingBench, Log, All);
+
+USelfieRingBenchCommandlet::USelfieRingBenchCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+/** Something like a slow pan: textured gradients scrolling sideways, a box moving across and a HUD that stays put */
+static void MakeSyntheticFrame(int32 Width, int32 Height, int32 FrameIndex, TArray<FColor>& OutPixels)
+{
+	OutPixels.Empty(Width * Height);
+	OutPixels.AddUninitialized(Width * Height);
+	const int32 Scroll = FrameIndex * 3;
+	const int32 BoxX = (FrameIndex * 11) % FMath::Max(Width - 64, 1);
+	for (int32 y = 0; y < Height; y++)
+	{
+		for (int32 x = 0; x < Width; x++)
+		{
+			FColor& Pixel = OutPixels[y * Width + x];
+			if (y >= Height - 48 && x < 320)
+			{
+				Pixel = FColor(32, 200, 255);
+				continue;
+			}
+			if (x >= BoxX && x < BoxX + 64 && y >= Height / 2 && y < Height / 2 + 64)
+			{
+				Pixel = FColor(200, 40, 40);
+				continue;
+			}
+			// Texture detail moves with the scroll rather than flickering, like the world does
+			const int32 u = x + Scroll;
+			const int32 Detail = (int32)((u * 73856093u ^ y * 19349663u) >> 28) - 8;
+			Pixel.R = (uint8)FMath::Clamp(u % 256 + Detail, 0, 255);
+			Pixel.G = (uint8)FMath::Clamp((y * 2) % 256 + Detail, 0, 255);
+			Pixel.B = (uint8)FMath::Clamp((u + y) / 2 % 256 - Detail, 0, 255);
+			Pixel.A = 255;
+		}
+	}
+}
+
+int32 USelfieRingBenchCommandlet::Main(const FString& Params)
+{
+	int32 Width = 1280;
+	int32 Height = 720;
+	int32 NumFrames = 90;
+	int32 Passes = 3;
+	FParse::Value(*Params, TEXT("Width="), Width);
+	FParse::Value(*Params, TEXT("Height="), Height);
+	FParse::Value(*Params, TEXT("Frames="), NumFrames);
+	FParse::Value(*Params, TEXT("Passes="), Passes);
+	Passes = FMath::Max(Passes, 1);
+
+	TArray< TArray<FColor> > Frames;
+	FString DumpPath;
+	if (FParse::Value(*Params, TEXT("Dump="), DumpPath))
+	{
+		FSelfieRingDumpHeader Header;
+		if (!FSelfieRingDump::Read(DumpPath, Header, Frames) || Header.NumFrames == 0)
+		{
+			UE_LOG(LogUTSelfieRingBench, Error, TEXT("Couldn't read ring dump %s"), *DumpPath);
+			return 1;
+		}
+		Width = Header.Width;
+		Height = Header.Height;
+	}
+	else
+	{
+		Width = FMath::Max(Width, 1);
+		Height = FMath::Max(Height, 1);
+		Frames.AddDefaulted(FMath::Max(NumFrames, 1));
+		for (int32 FrameIndex = 0; FrameIndex < Frames.Num(); FrameIndex++)
+		{
+			MakeSyntheticFrame(Width, Height, FrameIndex, Frames[FrameIndex]);
+		}
+	}
+
+	UE_LOG(LogUTSelfieRingBench, Display, TEXT("%d frames of %dx%d, best of %d passes"), Frames.Num(), Width, Height, Passes);
+
+	const int64 FrameBytes = (int64)Width * Height * sizeof(FColor);
+	const int32 KeyIntervals[] = { 1, 4, 8, 16, 30 };
+	TArray< TArray<uint8> > Compressed;
+	Compressed.AddDefaulted(Frames.Num());
+	TArray<FColor> Decoded;
+	Decoded.AddUninitialized(Width * Height);
+
+	int32 NumMismatches = 0;
+	for (const int32 KeyInterval : KeyIntervals)
+	{
+		double BestEncodeSeconds = DBL_MAX;
+		double BestDecodeSeconds = DBL_MAX;
+		bool bExact = true;
+		for (int32 Pass = 0; Pass < Passes; Pass++)
+		{
+			// Fresh codecs each pass, same as a ring that's just been made
+			FSelfieFrameCodec Encoder(Width, Height);
+			double StartTime = FPlatformTime::Seconds();
+			for (int32 FrameIndex = 0; FrameIndex < Frames.Num(); FrameIndex++)
+			{
+				Encoder.Encode(Frames[FrameIndex].GetData(), FrameIndex % KeyInterval == 0, Compressed[FrameIndex]);
+			}
+			BestEncodeSeconds = FMath::Min(BestEncodeSeconds, FPlatformTime::Seconds() - StartTime);
+
+			FSelfieFrameCodec Decoder(Width, Height);
+			StartTime = FPlatformTime::Seconds();
+			for (int32 FrameIndex = 0; FrameIndex < Frames.Num(); FrameIndex++)
+			{
+				bExact &= Decoder.Decode(Compressed[FrameIndex]);
+				Decoder.GetPixels(Decoded.GetData());
+				if (Pass == 0)
+				{
+					// Only checked the once, and outside the timing that counts
+					const double CheckStartTime = FPlatformTime::Seconds();
+					bExact &= FMemory::Memcmp(Decoded.GetData(), Frames[FrameIndex].GetData(), FrameBytes) == 0;
+					StartTime += FPlatformTime::Seconds() - CheckStartTime;
+				}
+			}
+			BestDecodeSeconds = FMath::Min(BestDecodeSeconds, FPlatformTime::Seconds() - StartTime);
+		}
+
+		int64 KeyBytes = 0;
+		int64 DeltaBytes = 0;
+		int32 NumKeyFrames = 0;
+		for (const TArray<uint8>& Frame : Compressed)
+		{
+			if (FSelfieFrameCodec::IsKeyFrame(Frame))
+			{
+				KeyBytes += Frame.Num();
+				NumKeyFrames++;
+			}
+			else
+			{
+				DeltaBytes += Frame.Num();
+			}
+		}
+		const int32 NumDeltaFrames = Frames.Num() - NumKeyFrames;
+		const double Ratio = (double)FrameBytes * Frames.Num() / FMath::Max<int64>(KeyBytes + DeltaBytes, 1);
+
+		if (!bExact)
+		{
+			NumMismatches++;
+		}
+
+		UE_LOG(LogUTSelfieRingBench, Display, TEXT("Key every %2d: %5.2fx, key %6.0f KB, delta %6.0f KB, encode %9.0f ns/frame, decode %9.0f ns/frame%s"),
+			KeyInterval, Ratio, NumKeyFrames > 0 ? KeyBytes / 1024.0 / NumKeyFrames : 0.0, NumDeltaFrames > 0 ? DeltaBytes / 1024.0 / NumDeltaFrames : 0.0,
+			BestEncodeSeconds * 1e9 / Frames.Num(), BestDecodeSeconds * 1e9 / Frames.Num(), bExact ? TEXT("") : TEXT(" MISMATCH"));
+	}
+
+	if (NumMismatches > 0)
+	{
+		UE_LOG(LogUTSelfieRingBench, Error, TEXT("%d key intervals didn't round trip"), NumMismatches);
+		return 1;
+	}
+	return 0;
+}
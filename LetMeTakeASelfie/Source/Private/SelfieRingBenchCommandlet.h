@@ -0,0 +1,21 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieRingBenchCommandlet.generated.h"
+
+/**
+ * Compression ratio and cost of FSelfieFrameCodec for a few key frame intervals, and checks every frame comes back exact.
+ *
+ * Runs over the frames of a ring dump made with SELFIEDUMP, or synthetic ones if there isn't one. Synthetic frames are
+ * kinder than real play, a dump is the one to quote. Prints the ratio, key and delta frame sizes, ns per frame each way.
+ * The ratio is roughly what SELFIECOMPRESS SCALE= can be set to. Returns 1 if any frame doesn't round trip.
+ *
+ * UE4Editor-Cmd.exe UnrealTournament -run=SelfieRingBench [-Dump=<file>] [-Width=1280 -Height=720 -Frames=90] [-Passes=3]
+ */
+UCLASS()
+class USelfieRingBenchCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	virtual int32 Main(const FString& Params) override;
+};
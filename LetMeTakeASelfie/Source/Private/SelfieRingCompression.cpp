@@ -0,0 +1,375 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieRingCompression.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieRing, Log, All);
+
+FSelfieFrameCodec::FSelfieFrameCodec(int32 InWidth, int32 InHeight)
+	: Width(InWidth)
+	, Height(InHeight)
+	, NumPixels(InWidth * InHeight)
+{
+	Planes.Init(0, NumPixels * 4);
+	Delta.Init(0, NumPixels * 4);
+	Packed.Init(0, NumPixels * 4);
+}
+
+void FSelfieFrameCodec::Encode(const FColor* Pixels, bool bKeyFrame, TArray<uint8>& OutCompressed)
+{
+	const uint8* Source = (const uint8*)Pixels;
+	uint8* Previous[4] = { Planes.GetData(), Planes.GetData() + NumPixels, Planes.GetData() + NumPixels * 2, Planes.GetData() + NumPixels * 3 };
+	uint8* Dest[4] = { Delta.GetData(), Delta.GetData() + NumPixels, Delta.GetData() + NumPixels * 2, Delta.GetData() + NumPixels * 3 };
+
+	// A key frame is its difference from black
+	if (bKeyFrame)
+	{
+		FMemory::Memzero(Planes.GetData(), Planes.Num());
+	}
+	for (int32 PixelIndex = 0; PixelIndex < NumPixels; PixelIndex++, Source += 4)
+	{
+		for (int32 Channel = 0; Channel < 4; Channel++)
+		{
+			Dest[Channel][PixelIndex] = Source[Channel] - Previous[Channel][PixelIndex];
+			Previous[Channel][PixelIndex] = Source[Channel];
+		}
+	}
+
+	const int32 NumBytes = NumPixels * 4;
+	uint8 Flags = bKeyFrame ? KeyFrameFlag : 0;
+	int32 PayloadSize = Packed.Num();
+	const uint8* Payload = Packed.GetData();
+	if (!FCompression::CompressMemory((ECompressionFlags)(COMPRESS_ZLIB | COMPRESS_BiasSpeed), Packed.GetData(), PayloadSize, Delta.GetData(), NumBytes))
+	{
+		// Wouldn't fit in the same size, noise or a scene cut
+		Flags |= StoredFlag;
+		PayloadSize = NumBytes;
+		Payload = Delta.GetData();
+	}
+
+	// Exactly the size it needs, the ring's budget counts these
+	OutCompressed.Empty(HeaderSize + PayloadSize);
+	OutCompressed.AddZeroed(HeaderSize);
+	OutCompressed[0] = Flags;
+	OutCompressed.Append(Payload, PayloadSize);
+}
+
+bool FSelfieFrameCodec::Decode(const TArray<uint8>& Compressed)
+{
+	if (Compressed.Num() < HeaderSize)
+	{
+		return false;
+	}
+
+	const uint8 Flags = Compressed[0];
+	const uint8* Payload = Compressed.GetData() + HeaderSize;
+	const int32 PayloadSize = Compressed.Num() - HeaderSize;
+	const int32 NumBytes = NumPixels * 4;
+
+	// Key frames go straight into the planes, deltas get added on
+	uint8* Dest = (Flags & KeyFrameFlag) ? Planes.GetData() : Delta.GetData();
+	if (Flags & StoredFlag)
+	{
+		if (PayloadSize != NumBytes)
+		{
+			return false;
+		}
+		FMemory::Memcpy(Dest, Payload, NumBytes);
+	}
+	else if (!FCompression::UncompressMemory(COMPRESS_ZLIB, Dest, NumBytes, Payload, PayloadSize))
+	{
+		return false;
+	}
+
+	if (!(Flags & KeyFrameFlag))
+	{
+		uint8* PlaneBytes = Planes.GetData();
+		const uint8* DeltaBytes = Delta.GetData();
+		for (int32 Index = 0; Index < NumBytes; Index++)
+		{
+			PlaneBytes[Index] += DeltaBytes[Index];
+		}
+	}
+	return true;
+}
+
+void FSelfieFrameCodec::GetPixels(FColor* OutPixels) const
+{
+	const uint8* Source[4] = { Planes.GetData(), Planes.GetData() + NumPixels, Planes.GetData() + NumPixels * 2, Planes.GetData() + NumPixels * 3 };
+	uint8* Dest = (uint8*)OutPixels;
+	for (int32 PixelIndex = 0; PixelIndex < NumPixels; PixelIndex++, Dest += 4)
+	{
+		Dest[0] = Source[0][PixelIndex];
+		Dest[1] = Source[1][PixelIndex];
+		Dest[2] = Source[2][PixelIndex];
+		Dest[3] = Source[3][PixelIndex];
+	}
+}
+
+bool FSelfieFrameCodec::IsKeyFrame(const TArray<uint8>& Compressed)
+{
+	return Compressed.Num() >= HeaderSize && (Compressed[0] & KeyFrameFlag) != 0;
+}
+
+FSelfieRingCompressor::FSelfieRingCompressor()
+	: Codec(nullptr)
+	, KeyInterval(1)
+	, FramesSinceKey(0)
+	, Thread(nullptr)
+	, WorkEvent(nullptr)
+	, FramesCompressed(0)
+	, KeyFramesCompressed(0)
+	, RawBytes(0)
+	, CompressedBytes(0)
+	, CompressSeconds(0)
+{
+}
+
+FSelfieRingCompressor::~FSelfieRingCompressor()
+{
+	Release();
+}
+
+void FSelfieRingCompressor::Init(int32 InWidth, int32 InHeight, int32 InKeyInterval)
+{
+	Release();
+
+	Codec = new FSelfieFrameCodec(InWidth, InHeight);
+	KeyInterval = FMath::Max(InKeyInterval, 1);
+	FramesSinceKey = KeyInterval;
+	ForceKeyFrameCounter.Reset();
+	FramesCompressed = 0;
+	KeyFramesCompressed = 0;
+	RawBytes = 0;
+	CompressedBytes = 0;
+	CompressSeconds = 0;
+
+	StopTaskCounter.Reset();
+	WorkEvent = FPlatformProcess::CreateSynchEvent();
+	Thread = FRunnableThread::Create(this, TEXT("FSelfieRingCompressor"), 0, TPri_BelowNormal);
+}
+
+void FSelfieRingCompressor::Release()
+{
+	if (Thread)
+	{
+		// Frames not compressed yet are dropped with the rest, no waiting on the ingest thread
+		Stop();
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+	if (WorkEvent)
+	{
+		delete WorkEvent;
+		WorkEvent = nullptr;
+	}
+
+	// Pending or compressed but never collected, nobody's going to now so they're freed here. The handoff makes new ones as it needs them
+	FSelfieReadbackFrame* Frame = nullptr;
+	while (PendingFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+	while (CompressedFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+	PendingCount.Reset();
+
+	delete Codec;
+	Codec = nullptr;
+}
+
+void FSelfieRingCompressor::Push(FSelfieReadbackFrame* Frame)
+{
+	check(IsActive());
+	PendingFrames.Enqueue(Frame);
+	PendingCount.Increment();
+	WorkEvent->Trigger();
+}
+
+FSelfieReadbackFrame* FSelfieRingCompressor::DequeueCompressed()
+{
+	FSelfieReadbackFrame* Frame = nullptr;
+	CompressedFrames.Dequeue(Frame);
+	return Frame;
+}
+
+void FSelfieRingCompressor::LogStats(FOutputDevice& Ar) const
+{
+	if (!IsActive())
+	{
+		return;
+	}
+
+	Ar.Logf(TEXT("Ring compression %d frames (%d key), %.2fx, %.2fms average, %d pending"), FramesCompressed, KeyFramesCompressed,
+		CompressedBytes > 0 ? (double)RawBytes / CompressedBytes : 0.0, FramesCompressed > 0 ? CompressSeconds * 1000.0 / FramesCompressed : 0.0, PendingCount.GetValue());
+}
+
+uint32 FSelfieRingCompressor::Run()
+{
+	while (StopTaskCounter.GetValue() == 0)
+	{
+		FSelfieReadbackFrame* Frame = nullptr;
+		if (!PendingFrames.Dequeue(Frame))
+		{
+			WorkEvent->Wait(100);
+			continue;
+		}
+
+		const double StartTime = FPlatformTime::Seconds();
+
+		const bool bKeyFrame = ForceKeyFrameCounter.Reset() != 0 || FramesSinceKey >= KeyInterval;
+		FramesSinceKey = bKeyFrame ? 1 : FramesSinceKey + 1;
+		Codec->Encode(Frame->Pixels.GetData(), bKeyFrame, Frame->Compressed);
+
+		CompressSeconds += FPlatformTime::Seconds() - StartTime;
+		FramesCompressed++;
+		KeyFramesCompressed += bKeyFrame ? 1 : 0;
+		RawBytes += Frame->Pixels.Num() * sizeof(FColor);
+		CompressedBytes += Frame->Compressed.Num();
+
+		CompressedFrames.Enqueue(Frame);
+		PendingCount.Decrement();
+	}
+
+	return 0;
+}
+
+void FSelfieRingCompressor::Stop()
+{
+	StopTaskCounter.Increment();
+	if (WorkEvent)
+	{
+		WorkEvent->Trigger();
+	}
+}
+
+FSelfieRingDecoder::FSelfieRingDecoder(int32 InWidth, int32 InHeight, const FSelfieGetCompressedFrame& InGetCompressed, int32 InNumCached)
+	: Codec(InWidth, InHeight)
+	, GetCompressed(InGetCompressed)
+	, DecodedFrame(INDEX_NONE)
+	, NumCached(FMath::Clamp<int32>(InNumCached, 1, NumCachedFrames))
+	, UseCounter(0)
+	, FramesDecoded(0)
+	, DecodeSeconds(0)
+{
+	for (FCachedFrame& Cached : Cache)
+	{
+		Cached.FrameIndex = INDEX_NONE;
+		Cached.LastUsed = 0;
+	}
+}
+
+const FColor* FSelfieRingDecoder::GetFrame(int32 FrameIndex)
+{
+	FScopeLock ScopeLock(&Lock);
+
+	// The caller's own buffer, nothing another thread decodes can touch it
+	const uint32 ThreadId = FPlatformTLS::GetCurrentThreadId();
+	FThreadFrames* Frames = nullptr;
+	for (FThreadFrames& Existing : ThreadFrames)
+	{
+		if (Existing.ThreadId == ThreadId)
+		{
+			Frames = &Existing;
+			break;
+		}
+	}
+	if (Frames == nullptr)
+	{
+		Frames = &ThreadFrames[ThreadFrames.AddDefaulted()];
+		Frames->ThreadId = ThreadId;
+		Frames->NextBuffer = 0;
+	}
+	TArray<FColor>& Buffer = Frames->Buffers[Frames->NextBuffer];
+	Frames->NextBuffer ^= 1;
+	if (Buffer.Num() == 0)
+	{
+		Buffer.AddUninitialized(Codec.GetWidth() * Codec.GetHeight());
+	}
+
+	FMemory::Memcpy(Buffer.GetData(), GetCachedFrame(FrameIndex)->Pixels.GetData(), Buffer.Num() * sizeof(FColor));
+	return Buffer.GetData();
+}
+
+FSelfieRingDecoder::FCachedFrame* FSelfieRingDecoder::GetCachedFrame(int32 FrameIndex)
+{
+	UseCounter++;
+	if (FCachedFrame* Cached = FindCached(FrameIndex))
+	{
+		Cached->LastUsed = UseCounter;
+		return Cached;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	// Back to the nearest key frame, or to just after the last frame decoded if that comes first
+	int32 StartIndex = FrameIndex;
+	if (DecodedFrame != FrameIndex)
+	{
+		while (StartIndex > 0 && StartIndex != DecodedFrame + 1 && !FSelfieFrameCodec::IsKeyFrame(*GetCompressed.Execute(StartIndex)))
+		{
+			StartIndex--;
+		}
+	}
+	else
+	{
+		StartIndex = FrameIndex + 1;
+	}
+
+	for (int32 Index = StartIndex; Index <= FrameIndex; Index++)
+	{
+		if (!Codec.Decode(*GetCompressed.Execute(Index)))
+		{
+			UE_LOG(LogUTSelfieRing, Warning, TEXT("Couldn't decode ring frame %d"), Index);
+		}
+		DecodedFrame = Index;
+		FramesDecoded++;
+
+		// The convert workers ask a little out of order, so the frame or two before this one are worth keeping too
+		if (Index < FrameIndex && FrameIndex - Index <= 2 && FindCached(Index) == nullptr)
+		{
+			Codec.GetPixels(AllocateCached(Index)->Pixels.GetData());
+		}
+	}
+
+	FCachedFrame* Cached = AllocateCached(FrameIndex);
+	Codec.GetPixels(Cached->Pixels.GetData());
+
+	DecodeSeconds += FPlatformTime::Seconds() - StartTime;
+	return Cached;
+}
+
+FSelfieRingDecoder::FCachedFrame* FSelfieRingDecoder::FindCached(int32 FrameIndex)
+{
+	for (FCachedFrame& Cached : Cache)
+	{
+		if (Cached.FrameIndex == FrameIndex)
+		{
+			return &Cached;
+		}
+	}
+	return nullptr;
+}
+
+FSelfieRingDecoder::FCachedFrame* FSelfieRingDecoder::AllocateCached(int32 FrameIndex)
+{
+	FCachedFrame* Oldest = &Cache[0];
+	for (int32 CacheIndex = 1; CacheIndex < NumCached; CacheIndex++)
+	{
+		if (Cache[CacheIndex].LastUsed < Oldest->LastUsed)
+		{
+			Oldest = &Cache[CacheIndex];
+		}
+	}
+
+	if (Oldest->Pixels.Num() == 0)
+	{
+		Oldest->Pixels.AddUninitialized(Codec.GetWidth() * Codec.GetHeight());
+	}
+	Oldest->FrameIndex = FrameIndex;
+	Oldest->LastUsed = UseCounter;
+	return Oldest;
+}
@@ -0,0 +1,170 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieFrameHandoff.h"
+
+/** Compressed ring frame by index, oldest being saved first */
+DECLARE_DELEGATE_RetVal_OneParam(const TArray<uint8>*, FSelfieGetCompressedFrame, int32);
+
+/**
+ * Lossless coding for ring frames.
+ *
+ * BGRA is split into B, G, R and A planes so like bytes sit together, each plane is the byte difference from the same
+ * plane of the frame before, and the lot goes through zlib at its fastest. Consecutive game frames are mostly the same,
+ * so the differences are mostly zeros and squash a long way. Key frames skip the difference so decoding can start
+ * somewhere other than the very first frame. An instance only goes one way, frames in capture order.
+ */
+class FSelfieFrameCodec
+{
+public:
+	FSelfieFrameCodec(int32 InWidth, int32 InHeight);
+
+	/** A delta frame is against the last frame encoded, the first one encoded should be a key frame */
+	void Encode(const FColor* Pixels, bool bKeyFrame, TArray<uint8>& OutCompressed);
+
+	/** A delta frame is applied to the last frame decoded. False if Compressed is corrupt, the frame is garbage then */
+	bool Decode(const TArray<uint8>& Compressed);
+	/** Last frame decoded */
+	void GetPixels(FColor* OutPixels) const;
+
+	static bool IsKeyFrame(const TArray<uint8>& Compressed);
+
+	int32 GetWidth() const { return Width; }
+	int32 GetHeight() const { return Height; }
+
+private:
+	enum
+	{
+		HeaderSize = 4,
+		KeyFrameFlag = 0x01,
+		// zlib couldn't make it any smaller, the planes are there as they are
+		StoredFlag = 0x02,
+	};
+
+	int32 Width;
+	int32 Height;
+	int32 NumPixels;
+	/** Last frame coded, B, G, R then A */
+	TArray<uint8> Planes;
+	TArray<uint8> Delta;
+	TArray<uint8> Packed;
+};
+
+/**
+ * Compresses frames on their way into the ring, so the same memory holds several times the seconds.
+ *
+ * The game thread pushes readbacks as they come in and the ingest thread codes their pixels into Frame->Compressed,
+ * every KeyInterval-th frame a key frame. Frames come back in order through DequeueCompressed for the ring to take the
+ * compressed copy, and the readback goes back to the render thread with its pixel buffer. When the thread falls
+ * behind the readbacks run out and capture misses samples, same as it would with the GPU behind. Nothing waits for it,
+ * a save takes the frames compressed by the time it starts and the ones still going miss that save.
+ */
+class FSelfieRingCompressor : public FRunnable
+{
+public:
+	FSelfieRingCompressor();
+	virtual ~FSelfieRingCompressor();
+
+	/** Game thread. Starts the ingest thread, the first frame pushed is a key frame */
+	void Init(int32 InWidth, int32 InHeight, int32 InKeyInterval);
+	void Release();
+
+	bool IsActive() const { return Thread != nullptr; }
+
+	/** Game thread. Frame comes back through DequeueCompressed with Compressed filled in */
+	void Push(FSelfieReadbackFrame* Frame);
+	FSelfieReadbackFrame* DequeueCompressed();
+
+	/** Game thread. The next frame pushed is a key frame, for when the ring has been emptied */
+	void ForceKeyFrame() { ForceKeyFrameCounter.Set(1); }
+
+	void LogStats(FOutputDevice& Ar) const;
+
+	/** FRunnable */
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	FSelfieFrameCodec* Codec;
+	int32 KeyInterval;
+	int32 FramesSinceKey;
+	FThreadSafeCounter ForceKeyFrameCounter;
+
+	FRunnableThread* Thread;
+	FThreadSafeCounter StopTaskCounter;
+	FEvent* WorkEvent;
+
+	TQueue<FSelfieReadbackFrame*, EQueueMode::Spsc> PendingFrames;
+	TQueue<FSelfieReadbackFrame*, EQueueMode::Spsc> CompressedFrames;
+	FThreadSafeCounter PendingCount;
+
+	// Only the ingest thread writes these, LogStats reads them as they are
+	int32 FramesCompressed;
+	int32 KeyFramesCompressed;
+	int64 RawBytes;
+	int64 CompressedBytes;
+	double CompressSeconds;
+};
+
+/**
+ * Gets frames out of a compressed ring for a save, any of the save's threads at once.
+ *
+ * Decoding carries on from the last frame decoded when it can, otherwise starts again at the key frame before the one
+ * asked for, so in order reads cost one decode each. Decoded frames are kept in a small cache that hands out the oldest
+ * entry again. Readers that jump about get a decoder of their own, otherwise every jump sends the in order reader
+ * back to a key frame.
+ *
+ * The cache is never handed out. Every thread that asks gets two frame buffers of its own and the frame is copied into
+ * the one it didn't get last time, so a frame stays valid until the same thread has asked for two more, however many
+ * other threads are decoding. That covers the encoder's previous and current frame and a convert worker's one.
+ */
+class FSelfieRingDecoder
+{
+public:
+	/** InNumCached is clamped to NumCachedFrames, less for a reader that copies each frame out straight away */
+	FSelfieRingDecoder(int32 InWidth, int32 InHeight, const FSelfieGetCompressedFrame& InGetCompressed, int32 InNumCached = NumCachedFrames);
+
+	enum { NumCachedFrames = 12 };
+
+	/** Valid until the calling thread has called this twice more */
+	const FColor* GetFrame(int32 FrameIndex);
+
+	int32 GetFramesDecoded() const { return FramesDecoded; }
+	double GetDecodeSeconds() const { return DecodeSeconds; }
+
+private:
+	struct FCachedFrame
+	{
+		int32 FrameIndex;
+		uint64 LastUsed;
+		TArray<FColor> Pixels;
+	};
+
+	/** Frames handed to one thread, alternately */
+	struct FThreadFrames
+	{
+		uint32 ThreadId;
+		int32 NextBuffer;
+		TArray<FColor> Buffers[2];
+	};
+
+	/** Under Lock. Decodes it if it isn't cached, the entry is only good until the next call */
+	FCachedFrame* GetCachedFrame(int32 FrameIndex);
+	FCachedFrame* FindCached(int32 FrameIndex);
+	/** Least recently used entry, handed over to FrameIndex */
+	FCachedFrame* AllocateCached(int32 FrameIndex);
+
+	FCriticalSection Lock;
+	FSelfieFrameCodec Codec;
+	FSelfieGetCompressedFrame GetCompressed;
+	/** Frame the codec last decoded, INDEX_NONE for none */
+	int32 DecodedFrame;
+	FCachedFrame Cache[NumCachedFrames];
+	/** Entries actually handed out, the rest never get pixels */
+	int32 NumCached;
+	TArray<FThreadFrames> ThreadFrames;
+	uint64 UseCounter;
+
+	int32 FramesDecoded;
+	double DecodeSeconds;
+};
@@ -0,0 +1,62 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieRingDump.h"
+
+bool FSelfieRingDump::Write(const FString& Path, int32 Width, int32 Height, int32 FrameRate, int32 NumFrames, const FSelfieGetSourceFrame& GetFrame)
+{
+	FArchive* Writer = IFileManager::Get().CreateFileWriter(*Path);
+	if (Writer == nullptr)
+	{
+		return false;
+	}
+
+	FSelfieRingDumpHeader Header;
+	Header.Magic = FSelfieRingDumpHeader::DumpMagic;
+	Header.Version = FSelfieRingDumpHeader::DumpVersion;
+	Header.Width = Width;
+	Header.Height = Height;
+	Header.FrameRate = FrameRate;
+	Header.NumFrames = NumFrames;
+	Writer->Serialize(&Header, sizeof(Header));
+
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		Writer->Serialize((void*)GetFrame.Execute(FrameIndex), Width * Height * sizeof(FColor));
+	}
+
+	const bool bSuccess = !Writer->IsError();
+	delete Writer;
+
+	return bSuccess;
+}
+
+bool FSelfieRingDump::Read(const FString& Path, FSelfieRingDumpHeader& OutHeader, TArray< TArray<FColor> >& OutFrames)
+{
+	FArchive* Reader = IFileManager::Get().CreateFileReader(*Path);
+	if (Reader == nullptr)
+	{
+		return false;
+	}
+
+	Reader->Serialize(&OutHeader, sizeof(OutHeader));
+	if (Reader->IsError() || OutHeader.Magic != FSelfieRingDumpHeader::DumpMagic || OutHeader.Version != FSelfieRingDumpHeader::DumpVersion
+		|| OutHeader.Width <= 0 || OutHeader.Height <= 0 || OutHeader.NumFrames < 0)
+	{
+		delete Reader;
+		return false;
+	}
+
+	OutFrames.Empty(OutHeader.NumFrames);
+	for (int32 FrameIndex = 0; FrameIndex < OutHeader.NumFrames; FrameIndex++)
+	{
+		TArray<FColor>& Frame = OutFrames[OutFrames.AddDefaulted()];
+		Frame.AddUninitialized(OutHeader.Width * OutHeader.Height);
+		Reader->Serialize(Frame.GetData(), Frame.Num() * sizeof(FColor));
+	}
+
+	const bool bSuccess = !Reader->IsError();
+	delete Reader;
+
+	return bSuccess;
+}
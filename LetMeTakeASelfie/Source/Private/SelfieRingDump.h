@@ -0,0 +1,26 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieEncodePipeline.h"
+
+/**
+ * Raw dump of the frame ring, oldest frame first, for offline tools like the encoder settings sweep.
+ * A small header followed by Width * Height BGRA pixels per frame.
+ */
+struct FSelfieRingDumpHeader
+{
+	enum { DumpMagic = 0x52464c53 /* SLFR */, DumpVersion = 1 };
+
+	uint32 Magic;
+	uint32 Version;
+	int32 Width;
+	int32 Height;
+	int32 FrameRate;
+	int32 NumFrames;
+};
+
+struct FSelfieRingDump
+{
+	static bool Write(const FString& Path, int32 Width, int32 Height, int32 FrameRate, int32 NumFrames, const FSelfieGetSourceFrame& GetFrame);
+	static bool Read(const FString& Path, FSelfieRingDumpHeader& OutHeader, TArray< TArray<FColor> >& OutFrames);
+};
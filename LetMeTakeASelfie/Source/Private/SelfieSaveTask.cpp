@@ -0,0 +1,83 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieSaveTask.h"
+
+FSelfieSaveTask::FSelfieSaveTask(const FString& InTrigger)
+	: Trigger(InTrigger)
+	, LastDispatchedFrames(0)
+	, bCompleteDispatched(false)
+{
+	State.Set(ESelfieSaveState::Queued);
+	// Manual reset so every waiter gets through, not just the first
+	DoneEvent = FPlatformProcess::CreateSynchEvent(true);
+}
+
+FSelfieSaveTask::~FSelfieSaveTask()
+{
+	delete DoneEvent;
+}
+
+float FSelfieSaveTask::GetProgress() const
+{
+	if (IsDone())
+	{
+		return 1.0f;
+	}
+	const int32 Total = GetTotalFrames();
+	return Total > 0 ? (float)GetFramesEncoded() / Total : 0.0f;
+}
+
+bool FSelfieSaveTask::Wait(uint32 WaitMs)
+{
+	return IsDone() || DoneEvent->Wait(WaitMs);
+}
+
+void FSelfieSaveTask::Begin(int32 InTotalFrames)
+{
+	TotalFrames.Set(InTotalFrames);
+	FramesEncoded.Reset();
+	State.Set(ESelfieSaveState::Running);
+}
+
+bool FSelfieSaveTask::ReportProgress(int32 InFramesEncoded)
+{
+	FramesEncoded.Set(InFramesEncoded);
+	return !IsCancelRequested();
+}
+
+void FSelfieSaveTask::Finish(ESelfieSaveState::Type FinalState, const FSelfieSaveStats& InStats)
+{
+	// Stats go in before the state flips, the state is what everyone else checks
+	Stats = InStats;
+	State.Set(FinalState);
+	DoneEvent->Trigger();
+}
+
+bool FSelfieSaveTask::DispatchCallbacks()
+{
+	check(IsInGameThread());
+
+	if (bCompleteDispatched)
+	{
+		return true;
+	}
+
+	// Read the state first so a save finishing right now still gets its last progress call before completion
+	const bool bDone = IsDone();
+
+	const int32 Frames = GetFramesEncoded();
+	if (Frames != LastDispatchedFrames)
+	{
+		LastDispatchedFrames = Frames;
+		OnProgress.Broadcast(*this, Frames, GetTotalFrames());
+	}
+
+	if (bDone)
+	{
+		bCompleteDispatched = true;
+		OnComplete.Broadcast(*this);
+	}
+
+	return bCompleteDispatched;
+}
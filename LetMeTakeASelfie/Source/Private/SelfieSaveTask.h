@@ -0,0 +1,134 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieSaveTask.generated.h"
+
+UENUM(BlueprintType)
+namespace ESelfieSaveState
+{
+	enum Type
+	{
+		Queued,
+		Running,
+		Succeeded,
+		Failed,
+		Cancelled,
+	};
+}
+
+/** What a save produced, filled in when it finishes */
+USTRUCT(BlueprintType)
+struct FSelfieSaveStats
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** The clip, or where it was streamed to for non file outputs */
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	FString Path;
+
+	/** Why it failed, empty otherwise */
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	FString Error;
+
+	/** Catalog number, 0 for ring dumps */
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	int32 ClipIndex;
+
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	int32 NumFrames;
+
+	/** Slowed down copy of the newest burst next to the clip, empty when there wasn't one */
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	FString SlowMotionPath;
+
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	float DurationSeconds;
+
+	/** Blueprints don't do int64, SizeBytes has the exact number */
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	int32 SizeKB;
+
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	float EncodeSeconds;
+
+	UPROPERTY(BlueprintReadOnly, Category = Selfie)
+	float TotalSeconds;
+
+	int64 SizeBytes;
+
+	FSelfieSaveStats()
+		: ClipIndex(0)
+		, NumFrames(0)
+		, DurationSeconds(0)
+		, SizeKB(0)
+		, EncodeSeconds(0)
+		, TotalSeconds(0)
+		, SizeBytes(0)
+	{
+	}
+};
+
+class FSelfieSaveTask;
+typedef TSharedPtr<FSelfieSaveTask, ESPMode::ThreadSafe> FSelfieSaveHandle;
+
+/** Game thread, progress is coalesced to at most one call per tick */
+DECLARE_MULTICAST_DELEGATE_ThreeParams(FOnSelfieSaveProgress, FSelfieSaveTask& /*Task*/, int32 /*FramesEncoded*/, int32 /*TotalFrames*/);
+/** Game thread, GetState and GetStats have the outcome */
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnSelfieSaveComplete, FSelfieSaveTask& /*Task*/);
+
+/**
+ * One save request, shared between whoever asked for it and the worker doing it.
+ *
+ * Works as a future: IsDone and Wait from any thread, GetStats once it's done. Progress and completion are also pushed
+ * through the delegates, which the selfie tick fires on the game thread so UI can bind to them directly.
+ * Cancel is cooperative, the encoder checks it after every frame.
+ */
+class FSelfieSaveTask : public TSharedFromThis<FSelfieSaveTask, ESPMode::ThreadSafe>
+{
+public:
+	FSelfieSaveTask(const FString& InTrigger);
+	~FSelfieSaveTask();
+
+	ESelfieSaveState::Type GetState() const { return (ESelfieSaveState::Type)State.GetValue(); }
+	bool IsDone() const { return GetState() >= ESelfieSaveState::Succeeded; }
+	int32 GetFramesEncoded() const { return FramesEncoded.GetValue(); }
+	int32 GetTotalFrames() const { return TotalFrames.GetValue(); }
+	/** 0 to 1 */
+	float GetProgress() const;
+	const FString& GetTrigger() const { return Trigger; }
+
+	/** Only valid once IsDone */
+	const FSelfieSaveStats& GetStats() const { return Stats; }
+
+	/** Asks the worker to stop, the task ends up Cancelled unless it finished first */
+	void Cancel() { bCancelRequested.Set(1); }
+	bool IsCancelRequested() const { return bCancelRequested.GetValue() != 0; }
+
+	/** Blocks until done or WaitMs runs out, true if done */
+	bool Wait(uint32 WaitMs = MAX_uint32);
+
+	FOnSelfieSaveProgress OnProgress;
+	FOnSelfieSaveComplete OnComplete;
+
+	/** Worker side */
+	void Begin(int32 InTotalFrames);
+	/** False once cancelled, binds straight to FSelfieEncodeProgress */
+	bool ReportProgress(int32 InFramesEncoded);
+	void Finish(ESelfieSaveState::Type FinalState, const FSelfieSaveStats& InStats);
+
+	/** Game thread. Fires whatever delegates are due, true once completion has gone out */
+	bool DispatchCallbacks();
+
+private:
+	FString Trigger;
+	FThreadSafeCounter State;
+	FThreadSafeCounter TotalFrames;
+	FThreadSafeCounter FramesEncoded;
+	FThreadSafeCounter bCancelRequested;
+	FEvent* DoneEvent;
+	FSelfieSaveStats Stats;
+
+	// Game thread only
+	int32 LastDispatchedFrames;
+	bool bCompleteDispatched;
+};
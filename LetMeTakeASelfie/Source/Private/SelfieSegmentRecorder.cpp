@@ -0,0 +1,354 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieSegmentRecorder.h"
+#include "SelfieEncodePipeline.h"
+#include "SelfieOutputSink.h"
+#include "SelfieWebMMuxer.h"
+
+#include "SelfieYUV.h"
+
+#include "vpx/vp8cx.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieRecord, Log, All);
+
+FSelfieSegmentRecorder::FSelfieSegmentRecorder()
+	: FramePoolSize(8)
+	, Width(0)
+	, Height(0)
+	, FrameRate(30)
+	, FramesPerSegment(0)
+	, Thread(nullptr)
+	, FrameEvent(nullptr)
+	, NextPts(0)
+	, StartCaptureTime(-1.0)
+	, SegmentSink(nullptr)
+	, SegmentMuxer(nullptr)
+	, bSegmentOpen(false)
+	, bSegmentFailed(false)
+{
+}
+
+FSelfieSegmentRecorder::~FSelfieSegmentRecorder()
+{
+	Stop();
+}
+
+bool FSelfieSegmentRecorder::Start(const FString& InOutputDir, int32 InWidth, int32 InHeight, int32 InFrameRate, float InSegmentSeconds)
+{
+	check(IsInGameThread());
+
+	if (IsRecording())
+	{
+		return false;
+	}
+
+	OutputDir = InOutputDir;
+	Width = InWidth;
+	Height = InHeight;
+	FrameRate = InFrameRate;
+	FramesPerSegment = FMath::Max(1, FMath::RoundToInt(InSegmentSeconds * FrameRate));
+
+	if (!IFileManager::Get().MakeDirectory(*OutputDir, true))
+	{
+		UE_LOG(LogUTSelfieRecord, Warning, TEXT("Couldn't create %s"), *OutputDir);
+		return false;
+	}
+
+	if (!FSelfieEncodePipeline::InitConfig(Cfg, Width, Height, FrameRate))
+	{
+		return false;
+	}
+	// Real time, nothing held back in the encoder so a forced keyframe lands exactly on the segment boundary
+	Cfg.g_lag_in_frames = 0;
+	Cfg.g_threads = 2;
+	Cfg.rc_end_usage = VPX_CBR;
+	Cfg.kf_max_dist = FramesPerSegment;
+
+	if (vpx_codec_enc_init(&Codec, vpx_codec_vp8_cx(), &Cfg, 0))
+	{
+		return false;
+	}
+	// Keep up with the game at the cost of some quality
+	vpx_codec_control(&Codec, VP8E_SET_CPUUSED, 8);
+
+	if (!vpx_img_alloc(&Image, VPX_IMG_FMT_I420, Width, Height, 1))
+	{
+		vpx_codec_destroy(&Codec);
+		return false;
+	}
+
+	for (int32 i = 0; i < FramePoolSize; i++)
+	{
+		FRecordedFrame* Frame = new FRecordedFrame();
+		Frame->Pixels.Empty(Width * Height);
+		Frame->Pixels.AddUninitialized(Width * Height);
+		FreeFrames.Enqueue(Frame);
+	}
+
+	NextPts = 0;
+	StartCaptureTime = -1.0;
+	Segments.Empty();
+	FramesPushed.Reset();
+	FramesDropped.Reset();
+	FramesEncoded.Reset();
+	SegmentsClosed.Reset();
+	SegmentsFailed.Reset();
+	bSegmentOpen = false;
+	bSegmentFailed = false;
+	bStopRequested.Reset();
+
+	FrameEvent = FPlatformProcess::CreateSynchEvent();
+	Thread = FRunnableThread::Create(this, TEXT("FSelfieSegmentRecorder"), 0, TPri_BelowNormal);
+
+	UE_LOG(LogUTSelfieRecord, Display, TEXT("Recording %dx%d in %d frame segments to %s"), Width, Height, FramesPerSegment, *OutputDir);
+
+	return true;
+}
+
+void FSelfieSegmentRecorder::Stop()
+{
+	if (!IsRecording())
+	{
+		return;
+	}
+
+	bStopRequested.Set(1);
+	FrameEvent->Trigger();
+	Thread->WaitForCompletion();
+	delete Thread;
+	Thread = nullptr;
+
+	delete FrameEvent;
+	FrameEvent = nullptr;
+
+	FRecordedFrame* Frame = nullptr;
+	while (PendingFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+	while (FreeFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+
+	vpx_img_free(&Image);
+	vpx_codec_destroy(&Codec);
+
+	UE_LOG(LogUTSelfieRecord, Display, TEXT("Recording stopped, %d segments (%d failed), %d frames encoded, %d dropped"), Segments.Num(), SegmentsFailed.GetValue(),
+		FramesEncoded.GetValue(), FramesDropped.GetValue());
+}
+
+bool FSelfieSegmentRecorder::PushFrame(const TArray<FColor>& Pixels, double CaptureTime)
+{
+	FRecordedFrame* Frame = nullptr;
+	if (!IsRecording() || Pixels.Num() != Width * Height || !FreeFrames.Dequeue(Frame))
+	{
+		FramesDropped.Increment();
+		return false;
+	}
+
+	FMemory::Memcpy(Frame->Pixels.GetData(), Pixels.GetData(), Pixels.Num() * Pixels.GetTypeSize());
+	Frame->CaptureTime = CaptureTime;
+	PendingFrames.Enqueue(Frame);
+	FramesPushed.Increment();
+	FrameEvent->Trigger();
+
+	return true;
+}
+
+uint32 FSelfieSegmentRecorder::Run()
+{
+	// Always BT.601 video range, it's going straight into VP8
+	const FSelfieYUVKernel ConvertKernel = FSelfieYUV::GetKernel(FSelfieYUVFormat());
+	const FSelfieYUVPlanes Planes = { Image.planes[VPX_PLANE_Y], Image.stride[VPX_PLANE_Y], Image.planes[VPX_PLANE_U], Image.stride[VPX_PLANE_U],
+		Image.planes[VPX_PLANE_V], Image.stride[VPX_PLANE_V] };
+
+	for (;;)
+	{
+		FRecordedFrame* Frame = nullptr;
+		if (!PendingFrames.Dequeue(Frame))
+		{
+			// Stop only once the queue is drained, frames pushed before Stop still make it into the last segment
+			if (bStopRequested.GetValue() && PendingFrames.IsEmpty())
+			{
+				break;
+			}
+			FrameEvent->Wait(5);
+			continue;
+		}
+
+		// Real time from the first frame, a frame that was never captured (or dropped here) leaves a gap the one before covers
+		if (StartCaptureTime < 0)
+		{
+			StartCaptureTime = Frame->CaptureTime;
+		}
+		const int64 Pts = FMath::Max(NextPts, (int64)FMath::RoundToDouble((Frame->CaptureTime - StartCaptureTime) * FrameRate));
+
+		// Roll over on the frame boundary, the next segment starts on a keyframe so it plays on its own
+		vpx_enc_frame_flags_t Flags = 0;
+		if (!bSegmentOpen || Pts - CurrentSegment.FirstFrame >= FramesPerSegment)
+		{
+			CloseSegment();
+			OpenSegment(Pts);
+			Flags |= VPX_EFLAG_FORCE_KF;
+		}
+		NextPts = Pts + 1;
+		CurrentSegment.EndFrame = NextPts;
+
+		// Nowhere to put it until the next segment
+		if (bSegmentFailed)
+		{
+			FreeFrames.Enqueue(Frame);
+			FramesDropped.Increment();
+			continue;
+		}
+
+		ConvertKernel(Frame->Pixels.GetData(), Width, Width, Height, Planes);
+
+		// Pixels are in the I420 image now, the game can have the buffer back before the encode
+		FreeFrames.Enqueue(Frame);
+
+		if (EncodeFrame(&Image, Pts, Flags))
+		{
+			CurrentSegment.NumFrames++;
+			FramesEncoded.Increment();
+		}
+		else
+		{
+			FramesDropped.Increment();
+		}
+	}
+
+	// Drain whatever the encoder still holds into the last segment
+	if (bSegmentOpen && !bSegmentFailed)
+	{
+		EncodeFrame(nullptr, NextPts, 0);
+	}
+	CloseSegment();
+
+	return 0;
+}
+
+bool FSelfieSegmentRecorder::EncodeFrame(const vpx_image_t* InImage, int64 Pts, vpx_enc_frame_flags_t Flags)
+{
+	if (vpx_codec_encode(&Codec, InImage, Pts, 1, Flags, VPX_DL_REALTIME))
+	{
+		return false;
+	}
+
+	vpx_codec_iter_t Iter = nullptr;
+	const vpx_codec_cx_pkt_t* Pkt = nullptr;
+	while ((Pkt = vpx_codec_get_cx_data(&Codec, &Iter)) != nullptr)
+	{
+		if (Pkt->kind == VPX_CODEC_CX_FRAME_PKT && SegmentMuxer)
+		{
+			// Each segment's timeline starts at zero
+			vpx_codec_cx_pkt_t SegmentPkt = *Pkt;
+			SegmentPkt.data.frame.pts -= CurrentSegment.FirstFrame;
+			if (!SegmentMuxer->WriteBlock(&SegmentPkt))
+			{
+				UE_LOG(LogUTSelfieRecord, Warning, TEXT("Couldn't write to %s, abandoning the segment"), *SegmentSink->Describe());
+				bSegmentFailed = true;
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool FSelfieSegmentRecorder::OpenSegment(int64 FirstPts)
+{
+	CurrentSegment.FileName = FString::Printf(TEXT("Segment%05i.webm"), Segments.Num());
+	CurrentSegment.FirstFrame = FirstPts;
+	CurrentSegment.EndFrame = FirstPts;
+	CurrentSegment.NumFrames = 0;
+	CurrentSegment.Bytes = 0;
+	bSegmentOpen = true;
+	bSegmentFailed = false;
+
+	SegmentSink = new FSelfieFileSink(OutputDir / CurrentSegment.FileName);
+	if (!SegmentSink->IsOpen())
+	{
+		UE_LOG(LogUTSelfieRecord, Warning, TEXT("Couldn't open %s"), *SegmentSink->Describe());
+		delete SegmentSink;
+		SegmentSink = nullptr;
+		bSegmentFailed = true;
+		return false;
+	}
+
+	SegmentMuxer = new FSelfieWebMMuxer(SegmentSink);
+	if (!SegmentMuxer->Begin(Cfg))
+	{
+		UE_LOG(LogUTSelfieRecord, Warning, TEXT("Couldn't write the WebM header to %s"), *SegmentSink->Describe());
+		bSegmentFailed = true;
+		return false;
+	}
+
+	return true;
+}
+
+void FSelfieSegmentRecorder::CloseSegment()
+{
+	if (!bSegmentOpen)
+	{
+		return;
+	}
+	bSegmentOpen = false;
+
+	if (SegmentMuxer)
+	{
+		if (!bSegmentFailed && !SegmentMuxer->Finish())
+		{
+			UE_LOG(LogUTSelfieRecord, Warning, TEXT("Couldn't finish %s, abandoning the segment"), *SegmentSink->Describe());
+			bSegmentFailed = true;
+		}
+		CurrentSegment.Bytes = SegmentMuxer->GetBytesWritten();
+		delete SegmentMuxer;
+		SegmentMuxer = nullptr;
+	}
+	if (SegmentSink)
+	{
+		SegmentSink->Close();
+		delete SegmentSink;
+		SegmentSink = nullptr;
+	}
+
+	if (bSegmentFailed)
+	{
+		// Whatever got written is no use to anyone, and its frames never made it after all
+		IFileManager::Get().Delete(*(OutputDir / CurrentSegment.FileName));
+		FramesEncoded.Subtract(CurrentSegment.NumFrames);
+		FramesDropped.Add(CurrentSegment.NumFrames);
+		SegmentsFailed.Increment();
+		bSegmentFailed = false;
+		return;
+	}
+
+	Segments.Add(CurrentSegment);
+	SegmentsClosed.Increment();
+	WriteManifest();
+}
+
+void FSelfieSegmentRecorder::WriteManifest()
+{
+	// Small enough to rewrite whole, it's always complete on disk even if the game goes down mid segment
+	FString Manifest = FString::Printf(TEXT("{\n\t\"width\": %d,\n\t\"height\": %d,\n\t\"framerate\": %d,\n\t\"segments\": [\n"), Width, Height, FrameRate);
+	for (int32 i = 0; i < Segments.Num(); i++)
+	{
+		const FSegmentInfo& Segment = Segments[i];
+		Manifest += FString::Printf(TEXT("\t\t{ \"file\": \"%s\", \"start\": %.3f, \"duration\": %.3f, \"frames\": %d, \"bytes\": %lld }%s\n"),
+			*Segment.FileName, (double)Segment.FirstFrame / FrameRate, (double)(Segment.EndFrame - Segment.FirstFrame) / FrameRate, Segment.NumFrames, Segment.Bytes,
+			i + 1 < Segments.Num() ? TEXT(",") : TEXT(""));
+	}
+	Manifest += TEXT("\t]\n}\n");
+
+	FFileHelper::SaveStringToFile(Manifest, *(OutputDir / TEXT("manifest.json")));
+}
+
+void FSelfieSegmentRecorder::LogStats(FOutputDevice& Ar) const
+{
+	Ar.Logf(TEXT("Selfie recording %s: %d pushed, %d encoded, %d dropped, %d segments closed, %d failed"), IsRecording() ? *OutputDir : TEXT("stopped"),
+		FramesPushed.GetValue(), FramesEncoded.GetValue(), FramesDropped.GetValue(), SegmentsClosed.GetValue(), SegmentsFailed.GetValue());
+}
@@ -0,0 +1,107 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "vpx/vpx_encoder.h"
+
+class FSelfieWebMMuxer;
+class FSelfieFileSink;
+
+/**
+ * Continuous recording for whole matches.
+ *
+ * Frames are copied into a fixed pool and encoded in real time on a background thread, so memory stays the same no
+ * matter how long the session runs. Output is fixed length WebM segments that each start on a forced keyframe,
+ * plus a manifest.json listing them that gets rewritten every time a segment closes. A segment the disk won't take
+ * (full, gone) is abandoned: the rest of its frames are dropped, the file deleted and the manifest never lists it.
+ * The next segment tries again.
+ */
+class FSelfieSegmentRecorder : public FRunnable
+{
+public:
+	FSelfieSegmentRecorder();
+	virtual ~FSelfieSegmentRecorder();
+
+	/** Game thread. Segments go into OutputDir as Segment00000.webm and so on */
+	bool Start(const FString& InOutputDir, int32 InWidth, int32 InHeight, int32 InFrameRate, float InSegmentSeconds);
+
+	/** Game thread. Encodes whatever is queued, closes the last segment and writes the manifest. Blocks until done */
+	void Stop();
+
+	bool IsRecording() const { return Thread != nullptr; }
+
+	/**
+	 * Game thread. Copies the frame into the pool, false if the encoder has fallen too far behind and the frame was dropped.
+	 * CaptureTime places it on the recording's timeline, so missed samples leave the last frame up rather than pulling the rest early
+	 */
+	bool PushFrame(const TArray<FColor>& Pixels, double CaptureTime);
+
+	void LogStats(FOutputDevice& Ar) const;
+
+	/** Frames of slack between the game and the encoder, this is the only memory that scales with resolution */
+	int32 FramePoolSize;
+
+	/** FRunnable */
+	virtual uint32 Run() override;
+
+private:
+	struct FSegmentInfo
+	{
+		FString FileName;
+		/** Frame ticks from the start of the recording, EndFrame is one past the last frame's */
+		int64 FirstFrame;
+		int64 EndFrame;
+		int32 NumFrames;
+		int64 Bytes;
+	};
+
+	struct FRecordedFrame
+	{
+		TArray<FColor> Pixels;
+		double CaptureTime;
+	};
+
+	/** FirstPts is the segment's first frame, its timeline starts there. The segment's failed if this returns false */
+	bool OpenSegment(int64 FirstPts);
+	/** Abandoned segments are deleted, their frames counted as dropped */
+	void CloseSegment();
+	void WriteManifest();
+	bool EncodeFrame(const vpx_image_t* Image, int64 Pts, vpx_enc_frame_flags_t Flags);
+
+	FString OutputDir;
+	int32 Width;
+	int32 Height;
+	int32 FrameRate;
+	int32 FramesPerSegment;
+
+	FRunnableThread* Thread;
+	FEvent* FrameEvent;
+	FThreadSafeCounter bStopRequested;
+
+	// Game thread -> encoder, and the emptied buffers back
+	TQueue<FRecordedFrame*, EQueueMode::Spsc> PendingFrames;
+	TQueue<FRecordedFrame*, EQueueMode::Spsc> FreeFrames;
+
+	FThreadSafeCounter FramesPushed;
+	FThreadSafeCounter FramesDropped;
+	FThreadSafeCounter FramesEncoded;
+	FThreadSafeCounter SegmentsClosed;
+	FThreadSafeCounter SegmentsFailed;
+
+	// Encoder thread only from here on
+	vpx_codec_ctx_t Codec;
+	vpx_codec_enc_cfg_t Cfg;
+	vpx_image_t Image;
+	/** Lowest pts the next frame can have */
+	int64 NextPts;
+	/** CaptureTime of the recording's first frame, pts 0 */
+	double StartCaptureTime;
+
+	FSelfieFileSink* SegmentSink;
+	FSelfieWebMMuxer* SegmentMuxer;
+	/** CurrentSegment has frames going to it, or would have if it hadn't failed */
+	bool bSegmentOpen;
+	/** Output failed, frames are dropped until the next segment */
+	bool bSegmentFailed;
+	FSegmentInfo CurrentSegment;
+	TArray<FSegmentInfo> Segments;
+};
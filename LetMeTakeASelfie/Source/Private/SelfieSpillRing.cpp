@@ -0,0 +1,264 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieSpillRing.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieSpill, Log, All);
+
+FSelfieSpillRing::FSelfieSpillRing()
+	: Width(0)
+	, Height(0)
+	, Capacity(0)
+	, FrameBytes(0)
+	, FileHandle(INVALID_HANDLE_VALUE)
+	, MappingHandle(nullptr)
+	, MappedFrames(nullptr)
+	, Thread(nullptr)
+	, WorkEvent(nullptr)
+	, bReading(false)
+	, PeakPending(0)
+	, FramesDropped(0)
+	, WriteSeconds(0)
+{
+}
+
+FSelfieSpillRing::~FSelfieSpillRing()
+{
+	Release();
+}
+
+bool FSelfieSpillRing::Init(const FString& InPath, int32 InWidth, int32 InHeight, int32 InCapacity)
+{
+	Release();
+
+	if (InCapacity <= 0)
+	{
+		return false;
+	}
+
+	Path = InPath;
+	Width = InWidth;
+	Height = InHeight;
+	Capacity = InCapacity;
+	FrameBytes = (int64)Width * Height * sizeof(FColor);
+	const int64 TotalBytes = FrameBytes * Capacity;
+
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+
+	// Not temporary, that asks the cache manager to keep it in memory and the whole point is for it not to be.
+	// Delete on close cleans up after a crash too
+	FileHandle = CreateFileW(*Path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (FileHandle == INVALID_HANDLE_VALUE)
+	{
+		UE_LOG(LogUTSelfieSpill, Warning, TEXT("Couldn't create spill file %s"), *Path);
+		Release();
+		return false;
+	}
+
+	MappingHandle = CreateFileMappingW(FileHandle, nullptr, PAGE_READWRITE, (DWORD)(TotalBytes >> 32), (DWORD)(TotalBytes & 0xffffffff), nullptr);
+	if (MappingHandle != nullptr)
+	{
+		MappedFrames = (uint8*)MapViewOfFile(MappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)TotalBytes);
+	}
+	if (MappedFrames == nullptr)
+	{
+		UE_LOG(LogUTSelfieSpill, Warning, TEXT("Couldn't map %lld MB spill file %s, error %u"), TotalBytes >> 20, *Path, GetLastError());
+		Release();
+		return false;
+	}
+
+	FrameTimes.Init(0, Capacity);
+	FramesWritten.Reset();
+	bReading = false;
+	PeakPending = 0;
+	FramesDropped = 0;
+	WriteSeconds = 0;
+	StopTaskCounter.Reset();
+	WorkEvent = FPlatformProcess::CreateSynchEvent();
+	Thread = FRunnableThread::Create(this, TEXT("FSelfieSpillRing"), 0, TPri_BelowNormal);
+
+	UE_LOG(LogUTSelfieSpill, Display, TEXT("Spilling up to %d frames (%lld MB) to %s"), Capacity, TotalBytes >> 20, *Path);
+
+	return true;
+}
+
+void FSelfieSpillRing::Release()
+{
+	if (Thread)
+	{
+		// Anything not written yet is dropped, no waiting on the disk
+		Stop();
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	if (WorkEvent)
+	{
+		delete WorkEvent;
+		WorkEvent = nullptr;
+	}
+
+	// Pending or written but never collected, nobody's going to now so they're freed here. The handoff makes new ones as it needs them
+	FSelfieReadbackFrame* Frame = nullptr;
+	while (PendingFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+	while (WrittenFrames.Dequeue(Frame))
+	{
+		delete Frame;
+	}
+	PendingCount.Reset();
+
+	if (MappedFrames)
+	{
+		UnmapViewOfFile(MappedFrames);
+		MappedFrames = nullptr;
+	}
+	if (MappingHandle)
+	{
+		CloseHandle(MappingHandle);
+		MappingHandle = nullptr;
+	}
+	if (FileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(FileHandle);
+		FileHandle = INVALID_HANDLE_VALUE;
+	}
+
+	Capacity = 0;
+	FramesWritten.Reset();
+	FrameTimes.Empty();
+}
+
+bool FSelfieSpillRing::Push(FSelfieReadbackFrame* Frame)
+{
+	check(IsActive());
+
+	// Disk can't keep up, losing a frame of pre-roll beats the handoff allocating new ones without end
+	if (PendingCount.GetValue() >= MaxPendingFrames)
+	{
+		FramesDropped++;
+		return false;
+	}
+
+	PendingFrames.Enqueue(Frame);
+	const int32 Pending = PendingCount.Increment();
+	PeakPending = FMath::Max(PeakPending, Pending);
+	WorkEvent->Trigger();
+	return true;
+}
+
+FSelfieReadbackFrame* FSelfieSpillRing::DequeueWritten()
+{
+	FSelfieReadbackFrame* Frame = nullptr;
+	WrittenFrames.Dequeue(Frame);
+	return Frame;
+}
+
+void FSelfieSpillRing::BeginRead()
+{
+	// Waits out the frame being written at most, the ones still pending are left for after the save
+	FScopeLock Lock(&WriteLock);
+	bReading = true;
+}
+
+void FSelfieSpillRing::EndRead()
+{
+	{
+		FScopeLock Lock(&WriteLock);
+		bReading = false;
+	}
+	if (WorkEvent)
+	{
+		WorkEvent->Trigger();
+	}
+}
+
+const FColor* FSelfieSpillRing::GetFrame(int32 FrameIndex) const
+{
+	const int32 Slot = (FramesWritten.GetValue() - GetNumFrames() + FrameIndex) % Capacity;
+	return (const FColor*)(MappedFrames + Slot * FrameBytes);
+}
+
+double FSelfieSpillRing::GetFrameTime(int32 FrameIndex) const
+{
+	return FrameTimes[(FramesWritten.GetValue() - GetNumFrames() + FrameIndex) % Capacity];
+}
+
+void FSelfieSpillRing::Reset()
+{
+	// The spill thread can't be taking pending frames while this holds the lock, so they're ours to hand straight back
+	FScopeLock Lock(&WriteLock);
+	FSelfieReadbackFrame* Frame = nullptr;
+	while (PendingFrames.Dequeue(Frame))
+	{
+		WrittenFrames.Enqueue(Frame);
+		PendingCount.Decrement();
+	}
+	FramesWritten.Reset();
+}
+
+void FSelfieSpillRing::LogStats(FOutputDevice& Ar) const
+{
+	if (!IsActive())
+	{
+		Ar.Logf(TEXT("Spill ring off"));
+		return;
+	}
+	Ar.Logf(TEXT("Spill ring %d/%d frames, %d pending, peak %d pending, %d dropped with the disk behind, %.2fms average write"), GetNumFrames(), Capacity,
+		PendingCount.GetValue(), PeakPending, FramesDropped, FramesWritten.GetValue() > 0 ? WriteSeconds * 1000.0 / FramesWritten.GetValue() : 0.0);
+}
+
+uint32 FSelfieSpillRing::Run()
+{
+	while (StopTaskCounter.GetValue() == 0)
+	{
+		FSelfieReadbackFrame* Frame = nullptr;
+		{
+			FScopeLock Lock(&WriteLock);
+			if (!bReading && PendingFrames.Dequeue(Frame))
+			{
+				WriteFrame(Frame);
+			}
+		}
+
+		if (Frame == nullptr)
+		{
+			WorkEvent->Wait(100);
+		}
+	}
+
+	return 0;
+}
+
+void FSelfieSpillRing::WriteFrame(FSelfieReadbackFrame* Frame)
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	const int32 Slot = FramesWritten.GetValue() % Capacity;
+	FrameTimes[Slot] = Frame->CaptureTime;
+	uint8* Dest = MappedFrames + Slot * FrameBytes;
+	FMemory::Memcpy(Dest, Frame->Pixels.GetData(), FrameBytes);
+
+	// Start the write now rather than when the cache manager gets round to it, then drop the pages from our
+	// working set. VirtualUnlock on pages that were never locked does exactly that, and reports an error doing it
+	FlushViewOfFile(Dest, (SIZE_T)FrameBytes);
+	VirtualUnlock(Dest, (SIZE_T)FrameBytes);
+
+	WriteSeconds += FPlatformTime::Seconds() - StartTime;
+	FramesWritten.Increment();
+
+	WrittenFrames.Enqueue(Frame);
+	PendingCount.Decrement();
+}
+
+void FSelfieSpillRing::Stop()
+{
+	StopTaskCounter.Increment();
+	if (WorkEvent)
+	{
+		WorkEvent->Trigger();
+	}
+}
@@ -0,0 +1,96 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieFrameHandoff.h"
+
+/**
+ * Second, disk backed tier behind the in-RAM frame ring so pre-roll can be far longer than memory allows.
+ *
+ * Frames that age out of the hot ring are handed over with Push and copied into a memory-mapped temp file by a
+ * background thread, one fixed size slot per frame, wrapping when full. Written pages are flushed and dropped from the
+ * working set straight away so resident memory stays at a frame or two. At save time the frames are read back
+ * through the same mapping, oldest first, which the OS turns into sequential reads.
+ *
+ * The game thread pushes and collects written frames, the spill thread only ever touches the mapping and the queues.
+ * Nothing on the game thread waits for the disk: past MaxPendingFrames a push is refused and that frame is lost, and
+ * a save reads whatever is written when it starts while the thread holds the rest back until it's done.
+ */
+class FSelfieSpillRing : public FRunnable
+{
+public:
+	FSelfieSpillRing();
+	virtual ~FSelfieSpillRing();
+
+	/** Game thread. Maps a temp file big enough for Capacity frames, deleted again on Release */
+	bool Init(const FString& InPath, int32 InWidth, int32 InHeight, int32 InCapacity);
+	void Release();
+
+	bool IsActive() const { return MappedFrames != nullptr; }
+	int32 GetCapacity() const { return Capacity; }
+
+	/** Writes queued at most, about a quarter of a second at 30fps */
+	enum { MaxPendingFrames = 8 };
+
+	/**
+	 * Game thread. Frame holds the oldest hot frame, it comes back through DequeueWritten once it's on disk.
+	 * False if the disk is that far behind, the frame isn't taken and the caller recycles it
+	 */
+	bool Push(FSelfieReadbackFrame* Frame);
+	FSelfieReadbackFrame* DequeueWritten();
+
+	/** Save worker. Holds writes back so the frames on disk stay put while they're read, and forgets them again after */
+	void BeginRead();
+	void EndRead();
+
+	/** Frames held, only stable between BeginRead and EndRead */
+	int32 GetNumFrames() const { return FMath::Min(FramesWritten.GetValue(), Capacity); }
+
+	/** Oldest first, points into the mapping. Between BeginRead and EndRead */
+	const FColor* GetFrame(int32 FrameIndex) const;
+	double GetFrameTime(int32 FrameIndex) const;
+
+	/** Game thread. Forgets the frames, including ones still waiting to be written. The file stays mapped */
+	void Reset();
+
+	void LogStats(FOutputDevice& Ar) const;
+
+	/** FRunnable */
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	/** Spill thread, under WriteLock */
+	void WriteFrame(FSelfieReadbackFrame* Frame);
+
+	FString Path;
+	int32 Width;
+	int32 Height;
+	int32 Capacity;
+	int64 FrameBytes;
+
+	HANDLE FileHandle;
+	HANDLE MappingHandle;
+	uint8* MappedFrames;
+	/** CaptureTime of each slot, kept in memory */
+	TArray<double> FrameTimes;
+
+	FRunnableThread* Thread;
+	FThreadSafeCounter StopTaskCounter;
+	FEvent* WorkEvent;
+
+	TQueue<FSelfieReadbackFrame*, EQueueMode::Spsc> PendingFrames;
+	TQueue<FSelfieReadbackFrame*, EQueueMode::Spsc> WrittenFrames;
+	FThreadSafeCounter PendingCount;
+
+	/** Held by the spill thread for each frame it writes, and by anyone that needs it to stop taking pending frames */
+	FCriticalSection WriteLock;
+	/** Under WriteLock, set while a save reads the mapping */
+	bool bReading;
+
+	FThreadSafeCounter FramesWritten;
+	// Game thread
+	int32 PeakPending;
+	int32 FramesDropped;
+	// Spill thread
+	double WriteSeconds;
+};
@@ -0,0 +1,106 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieStaticRegions.h"
+
+#include <emmintrin.h>
+
+FSelfieStaticRegions::FSelfieStaticRegions(int32 InWidth, int32 InHeight)
+	: BlockSADThreshold(64)
+	, MaxStaticRun(15)
+	, Width(InWidth)
+	, Height(InHeight)
+	, Cols((InWidth + 15) / 16)
+	, Rows((InHeight + 15) / 16)
+	, TotalBlocks(0)
+	, TotalStaticBlocks(0)
+{
+	ActiveBlocks.Init(1, Cols * Rows);
+	StaticRun.Init(0, Cols * Rows);
+
+	ActiveMap.active_map = ActiveBlocks.GetData();
+	ActiveMap.rows = Rows;
+	ActiveMap.cols = Cols;
+}
+
+float FSelfieStaticRegions::GetStaticShare() const
+{
+	return TotalBlocks > 0 ? (float)((double)TotalStaticBlocks / TotalBlocks) : 0.0f;
+}
+
+int32 FSelfieStaticRegions::Analyze(const FColor* Previous, const FColor* Current)
+{
+	int32 NumStatic = 0;
+	for (int32 BlockY = 0; BlockY < Rows; BlockY++)
+	{
+		const int32 PixelY = BlockY * 16;
+		const int32 BlockHeight = FMath::Min(16, Height - PixelY);
+		for (int32 BlockX = 0; BlockX < Cols; BlockX++)
+		{
+			const int32 BlockIndex = BlockY * Cols + BlockX;
+			const int32 PixelX = BlockX * 16;
+			const int32 BlockWidth = FMath::Min(16, Width - PixelX);
+
+			bool bStatic = false;
+			if (Previous && StaticRun[BlockIndex] < MaxStaticRun)
+			{
+				const int32 Offset = PixelY * Width + PixelX;
+				bStatic = BlockSAD(Previous + Offset, Current + Offset, Width, BlockWidth, BlockHeight, BlockSADThreshold) <= BlockSADThreshold;
+			}
+
+			ActiveBlocks[BlockIndex] = bStatic ? 0 : 1;
+			StaticRun[BlockIndex] = bStatic ? StaticRun[BlockIndex] + 1 : 0;
+			NumStatic += bStatic ? 1 : 0;
+		}
+	}
+
+	TotalBlocks += Cols * Rows;
+	TotalStaticBlocks += NumStatic;
+
+	return NumStatic;
+}
+
+uint32 FSelfieStaticRegions::BlockSADScalar(const FColor* A, const FColor* B, int32 Stride, int32 BlockWidth, int32 BlockHeight, uint32 Limit)
+{
+	uint32 Total = 0;
+	for (int32 y = 0; y < BlockHeight && Total <= Limit; y++)
+	{
+		const uint8* RowA = (const uint8*)(A + y * Stride);
+		const uint8* RowB = (const uint8*)(B + y * Stride);
+		for (int32 x = 0; x < BlockWidth * 4; x++)
+		{
+			Total += FMath::Abs((int32)RowA[x] - (int32)RowB[x]);
+		}
+	}
+	return Total;
+}
+
+uint32 FSelfieStaticRegions::BlockSAD(const FColor* A, const FColor* B, int32 Stride, int32 BlockWidth, int32 BlockHeight, uint32 Limit)
+{
+	// Only whole blocks are worth vectorising, the right and bottom edges can be any size
+	if (BlockWidth != 16)
+	{
+		return BlockSADScalar(A, B, Stride, BlockWidth, BlockHeight, Limit);
+	}
+
+	uint32 Total = 0;
+	for (int32 y = 0; y < BlockHeight; y++)
+	{
+		// A 16 pixel row is 64 bytes, psadbw sums each 8 byte half into a 64 bit lane
+		const __m128i* RowA = (const __m128i*)(A + y * Stride);
+		const __m128i* RowB = (const __m128i*)(B + y * Stride);
+		__m128i Sum = _mm_sad_epu8(_mm_loadu_si128(RowA), _mm_loadu_si128(RowB));
+		Sum = _mm_add_epi64(Sum, _mm_sad_epu8(_mm_loadu_si128(RowA + 1), _mm_loadu_si128(RowB + 1)));
+		Sum = _mm_add_epi64(Sum, _mm_sad_epu8(_mm_loadu_si128(RowA + 2), _mm_loadu_si128(RowB + 2)));
+		Sum = _mm_add_epi64(Sum, _mm_sad_epu8(_mm_loadu_si128(RowA + 3), _mm_loadu_si128(RowB + 3)));
+		Sum = _mm_add_epi64(Sum, _mm_srli_si128(Sum, 8));
+		Total += (uint32)_mm_cvtsi128_si32(Sum);
+
+		// Most blocks in a moving scene fail on the first row or two
+		if (Total > Limit)
+		{
+			break;
+		}
+	}
+	return Total;
+}
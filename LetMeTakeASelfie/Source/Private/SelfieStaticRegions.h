@@ -0,0 +1,51 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "vpx/vp8cx.h"
+
+/**
+ * Finds 16x16 macroblocks that didn't change since the previous frame, for VP8E_SET_ACTIVEMAP.
+ *
+ * Inactive macroblocks are copied from the previous reconstructed frame by the encoder, so a block is only let off if
+ * its BGRA SAD against the previous source frame is tiny, and never for more than MaxStaticRun frames in a row so small
+ * changes can't pile up unnoticed. Runs on the encoding thread just ahead of each frame, one pass over two frames with
+ * SSE2 and an early out as soon as a block has clearly changed.
+ */
+class FSelfieStaticRegions
+{
+public:
+	FSelfieStaticRegions(int32 InWidth, int32 InHeight);
+
+	/** Sum of absolute BGRA differences a 16x16 block may have and still count as unchanged */
+	uint32 BlockSADThreshold;
+	/** Frames a block may stay inactive before it gets encoded again regardless */
+	int32 MaxStaticRun;
+
+	/** Builds the active map for Current, Previous null marks everything active. Returns the number of static blocks */
+	int32 Analyze(const FColor* Previous, const FColor* Current);
+
+	/** Valid until the next Analyze */
+	vpx_active_map_t* GetActiveMap() { return &ActiveMap; }
+
+	int32 GetNumBlocks() const { return Cols * Rows; }
+
+	/** Share of blocks found static over every frame so far */
+	float GetStaticShare() const;
+
+	/** SAD of a BlockWidth x BlockHeight region of BGRA pixels, stops adding up once it's past Limit */
+	static uint32 BlockSAD(const FColor* A, const FColor* B, int32 Stride, int32 BlockWidth, int32 BlockHeight, uint32 Limit);
+	static uint32 BlockSADScalar(const FColor* A, const FColor* B, int32 Stride, int32 BlockWidth, int32 BlockHeight, uint32 Limit);
+
+private:
+	int32 Width;
+	int32 Height;
+	int32 Cols;
+	int32 Rows;
+
+	TArray<uint8> ActiveBlocks;
+	TArray<int32> StaticRun;
+	vpx_active_map_t ActiveMap;
+
+	int64 TotalBlocks;
+	int64 TotalStaticBlocks;
+};
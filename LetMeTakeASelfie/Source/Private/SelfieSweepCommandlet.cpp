@@ -0,0 +1,346 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieSweepCommandlet.h"
+#include "SelfieRingDump.h"
+#include "SelfieEncodePipeline.h"
+#include "SelfieOutputSink.h"
+#include "SelfieWebMMuxer.h"
+#include "SelfieQualityMetrics.h"
+#include "SelfieYUV.h"
+
+#include "vpx/vp8cx.h"
+#include "vpx/vp8dx.h"
+#include "vpx/vpx_decoder.h"
+#include "libyuv/scale.h"
+#include "libyuv/scale_argb.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieSweep, Log, All);
+
+/** Planar I420 frame in one allocation */
+struct FSelfieSweepI420
+{
+	int32 Width;
+	int32 Height;
+	TArray<uint8> Data;
+
+	void Init(int32 InWidth, int32 InHeight)
+	{
+		Width = InWidth;
+		Height = InHeight;
+		Data.Empty(GetSize());
+		Data.AddUninitialized(GetSize());
+	}
+
+	int32 GetChromaWidth() const { return (Width + 1) / 2; }
+	int32 GetChromaHeight() const { return (Height + 1) / 2; }
+	int32 GetSize() const { return Width * Height + 2 * GetChromaWidth() * GetChromaHeight(); }
+
+	uint8* Y() { return Data.GetData(); }
+	uint8* U() { return Y() + Width * Height; }
+	uint8* V() { return U() + GetChromaWidth() * GetChromaHeight(); }
+};
+
+/** Feeds one scale of the sweep to the pipeline */
+struct FSelfieSweepSource
+{
+	TArray< TArray<FColor> >* Frames;
+
+	const FColor* GetFrame(int32 FrameIndex)
+	{
+		return (*Frames)[FrameIndex].GetData();
+	}
+};
+
+/** Muxes into memory for the file size, and keeps the packets to decode them afterwards */
+struct FSelfieSweepOutput
+{
+	FSelfieWebMMuxer* Muxer;
+	TArray< TArray<uint8> > Packets;
+
+	bool OnPacket(const vpx_codec_cx_pkt_t* Pkt)
+	{
+		TArray<uint8>& Packet = Packets[Packets.AddDefaulted()];
+		Packet.Append((const uint8*)Pkt->data.frame.buf, Pkt->data.frame.sz);
+		return Muxer->WriteBlock(Pkt);
+	}
+};
+
+struct FSelfieSweepPoint
+{
+	int32 Bitrate;
+	int32 Speed;
+	float Scale;
+	int32 Width;
+	int32 Height;
+
+	double EncodeFps;
+	int64 FileSize;
+	double PSNRY;
+	double PSNR;
+	double SSIMY;
+	bool bPareto;
+
+	/** Smaller, better looking and faster or equal on every axis, and strictly better on one */
+	bool Dominates(const FSelfieSweepPoint& Other) const
+	{
+		const bool bNoWorse = FileSize <= Other.FileSize && PSNR >= Other.PSNR && EncodeFps >= Other.EncodeFps;
+		const bool bBetter = FileSize < Other.FileSize || PSNR > Other.PSNR || EncodeFps > Other.EncodeFps;
+		return bNoWorse && bBetter;
+	}
+};
+
+USelfieSweepCommandlet::USelfieSweepCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+static void ParseSweepValue(const FString& Entry, int32& OutValue)
+{
+	OutValue = FCString::Atoi(*Entry);
+}
+
+static void ParseSweepValue(const FString& Entry, float& OutValue)
+{
+	OutValue = FCString::Atof(*Entry);
+}
+
+template<typename T>
+static void ParseSweepList(const FString& Params, const TCHAR* Key, TArray<T>& OutValues)
+{
+	FString List;
+	if (!FParse::Value(*Params, Key, List))
+	{
+		return;
+	}
+
+	TArray<FString> Entries;
+	List.ParseIntoArray(&Entries, TEXT(","), true);
+	OutValues.Empty();
+	for (const FString& Entry : Entries)
+	{
+		T Value;
+		ParseSweepValue(Entry, Value);
+		OutValues.Add(Value);
+	}
+}
+
+int32 USelfieSweepCommandlet::Main(const FString& Params)
+{
+	FString DumpPath;
+	if (!FParse::Value(*Params, TEXT("Dump="), DumpPath))
+	{
+		UE_LOG(LogUTSelfieSweep, Error, TEXT("Usage: -run=SelfieSweep -Dump=<ring dump> [-Bitrates=0,1000] [-Speeds=0,4,8] [-Scales=1,0.5] [-Realtime]"));
+		return 1;
+	}
+
+	TArray<int32> Bitrates;
+	Bitrates.Add(0);
+	TArray<int32> Speeds;
+	Speeds.Add(0);
+	Speeds.Add(4);
+	Speeds.Add(8);
+	TArray<float> Scales;
+	Scales.Add(1.0f);
+	Scales.Add(0.75f);
+	Scales.Add(0.5f);
+	ParseSweepList(Params, TEXT("Bitrates="), Bitrates);
+	ParseSweepList(Params, TEXT("Speeds="), Speeds);
+	ParseSweepList(Params, TEXT("Scales="), Scales);
+	const unsigned long Deadline = FParse::Param(*Params, TEXT("Realtime")) ? VPX_DL_REALTIME : VPX_DL_GOOD_QUALITY;
+
+	FSelfieRingDumpHeader Header;
+	TArray< TArray<FColor> > SourceFrames;
+	if (!FSelfieRingDump::Read(DumpPath, Header, SourceFrames) || Header.NumFrames == 0)
+	{
+		UE_LOG(LogUTSelfieSweep, Error, TEXT("Couldn't read ring dump %s"), *DumpPath);
+		return 1;
+	}
+	UE_LOG(LogUTSelfieSweep, Display, TEXT("%d frames of %dx%d at %dhz"), Header.NumFrames, Header.Width, Header.Height, Header.FrameRate);
+
+	// Reference frames, everything gets measured against these at full resolution. Same conversion the pipeline does
+	const FSelfieYUVFormat ReferenceFormat;
+	const FSelfieYUVKernel ConvertKernel = FSelfieYUV::GetKernel(ReferenceFormat);
+	TArray<FSelfieSweepI420> Reference;
+	Reference.AddDefaulted(Header.NumFrames);
+	for (int32 FrameIndex = 0; FrameIndex < Header.NumFrames; FrameIndex++)
+	{
+		FSelfieSweepI420& Ref = Reference[FrameIndex];
+		Ref.Init(Header.Width, Header.Height);
+		ConvertKernel(SourceFrames[FrameIndex].GetData(), Header.Width, Header.Width, Header.Height, FSelfieYUV::GetPackedPlanes(ReferenceFormat, Ref.Y(), Ref.Width, Ref.Height));
+	}
+
+	TArray<FSelfieSweepPoint> Points;
+	FSelfieSweepI420 Upscaled;
+	Upscaled.Init(Header.Width, Header.Height);
+
+	for (const float Scale : Scales)
+	{
+		// VP8 wants even dimensions
+		const int32 Width = FMath::Max(2, FMath::RoundToInt(Header.Width * Scale) & ~1);
+		const int32 Height = FMath::Max(2, FMath::RoundToInt(Header.Height * Scale) & ~1);
+
+		TArray< TArray<FColor> > ScaledFrames;
+		TArray< TArray<FColor> >* EncodeFrames = &SourceFrames;
+		if (Width != Header.Width || Height != Header.Height)
+		{
+			ScaledFrames.AddDefaulted(Header.NumFrames);
+			for (int32 FrameIndex = 0; FrameIndex < Header.NumFrames; FrameIndex++)
+			{
+				ScaledFrames[FrameIndex].AddUninitialized(Width * Height);
+				libyuv::ARGBScale((const uint8*)SourceFrames[FrameIndex].GetData(), Header.Width * 4, Header.Width, Header.Height,
+					(uint8*)ScaledFrames[FrameIndex].GetData(), Width * 4, Width, Height, libyuv::kFilterBox);
+			}
+			EncodeFrames = &ScaledFrames;
+		}
+
+		FSelfieSweepSource Source;
+		Source.Frames = EncodeFrames;
+
+		for (const int32 Bitrate : Bitrates)
+		{
+			for (const int32 Speed : Speeds)
+			{
+				FSelfieSweepPoint Point;
+				FMemory::Memzero(Point);
+				Point.Bitrate = Bitrate;
+				Point.Speed = Speed;
+				Point.Scale = Scale;
+				Point.Width = Width;
+				Point.Height = Height;
+
+				vpx_codec_enc_cfg_t Cfg;
+				vpx_codec_ctx_t Codec;
+				if (!FSelfieEncodePipeline::InitConfig(Cfg, Width, Height, Header.FrameRate))
+				{
+					return 1;
+				}
+				if (Bitrate > 0)
+				{
+					Cfg.rc_target_bitrate = Bitrate;
+				}
+				if (vpx_codec_enc_init(&Codec, vpx_codec_vp8_cx(), &Cfg, 0))
+				{
+					UE_LOG(LogUTSelfieSweep, Warning, TEXT("Encoder init failed for %dx%d"), Width, Height);
+					continue;
+				}
+				vpx_codec_control(&Codec, VP8E_SET_CPUUSED, Speed);
+
+				TArray<uint8> WebM;
+				FSelfieMemorySink Sink(WebM);
+				FSelfieWebMMuxer Muxer(&Sink);
+				Muxer.Begin(Cfg);
+
+				FSelfieSweepOutput Output;
+				Output.Muxer = &Muxer;
+
+				FSelfieEncodePipeline Pipeline(&Codec, Width, Height, Deadline);
+				Pipeline.NumConvertWorkers = FMath::Clamp(FPlatformMisc::NumberOfCores() - 2, 1, 2);
+				Pipeline.Run(Header.NumFrames,
+					FSelfieGetSourceFrame::CreateRaw(&Source, &FSelfieSweepSource::GetFrame),
+					FSelfieMuxPacket::CreateRaw(&Output, &FSelfieSweepOutput::OnPacket));
+				Muxer.Finish();
+				vpx_codec_destroy(&Codec);
+
+				Point.EncodeFps = Pipeline.TotalSeconds > 0 ? Header.NumFrames / Pipeline.TotalSeconds : 0;
+				Point.FileSize = WebM.Num();
+
+				// Decode and bring back up to the source size, so scaled points pay for the detail they threw away
+				vpx_codec_ctx_t Decoder;
+				if (vpx_codec_dec_init(&Decoder, vpx_codec_vp8_dx(), nullptr, 0))
+				{
+					continue;
+				}
+
+				uint64 SSEY = 0;
+				uint64 SSEUV = 0;
+				double SSIMYTotal = 0;
+				int32 DecodedFrames = 0;
+				for (const TArray<uint8>& Packet : Output.Packets)
+				{
+					if (vpx_codec_decode(&Decoder, Packet.GetData(), Packet.Num(), nullptr, 0))
+					{
+						continue;
+					}
+
+					vpx_codec_iter_t Iter = nullptr;
+					while (vpx_image_t* Decoded = vpx_codec_get_frame(&Decoder, &Iter))
+					{
+						if (DecodedFrames >= Header.NumFrames)
+						{
+							break;
+						}
+
+						libyuv::I420Scale(
+							Decoded->planes[VPX_PLANE_Y], Decoded->stride[VPX_PLANE_Y],
+							Decoded->planes[VPX_PLANE_U], Decoded->stride[VPX_PLANE_U],
+							Decoded->planes[VPX_PLANE_V], Decoded->stride[VPX_PLANE_V],
+							Decoded->d_w, Decoded->d_h,
+							Upscaled.Y(), Upscaled.Width, Upscaled.U(), Upscaled.GetChromaWidth(), Upscaled.V(), Upscaled.GetChromaWidth(),
+							Upscaled.Width, Upscaled.Height, libyuv::kFilterBilinear);
+
+						FSelfieSweepI420& Ref = Reference[DecodedFrames];
+						SSEY += FSelfieQualityMetrics::SumSquaredError(Ref.Y(), Ref.Width, Upscaled.Y(), Upscaled.Width, Ref.Width, Ref.Height);
+						SSEUV += FSelfieQualityMetrics::SumSquaredError(Ref.U(), Ref.GetChromaWidth(), Upscaled.U(), Upscaled.GetChromaWidth(), Ref.GetChromaWidth(), Ref.GetChromaHeight());
+						SSEUV += FSelfieQualityMetrics::SumSquaredError(Ref.V(), Ref.GetChromaWidth(), Upscaled.V(), Upscaled.GetChromaWidth(), Ref.GetChromaWidth(), Ref.GetChromaHeight());
+						SSIMYTotal += FSelfieQualityMetrics::SSIM(Ref.Y(), Ref.Width, Upscaled.Y(), Upscaled.Width, Ref.Width, Ref.Height);
+						DecodedFrames++;
+					}
+				}
+				vpx_codec_destroy(&Decoder);
+
+				if (DecodedFrames == 0)
+				{
+					continue;
+				}
+
+				const uint64 LumaSamples = (uint64)Header.Width * Header.Height * DecodedFrames;
+				const uint64 ChromaSamples = (uint64)2 * Reference[0].GetChromaWidth() * Reference[0].GetChromaHeight() * DecodedFrames;
+				Point.PSNRY = FSelfieQualityMetrics::PSNR(SSEY, LumaSamples);
+				Point.PSNR = FSelfieQualityMetrics::PSNR(SSEY + SSEUV, LumaSamples + ChromaSamples);
+				Point.SSIMY = SSIMYTotal / DecodedFrames;
+
+				UE_LOG(LogUTSelfieSweep, Display, TEXT("%4dx%-4d %5dkbps speed %2d: %6.1f fps %8lld bytes %6.2f dB"), Width, Height, Cfg.rc_target_bitrate, Speed, Point.EncodeFps, Point.FileSize, Point.PSNR);
+				Point.Bitrate = Cfg.rc_target_bitrate;
+				Points.Add(Point);
+			}
+		}
+	}
+
+	for (FSelfieSweepPoint& Point : Points)
+	{
+		Point.bPareto = true;
+		for (const FSelfieSweepPoint& Other : Points)
+		{
+			if (Other.Dominates(Point))
+			{
+				Point.bPareto = false;
+				break;
+			}
+		}
+	}
+
+	// Smallest first so the Pareto front reads as a quality/size curve
+	Points.Sort([](const FSelfieSweepPoint& A, const FSelfieSweepPoint& B) { return A.FileSize < B.FileSize; });
+
+	FString Csv = TEXT("pareto,width,height,scale,bitrate_kbps,speed,encode_fps,file_bytes,psnr_y,psnr,ssim_y\n");
+	UE_LOG(LogUTSelfieSweep, Display, TEXT("  * = Pareto optimal (size, PSNR, encode fps)"));
+	UE_LOG(LogUTSelfieSweep, Display, TEXT("    resolution  kbps  speed    fps       bytes  PSNR-Y    PSNR  SSIM-Y"));
+	for (const FSelfieSweepPoint& Point : Points)
+	{
+		UE_LOG(LogUTSelfieSweep, Display, TEXT("  %s %4dx%-4d  %5d  %5d  %5.1f  %10lld  %6.2f  %6.2f  %6.4f"),
+			Point.bPareto ? TEXT("*") : TEXT(" "), Point.Width, Point.Height, Point.Bitrate, Point.Speed, Point.EncodeFps, Point.FileSize, Point.PSNRY, Point.PSNR, Point.SSIMY);
+		Csv += FString::Printf(TEXT("%d,%d,%d,%.3f,%d,%d,%.2f,%lld,%.3f,%.3f,%.5f\n"),
+			Point.bPareto ? 1 : 0, Point.Width, Point.Height, Point.Scale, Point.Bitrate, Point.Speed, Point.EncodeFps, Point.FileSize, Point.PSNRY, Point.PSNR, Point.SSIMY);
+	}
+
+	const FString CsvPath = FPaths::ChangeExtension(DumpPath, TEXT("sweep.csv"));
+	FFileHelper::SaveStringToFile(Csv, *CsvPath);
+	UE_LOG(LogUTSelfieSweep, Display, TEXT("Wrote %s"), *CsvPath);
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieSweepCommandlet.generated.h"
+
+/**
+ * Offline rate-distortion sweep over a ring dump made with SELFIEDUMP.
+ *
+ * Every combination of bitrate, encoder speed and resolution scale is encoded with the same pipeline WriteWebM uses,
+ * decoded again and compared against the source I420 frames. Prints a table with encode fps, file size, PSNR and SSIM,
+ * with the Pareto optimal points marked, and writes the same thing as CSV next to the dump.
+ *
+ * UE4Editor-Cmd.exe UnrealTournament -run=SelfieSweep -Dump=<file> [-Bitrates=0,1000,2000] [-Speeds=0,4,8] [-Scales=1,0.75,0.5] [-Realtime]
+ * A bitrate of 0 means what WriteWebM picks for the resolution.
+ */
+UCLASS()
+class USelfieSweepCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	virtual int32 Main(const FString& Params) override;
+};
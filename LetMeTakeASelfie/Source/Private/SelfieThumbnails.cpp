@@ -0,0 +1,269 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieThumbnails.h"
+
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+
+#include <emmintrin.h>
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieThumbnails, Log, All);
+
+/** One compressed output, runs on GThreadPool */
+class FSelfieImageWriteWork : public IQueuedWork
+{
+public:
+	FSelfieImageWriteWork(TArray<FColor>& InPixels, int32 InWidth, int32 InHeight, bool bInPNG, int32 InQuality, const FString& InPath, FThreadSafeCounter& InPendingWrites, FEvent* InDoneEvent)
+		: Pixels(InPixels)
+		, Width(InWidth)
+		, Height(InHeight)
+		, bPNG(bInPNG)
+		, Quality(InQuality)
+		, Path(InPath)
+		, PendingWrites(InPendingWrites)
+		, DoneEvent(InDoneEvent)
+	{
+	}
+
+	virtual void DoThreadedWork() override
+	{
+		IImageWrapperModule& ImageWrapperModule = FModuleManager::GetModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+		IImageWrapperPtr ImageWrapper = ImageWrapperModule.CreateImageWrapper(bPNG ? EImageFormat::PNG : EImageFormat::JPEG);
+		if (ImageWrapper.IsValid() && ImageWrapper->SetRaw(Pixels.GetData(), Pixels.Num() * sizeof(FColor), Width, Height, ERGBFormat::BGRA, 8))
+		{
+			const TArray<uint8>& Compressed = ImageWrapper->GetCompressed(bPNG ? 0 : Quality);
+			if (!FFileHelper::SaveArrayToFile(Compressed, *Path))
+			{
+				UE_LOG(LogUTSelfieThumbnails, Warning, TEXT("Couldn't write %s"), *Path);
+			}
+		}
+
+		Finish();
+	}
+
+	virtual void Abandon() override
+	{
+		Finish();
+	}
+
+private:
+	void Finish()
+	{
+		if (PendingWrites.Decrement() == 0)
+		{
+			DoneEvent->Trigger();
+		}
+		delete this;
+	}
+
+	TArray<FColor>& Pixels;
+	int32 Width;
+	int32 Height;
+	bool bPNG;
+	int32 Quality;
+	FString Path;
+	FThreadSafeCounter& PendingWrites;
+	FEvent* DoneEvent;
+};
+
+FSelfieThumbnailExport::FSelfieThumbnailExport(const FString& InBasePath, int32 InWidth, int32 InHeight, int32 InNumFrames, const FSelfieGetSourceFrame& InGetFrame)
+	: SheetColumns(4)
+	, SheetRows(3)
+	, SheetDownscaleSteps(2)
+	, StripFrames(10)
+	, StripDownscaleSteps(3)
+	, JpegQuality(85)
+	, BasePath(InBasePath)
+	, Width(InWidth)
+	, Height(InHeight)
+	, NumFrames(InNumFrames)
+	, GetFrame(InGetFrame)
+	, Thread(nullptr)
+{
+	WritesDoneEvent = FPlatformProcess::CreateSynchEvent(true);
+}
+
+FSelfieThumbnailExport::~FSelfieThumbnailExport()
+{
+	Wait();
+	delete WritesDoneEvent;
+}
+
+void FSelfieThumbnailExport::Start()
+{
+	if (NumFrames > 0)
+	{
+		Thread = FRunnableThread::Create(this, TEXT("FSelfieThumbnailExport"), 0, TPri_BelowNormal);
+	}
+}
+
+void FSelfieThumbnailExport::Wait()
+{
+	if (Thread)
+	{
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+}
+
+void FSelfieThumbnailExport::DeleteOutputs()
+{
+	IFileManager::Get().Delete(*(BasePath + TEXT("_poster.jpg")));
+	IFileManager::Get().Delete(*(BasePath + TEXT("_sheet.jpg")));
+	IFileManager::Get().Delete(*(BasePath + TEXT("_strip.png")));
+}
+
+uint32 FSelfieThumbnailExport::Run()
+{
+	// Three outputs, the counter hits zero when the last one is on disk
+	PendingWrites.Set(3);
+	WritesDoneEvent->Reset();
+
+	// Poster from the middle of the clip, full size
+	PosterPixels.Empty(Width * Height);
+	PosterPixels.Append(GetFrame.Execute(NumFrames / 2), Width * Height);
+	for (FColor& Pixel : PosterPixels)
+	{
+		Pixel.A = 255;
+	}
+	CompressAndSave(PosterPixels, Width, Height, false, BasePath + TEXT("_poster.jpg"));
+
+	int32 SheetWidth = 0;
+	int32 SheetHeight = 0;
+	BuildSheet(SheetColumns, SheetRows, SheetDownscaleSteps, SheetPixels, SheetWidth, SheetHeight);
+	CompressAndSave(SheetPixels, SheetWidth, SheetHeight, false, BasePath + TEXT("_sheet.jpg"));
+
+	// Scrub strip is a one row sheet
+	int32 StripWidth = 0;
+	int32 StripHeight = 0;
+	BuildSheet(StripFrames, 1, StripDownscaleSteps, StripPixels, StripWidth, StripHeight);
+	CompressAndSave(StripPixels, StripWidth, StripHeight, true, BasePath + TEXT("_strip.png"));
+
+	WritesDoneEvent->Wait();
+
+	return 0;
+}
+
+void FSelfieThumbnailExport::CompressAndSave(TArray<FColor>& Pixels, int32 ImageWidth, int32 ImageHeight, bool bPNG, const FString& Path)
+{
+	GThreadPool->AddQueuedWork(new FSelfieImageWriteWork(Pixels, ImageWidth, ImageHeight, bPNG, JpegQuality, Path, PendingWrites, WritesDoneEvent));
+}
+
+void FSelfieThumbnailExport::BuildSheet(int32 Columns, int32 Rows, int32 DownscaleSteps, TArray<FColor>& OutPixels, int32& OutWidth, int32& OutHeight)
+{
+	const int32 TileWidth = Width >> DownscaleSteps;
+	const int32 TileHeight = Height >> DownscaleSteps;
+	const int32 NumTiles = Columns * Rows;
+
+	OutWidth = TileWidth * Columns;
+	OutHeight = TileHeight * Rows;
+	OutPixels.Empty(OutWidth * OutHeight);
+	OutPixels.AddZeroed(OutWidth * OutHeight);
+
+	TArray<FColor> Tile;
+	Tile.AddUninitialized(TileWidth * TileHeight);
+
+	for (int32 TileIndex = 0; TileIndex < NumTiles; TileIndex++)
+	{
+		// Evenly spaced through the clip, first and last frame included
+		const int32 FrameIndex = NumTiles > 1 ? (int32)((int64)TileIndex * (NumFrames - 1) / (NumTiles - 1)) : 0;
+		Downscale(GetFrame.Execute(FrameIndex), Width, Height, DownscaleSteps, Tile.GetData());
+
+		const int32 TileX = (TileIndex % Columns) * TileWidth;
+		const int32 TileY = (TileIndex / Columns) * TileHeight;
+		for (int32 y = 0; y < TileHeight; y++)
+		{
+			FMemory::Memcpy(&OutPixels[(TileY + y) * OutWidth + TileX], &Tile[y * TileWidth], TileWidth * sizeof(FColor));
+		}
+	}
+
+	for (FColor& Pixel : OutPixels)
+	{
+		Pixel.A = 255;
+	}
+}
+
+/** One 2x2 box filter pass, Dest is SrcWidth / 2 by SrcHeight / 2 */
+static void SelfieHalve(const FColor* Src, int32 SrcWidth, int32 SrcHeight, FColor* Dest)
+{
+	const int32 DestWidth = SrcWidth / 2;
+	const int32 DestHeight = SrcHeight / 2;
+	const int32 VectorWidth = DestWidth & ~3;
+
+	for (int32 y = 0; y < DestHeight; y++)
+	{
+		const FColor* Row0 = Src + (2 * y) * SrcWidth;
+		const FColor* Row1 = Row0 + SrcWidth;
+		FColor* DestRow = Dest + y * DestWidth;
+
+		// 8 source pixels from each row make 4 output pixels. Sums are done in 16 bits so it rounds once, the same as
+		// the scalar tail, rather than twice with a pair of _mm_avg_epu8
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i Two = _mm_set1_epi16(2);
+		for (int32 x = 0; x < VectorWidth; x += 4)
+		{
+			const __m128 Top0 = _mm_loadu_ps((const float*)(Row0 + 2 * x));
+			const __m128 Top1 = _mm_loadu_ps((const float*)(Row0 + 2 * x + 4));
+			const __m128 Bottom0 = _mm_loadu_ps((const float*)(Row1 + 2 * x));
+			const __m128 Bottom1 = _mm_loadu_ps((const float*)(Row1 + 2 * x + 4));
+
+			const __m128i TopEven = _mm_castps_si128(_mm_shuffle_ps(Top0, Top1, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128i TopOdd = _mm_castps_si128(_mm_shuffle_ps(Top0, Top1, _MM_SHUFFLE(3, 1, 3, 1)));
+			const __m128i BottomEven = _mm_castps_si128(_mm_shuffle_ps(Bottom0, Bottom1, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128i BottomOdd = _mm_castps_si128(_mm_shuffle_ps(Bottom0, Bottom1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+			// Output pixels 0-1 in Low, 2-3 in High, (A + B + C + D + 2) / 4 per channel
+			__m128i Low = _mm_add_epi16(_mm_unpacklo_epi8(TopEven, Zero), _mm_unpacklo_epi8(TopOdd, Zero));
+			Low = _mm_add_epi16(Low, _mm_add_epi16(_mm_unpacklo_epi8(BottomEven, Zero), _mm_unpacklo_epi8(BottomOdd, Zero)));
+			Low = _mm_srli_epi16(_mm_add_epi16(Low, Two), 2);
+			__m128i High = _mm_add_epi16(_mm_unpackhi_epi8(TopEven, Zero), _mm_unpackhi_epi8(TopOdd, Zero));
+			High = _mm_add_epi16(High, _mm_add_epi16(_mm_unpackhi_epi8(BottomEven, Zero), _mm_unpackhi_epi8(BottomOdd, Zero)));
+			High = _mm_srli_epi16(_mm_add_epi16(High, Two), 2);
+
+			_mm_storeu_si128((__m128i*)(DestRow + x), _mm_packus_epi16(Low, High));
+		}
+
+		for (int32 x = VectorWidth; x < DestWidth; x++)
+		{
+			const FColor& A = Row0[2 * x];
+			const FColor& B = Row0[2 * x + 1];
+			const FColor& C = Row1[2 * x];
+			const FColor& D = Row1[2 * x + 1];
+			DestRow[x] = FColor((A.R + B.R + C.R + D.R + 2) / 4, (A.G + B.G + C.G + D.G + 2) / 4, (A.B + B.B + C.B + D.B + 2) / 4, (A.A + B.A + C.A + D.A + 2) / 4);
+		}
+	}
+}
+
+void FSelfieThumbnailExport::Downscale(const FColor* Src, int32 SrcWidth, int32 SrcHeight, int32 Steps, FColor* Dest)
+{
+	if (Steps <= 0)
+	{
+		FMemory::Memcpy(Dest, Src, SrcWidth * SrcHeight * sizeof(FColor));
+		return;
+	}
+
+	// Intermediate passes ping-pong through scratch, the last one lands in Dest
+	TArray<FColor> Scratch[2];
+	const FColor* PassSrc = Src;
+	int32 PassWidth = SrcWidth;
+	int32 PassHeight = SrcHeight;
+	for (int32 Step = 0; Step < Steps; Step++)
+	{
+		FColor* PassDest = Dest;
+		if (Step + 1 < Steps)
+		{
+			TArray<FColor>& Buffer = Scratch[Step % 2];
+			Buffer.Empty((PassWidth / 2) * (PassHeight / 2));
+			Buffer.AddUninitialized((PassWidth / 2) * (PassHeight / 2));
+			PassDest = Buffer.GetData();
+		}
+
+		SelfieHalve(PassSrc, PassWidth, PassHeight, PassDest);
+
+		PassSrc = PassDest;
+		PassWidth /= 2;
+		PassHeight /= 2;
+	}
+}
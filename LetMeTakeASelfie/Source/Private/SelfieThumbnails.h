@@ -0,0 +1,58 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieEncodePipeline.h"
+
+/**
+ * Poster image, contact sheet and scrub strip for a clip, made straight from the ring while the video encodes.
+ *
+ * Frames are downscaled with an SSE2 2x2 box filter and tiled, then each output is compressed on the thread pool
+ * so the JPEG/PNG encodes run side by side. Runs on its own thread, reading the same ring frames as the encoder.
+ */
+class FSelfieThumbnailExport : public FRunnable
+{
+public:
+	/** Outputs go to BasePath + _poster.jpg, _sheet.jpg and _strip.png */
+	FSelfieThumbnailExport(const FString& InBasePath, int32 InWidth, int32 InHeight, int32 InNumFrames, const FSelfieGetSourceFrame& InGetFrame);
+	virtual ~FSelfieThumbnailExport();
+
+	void Start();
+
+	/** Blocks until every file has been written */
+	void Wait();
+
+	/** Removes whatever got written, after Wait */
+	void DeleteOutputs();
+
+	/** Halves both dimensions Steps times, SSE2 for the bulk of each row. Dest needs room for the result */
+	static void Downscale(const FColor* Src, int32 SrcWidth, int32 SrcHeight, int32 Steps, FColor* Dest);
+
+	int32 SheetColumns;
+	int32 SheetRows;
+	/** Each tile is 1 / 2^SheetDownscaleSteps of the frame */
+	int32 SheetDownscaleSteps;
+	int32 StripFrames;
+	int32 StripDownscaleSteps;
+	int32 JpegQuality;
+
+	/** FRunnable */
+	virtual uint32 Run() override;
+
+private:
+	void BuildSheet(int32 Columns, int32 Rows, int32 DownscaleSteps, TArray<FColor>& OutPixels, int32& OutWidth, int32& OutHeight);
+	void CompressAndSave(TArray<FColor>& Pixels, int32 ImageWidth, int32 ImageHeight, bool bPNG, const FString& Path);
+
+	FString BasePath;
+	int32 Width;
+	int32 Height;
+	int32 NumFrames;
+	FSelfieGetSourceFrame GetFrame;
+
+	FRunnableThread* Thread;
+	FThreadSafeCounter PendingWrites;
+	FEvent* WritesDoneEvent;
+
+	TArray<FColor> PosterPixels;
+	TArray<FColor> SheetPixels;
+	TArray<FColor> StripPixels;
+};
@@ -0,0 +1,158 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieWebMMuxer.h"
+#include "SelfieOutputSink.h"
+
+#include "vpx/third_party/libwebm/mkvmuxer.hpp"
+
+/** Forwards libwebm's writes to a selfie sink */
+class FSelfieMkvWriter : public mkvmuxer::IMkvWriter
+{
+public:
+	FSelfieMkvWriter(ISelfieOutputSink* InSink)
+		: Sink(InSink)
+		, bFailed(false)
+	{
+	}
+
+	virtual mkvmuxer::int32 Write(const void* Buffer, mkvmuxer::uint32 Length) override
+	{
+		if (!Sink->Write(Buffer, Length))
+		{
+			bFailed = true;
+			return -1;
+		}
+		return 0;
+	}
+
+	virtual mkvmuxer::int64 Position() const override
+	{
+		return Sink->Position();
+	}
+
+	virtual mkvmuxer::int32 Position(mkvmuxer::int64 NewPosition) override
+	{
+		return Sink->Seek(NewPosition) ? 0 : -1;
+	}
+
+	virtual bool Seekable() const override
+	{
+		return Sink->IsSeekable();
+	}
+
+	virtual void ElementStartNotify(mkvmuxer::uint64 ElementId, mkvmuxer::int64 ElementPosition) override
+	{
+	}
+
+	ISelfieOutputSink* Sink;
+	bool bFailed;
+};
+
+FSelfieWebMMuxer::FSelfieWebMMuxer(ISelfieOutputSink* InSink)
+	: Sink(InSink)
+	, Writer(nullptr)
+	, Segment(nullptr)
+	, VideoTrackId(0)
+	, LastPtsNs(-1)
+	, bFailed(false)
+{
+	Timebase.num = 1;
+	Timebase.den = 30;
+}
+
+FSelfieWebMMuxer::~FSelfieWebMMuxer()
+{
+	delete Segment;
+	Segment = nullptr;
+	delete Writer;
+	Writer = nullptr;
+}
+
+bool FSelfieWebMMuxer::Begin(const vpx_codec_enc_cfg_t& Cfg)
+{
+	Timebase = Cfg.g_timebase;
+
+	Writer = new FSelfieMkvWriter(Sink);
+	Segment = new mkvmuxer::Segment();
+	if (!Segment->Init(Writer))
+	{
+		bFailed = true;
+		return false;
+	}
+
+	// Streams can't go back to fill in sizes and cues, so write them as live
+	if (Sink->IsSeekable())
+	{
+		Segment->set_mode(mkvmuxer::Segment::kFile);
+		Segment->OutputCues(true);
+	}
+	else
+	{
+		Segment->set_mode(mkvmuxer::Segment::kLive);
+		Segment->OutputCues(false);
+	}
+
+	mkvmuxer::SegmentInfo* const Info = Segment->GetSegmentInfo();
+	Info->set_timecode_scale(1000000);
+	Info->set_writing_app("LetMeTakeASelfie");
+
+	VideoTrackId = Segment->AddVideoTrack(Cfg.g_w, Cfg.g_h, 1);
+	mkvmuxer::VideoTrack* const VideoTrack = static_cast<mkvmuxer::VideoTrack*>(Segment->GetTrackByNumber(VideoTrackId));
+	if (VideoTrack == nullptr)
+	{
+		bFailed = true;
+		return false;
+	}
+	VideoTrack->set_codec_id("V_VP8");
+	VideoTrack->set_frame_rate((double)Timebase.den / Timebase.num);
+
+	return !Writer->bFailed;
+}
+
+bool FSelfieWebMMuxer::WriteBlock(const vpx_codec_cx_pkt_t* Pkt)
+{
+	if (bFailed || Segment == nullptr)
+	{
+		return false;
+	}
+
+	// Same timestamp handling as webmenc, never let two blocks share a timestamp
+	int64 PtsNs = Pkt->data.frame.pts * 1000000000ll * Timebase.num / Timebase.den;
+	if (PtsNs <= LastPtsNs)
+	{
+		PtsNs = LastPtsNs + 1000000;
+	}
+	LastPtsNs = PtsNs;
+
+	const bool bKeyFrame = (Pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+	if (!Segment->AddFrame((const uint8*)Pkt->data.frame.buf, Pkt->data.frame.sz, VideoTrackId, PtsNs, bKeyFrame))
+	{
+		bFailed = true;
+	}
+
+	return !bFailed;
+}
+
+bool FSelfieWebMMuxer::Finish()
+{
+	if (Segment == nullptr)
+	{
+		return false;
+	}
+
+	if (!Segment->Finalize())
+	{
+		bFailed = true;
+	}
+
+	delete Segment;
+	Segment = nullptr;
+
+	return !bFailed && !Writer->bFailed;
+}
+
+int64 FSelfieWebMMuxer::GetBytesWritten() const
+{
+	return Sink->Position();
+}
@@ -0,0 +1,38 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "vpx/vpx_encoder.h"
+
+class ISelfieOutputSink;
+
+namespace mkvmuxer
+{
+	class Segment;
+}
+
+/**
+ * Same output as webmenc's write_webm_file_header/write_webm_block/write_webm_file_footer,
+ * but writing through an ISelfieOutputSink instead of a FILE so clips can stream straight to another process.
+ */
+class FSelfieWebMMuxer
+{
+public:
+	/** Sink has to outlive the muxer */
+	FSelfieWebMMuxer(ISelfieOutputSink* InSink);
+	~FSelfieWebMMuxer();
+
+	bool Begin(const vpx_codec_enc_cfg_t& Cfg);
+	bool WriteBlock(const vpx_codec_cx_pkt_t* Pkt);
+	bool Finish();
+
+	int64 GetBytesWritten() const;
+
+private:
+	ISelfieOutputSink* Sink;
+	class FSelfieMkvWriter* Writer;
+	mkvmuxer::Segment* Segment;
+	uint64 VideoTrackId;
+	vpx_rational Timebase;
+	int64 LastPtsNs;
+	bool bFailed;
+};
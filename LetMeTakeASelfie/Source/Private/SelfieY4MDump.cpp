@@ -0,0 +1,157 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieY4MDump.h"
+
+#include "SelfieYUV.h"
+
+// About a dozen 720p frames per write
+static const int32 SelfieY4MChunkBytes = 16 * 1024 * 1024;
+
+/** Writes one full chunk, runs on GThreadPool */
+class FSelfieY4MChunkWrite : public IQueuedWork
+{
+public:
+	FSelfieY4MChunkWrite(IFileHandle* InFile, const TArray<uint8>& InChunk, FThreadSafeCounter& InFailed, FEvent* InDoneEvent)
+		: File(InFile)
+		, Chunk(InChunk)
+		, Failed(InFailed)
+		, DoneEvent(InDoneEvent)
+	{
+	}
+
+	virtual void DoThreadedWork() override
+	{
+		if (!File->Write(Chunk.GetData(), Chunk.Num()))
+		{
+			Failed.Set(1);
+		}
+		Finish();
+	}
+
+	virtual void Abandon() override
+	{
+		Failed.Set(1);
+		Finish();
+	}
+
+private:
+	void Finish()
+	{
+		DoneEvent->Trigger();
+		delete this;
+	}
+
+	IFileHandle* File;
+	const TArray<uint8>& Chunk;
+	FThreadSafeCounter& Failed;
+	FEvent* DoneEvent;
+};
+
+bool FSelfieY4MSidecar::Save(const FString& Path) const
+{
+	FString Text = FString::Printf(TEXT("# LetMeTakeASelfie y4m sidecar\nversion %d\nwidth %d\nheight %d\nfps %d\nbitrate %d\ndeadline %u\nstatic_threshold %u\nstatic_block_sad %u\nmatrix %d\nfull_range %d\nframes %d\n"),
+		(int32)SidecarVersion, Width, Height, FrameRate, TargetBitrate, Deadline, StaticThreshold, StaticBlockSAD,
+		YUVFormat.Matrix == ESelfieYUVMatrix::BT709 ? 709 : 601, YUVFormat.Range == ESelfieYUVRange::Full ? 1 : 0, FrameTimes.Num());
+
+	const double FirstTime = FrameTimes.Num() > 0 ? FrameTimes[0] : 0;
+	for (int32 FrameIndex = 0; FrameIndex < FrameTimes.Num(); FrameIndex++)
+	{
+		Text += FString::Printf(TEXT("%d %.6f\n"), FrameIndex, FrameTimes[FrameIndex] - FirstTime);
+	}
+
+	return FFileHelper::SaveStringToFile(Text, *Path);
+}
+
+bool FSelfieY4MDump::Write(const FString& Path, const FSelfieY4MSidecar& Settings, int32 NumFrames, const FSelfieGetSourceFrame& GetFrame,
+	const FSelfieGetFrameTime& GetTime, const FSelfieEncodeProgress& Progress)
+{
+	const int32 Width = Settings.Width;
+	const int32 Height = Settings.Height;
+	const FSelfieYUVFormat Format(ESelfieYUVLayout::I420, Settings.YUVFormat.Matrix, Settings.YUVFormat.Range);
+	const FSelfieYUVKernel ConvertKernel = FSelfieYUV::GetKernel(Format);
+
+	static const ANSICHAR FrameMarker[] = "FRAME\n";
+	const int32 FrameMarkerBytes = ARRAY_COUNT(FrameMarker) - 1;
+	const int32 FrameBytes = FrameMarkerBytes + FSelfieYUV::GetFrameSize(Width, Height);
+
+	IFileHandle* File = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path);
+	if (File == nullptr)
+	{
+		return false;
+	}
+
+	// Chroma is the average of each 2x2 block so it sits in the middle of it like jpeg. y4m has no way to say which matrix
+	const FString Header = FString::Printf(TEXT("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=%s\n"), Width, Height, Settings.FrameRate,
+		Format.Range == ESelfieYUVRange::Full ? TEXT("FULL") : TEXT("LIMITED"));
+
+	// Two chunk buffers, one filling while the other is on its way to disk
+	const int32 ChunkCapacity = FMath::Max(SelfieY4MChunkBytes / FrameBytes, 1) * FrameBytes + Header.Len();
+	TArray<uint8> Chunks[2];
+	int32 FillingChunk = 0;
+	for (TArray<uint8>& Chunk : Chunks)
+	{
+		Chunk.Empty(ChunkCapacity);
+	}
+
+	FThreadSafeCounter Failed;
+	FEvent* WriteDoneEvent = FPlatformProcess::CreateSynchEvent();
+	bool bWriteInFlight = false;
+
+	FSelfieY4MSidecar Sidecar = Settings;
+	Sidecar.FrameTimes.Empty(NumFrames);
+
+	Chunks[0].Append((const uint8*)TCHAR_TO_ANSI(*Header), Header.Len());
+
+	bool bCancelled = false;
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames && Failed.GetValue() == 0; FrameIndex++)
+	{
+		TArray<uint8>& Chunk = Chunks[FillingChunk];
+		const int32 FrameOffset = Chunk.Num();
+		Chunk.AddUninitialized(FrameBytes);
+
+		FMemory::Memcpy(Chunk.GetData() + FrameOffset, FrameMarker, FrameMarkerBytes);
+		ConvertKernel(GetFrame.Execute(FrameIndex), Width, Width, Height, FSelfieYUV::GetPackedPlanes(Format, Chunk.GetData() + FrameOffset + FrameMarkerBytes, Width, Height));
+
+		Sidecar.FrameTimes.Add(GetTime.IsBound() ? GetTime.Execute(FrameIndex) : (double)FrameIndex / Settings.FrameRate);
+
+		const bool bLastFrame = FrameIndex == NumFrames - 1;
+		if (Chunk.GetSlack() < FrameBytes || bLastFrame)
+		{
+			// Only ever one write in flight so the file sees them in order
+			if (bWriteInFlight)
+			{
+				WriteDoneEvent->Wait();
+			}
+			Chunks[1 - FillingChunk].Empty(ChunkCapacity);
+
+			GThreadPool->AddQueuedWork(new FSelfieY4MChunkWrite(File, Chunk, Failed, WriteDoneEvent));
+			bWriteInFlight = true;
+			FillingChunk = 1 - FillingChunk;
+		}
+
+		if (Progress.IsBound() && !Progress.Execute(FrameIndex + 1))
+		{
+			bCancelled = true;
+			break;
+		}
+	}
+
+	if (bWriteInFlight)
+	{
+		WriteDoneEvent->Wait();
+	}
+	delete WriteDoneEvent;
+	delete File;
+
+	const FString SidecarPath = FSelfieY4MSidecar::GetPath(Path);
+	const bool bSuccess = !bCancelled && Failed.GetValue() == 0 && Sidecar.Save(SidecarPath);
+	if (!bSuccess)
+	{
+		// Half a dump or one without its sidecar can't be encoded
+		IFileManager::Get().Delete(*Path);
+		IFileManager::Get().Delete(*SidecarPath);
+	}
+
+	return bSuccess;
+}
@@ -0,0 +1,52 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieEncodePipeline.h"
+#include "SelfieYUV.h"
+
+/** Capture time of a frame index in seconds, any origin */
+DECLARE_DELEGATE_RetVal_OneParam(double, FSelfieGetFrameTime, int32);
+
+/**
+ * Everything besides the pixels that an out of process encoder needs to make the same clip WriteWebM would, saved as
+ * a text file next to the .y4m. Key value lines, then "frames N" and one "index seconds" line per frame with capture
+ * times relative to the first frame. Tools/SelfieY4MEncode reads it back.
+ */
+struct FSelfieY4MSidecar
+{
+	enum { SidecarVersion = 1 };
+
+	int32 Width;
+	int32 Height;
+	int32 FrameRate;
+	/** kbps, from FSelfieEncodePipeline::InitConfig */
+	int32 TargetBitrate;
+	uint32 Deadline;
+	/** VP8E_SET_STATIC_THRESHOLD */
+	uint32 StaticThreshold;
+	/** Per 16x16 BGRA block, 0 if the save wouldn't have used active maps, see FSelfieStaticRegions */
+	uint32 StaticBlockSAD;
+	/** Matrix and range of the pixels in the dump, layout is always I420 */
+	FSelfieYUVFormat YUVFormat;
+
+	TArray<double> FrameTimes;
+
+	static FString GetPath(const FString& Y4MPath) { return FPaths::GetPath(Y4MPath) / FPaths::GetBaseFilename(Y4MPath) + TEXT(".txt"); }
+
+	bool Save(const FString& Path) const;
+};
+
+/**
+ * Ring as an I420 .y4m for encoding somewhere else, so the client does a colour conversion and a file write and
+ * nothing more.
+ *
+ * Frames are converted into a big chunk buffer and each full chunk goes to disk in one write on GThreadPool while the
+ * next one fills, so the disk sees a few large sequential writes instead of one per plane. Conversion is the same
+ * FSelfieYUV kernel the encode pipeline uses, so the pixels match what WriteWebM would have fed libvpx.
+ */
+struct FSelfieY4MDump
+{
+	/** Sidecar frame times are filled in from GetTime. Progress can cancel, the partial files are deleted then */
+	static bool Write(const FString& Path, const FSelfieY4MSidecar& Settings, int32 NumFrames, const FSelfieGetSourceFrame& GetFrame,
+		const FSelfieGetFrameTime& GetTime, const FSelfieEncodeProgress& Progress = FSelfieEncodeProgress());
+};
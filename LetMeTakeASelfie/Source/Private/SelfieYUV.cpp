@@ -0,0 +1,373 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieYUV.h"
+
+#include <immintrin.h>
+#if PLATFORM_WINDOWS
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// MSVC lets any function use any intrinsic, other compilers need telling per function
+#if defined(__GNUC__) || defined(__clang__)
+#define SELFIE_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define SELFIE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SELFIE_TARGET_SSE4
+#define SELFIE_TARGET_AVX2
+#endif
+
+/**
+ * Q14 coefficients, luma per pixel and chroma per sum of a 2x2 block. Luma rows add up to the range's scale and chroma
+ * rows to zero, green takes up the rounding
+ */
+template<int Matrix, int Range> struct TSelfieYUVCoefficients;
+
+template<> struct TSelfieYUVCoefficients<ESelfieYUVMatrix::BT601, ESelfieYUVRange::Limited>
+{
+	enum { YR = 4207, YG = 8260, YB = 1604, YOffset = 16, UR = -2428, UG = -4768, UB = 7196, VR = 7196, VG = -6026, VB = -1170 };
+};
+
+template<> struct TSelfieYUVCoefficients<ESelfieYUVMatrix::BT601, ESelfieYUVRange::Full>
+{
+	enum { YR = 4899, YG = 9617, YB = 1868, YOffset = 0, UR = -2765, UG = -5427, UB = 8192, VR = 8192, VG = -6860, VB = -1332 };
+};
+
+template<> struct TSelfieYUVCoefficients<ESelfieYUVMatrix::BT709, ESelfieYUVRange::Limited>
+{
+	enum { YR = 2991, YG = 10064, YB = 1016, YOffset = 16, UR = -1649, UG = -5547, UB = 7196, VR = 7196, VG = -6536, VB = -660 };
+};
+
+template<> struct TSelfieYUVCoefficients<ESelfieYUVMatrix::BT709, ESelfieYUVRange::Full>
+{
+	enum { YR = 3483, YG = 11718, YB = 1183, YOffset = 0, UR = -1877, UG = -6315, UB = 8192, VR = 8192, VG = -7441, VB = -751 };
+};
+
+template<int Layout, int Matrix, int Range>
+struct TSelfieYUVKernel
+{
+	typedef TSelfieYUVCoefficients<Matrix, Range> C;
+
+	enum
+	{
+		LumaRound = (C::YOffset << 14) + (1 << 13),
+		// Chroma sums are four pixels, so two more bits to shift off
+		ChromaRound = (128 << 16) + (1 << 15),
+	};
+
+	static FORCEINLINE uint8 Luma(const FColor& Pixel)
+	{
+		return (uint8)((C::YR * Pixel.R + C::YG * Pixel.G + C::YB * Pixel.B + LumaRound) >> 14);
+	}
+
+	static FORCEINLINE uint8 Chroma(int32 R, int32 G, int32 B, int32 CR, int32 CG, int32 CB)
+	{
+		return (uint8)FMath::Clamp((CR * R + CG * G + CB * B + ChromaRound) >> 16, 0, 255);
+	}
+
+	/** Columns [StartX, Width) of a pair of rows, StartX even. Row1 and Y1 are Row0 and Y0 again for an odd last row */
+	static void RowPairScalar(const FColor* Row0, const FColor* Row1, int32 StartX, int32 Width, uint8* Y0, uint8* Y1, uint8* U, uint8* V)
+	{
+		for (int32 x = StartX; x < Width; x += 2)
+		{
+			const int32 x1 = FMath::Min(x + 1, Width - 1);
+			Y0[x] = Luma(Row0[x]);
+			Y1[x] = Luma(Row1[x]);
+			Y0[x1] = Luma(Row0[x1]);
+			Y1[x1] = Luma(Row1[x1]);
+
+			const int32 R = Row0[x].R + Row0[x1].R + Row1[x].R + Row1[x1].R;
+			const int32 G = Row0[x].G + Row0[x1].G + Row1[x].G + Row1[x1].G;
+			const int32 B = Row0[x].B + Row0[x1].B + Row1[x].B + Row1[x1].B;
+			const uint8 ChromaU = Chroma(R, G, B, C::UR, C::UG, C::UB);
+			const uint8 ChromaV = Chroma(R, G, B, C::VR, C::VG, C::VB);
+			if (Layout == ESelfieYUVLayout::I420)
+			{
+				U[x / 2] = ChromaU;
+				V[x / 2] = ChromaV;
+			}
+			else
+			{
+				U[x] = ChromaU;
+				U[x + 1] = ChromaV;
+			}
+		}
+	}
+
+	/** Four BGRA pixels to four unshifted luma sums */
+	static FORCEINLINE SELFIE_TARGET_SSE4 __m128i LumaSums4(__m128i Pixels, __m128i Coefficients)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+		return _mm_hadd_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(Pixels, Zero), Coefficients), _mm_madd_epi16(_mm_unpackhi_epi8(Pixels, Zero), Coefficients));
+	}
+
+	/** Eight pixels at a time, returns where the scalar tail should pick up */
+	static SELFIE_TARGET_SSE4 int32 RowPairSSE4(const FColor* Row0, const FColor* Row1, int32 Width, uint8* Y0, uint8* Y1, uint8* U, uint8* V)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i CoefY = _mm_setr_epi16(C::YB, C::YG, C::YR, 0, C::YB, C::YG, C::YR, 0);
+		const __m128i CoefU = _mm_setr_epi16(C::UB, C::UG, C::UR, 0, C::UB, C::UG, C::UR, 0);
+		const __m128i CoefV = _mm_setr_epi16(C::VB, C::VG, C::VR, 0, C::VB, C::VG, C::VR, 0);
+		const __m128i RoundY = _mm_set1_epi32(LumaRound);
+		const __m128i RoundC = _mm_set1_epi32(ChromaRound);
+
+		const int32 EndX = Width & ~7;
+		for (int32 x = 0; x < EndX; x += 8)
+		{
+			const __m128i A = _mm_loadu_si128((const __m128i*)(Row0 + x));
+			const __m128i B = _mm_loadu_si128((const __m128i*)(Row0 + x + 4));
+			const __m128i CC = _mm_loadu_si128((const __m128i*)(Row1 + x));
+			const __m128i D = _mm_loadu_si128((const __m128i*)(Row1 + x + 4));
+
+			// Luma, 8 per row
+			__m128i Luma0 = _mm_packus_epi32(_mm_srai_epi32(_mm_add_epi32(LumaSums4(A, CoefY), RoundY), 14), _mm_srai_epi32(_mm_add_epi32(LumaSums4(B, CoefY), RoundY), 14));
+			__m128i Luma1 = _mm_packus_epi32(_mm_srai_epi32(_mm_add_epi32(LumaSums4(CC, CoefY), RoundY), 14), _mm_srai_epi32(_mm_add_epi32(LumaSums4(D, CoefY), RoundY), 14));
+			_mm_storel_epi64((__m128i*)(Y0 + x), _mm_packus_epi16(Luma0, Luma0));
+			_mm_storel_epi64((__m128i*)(Y1 + x), _mm_packus_epi16(Luma1, Luma1));
+
+			// Vertical sums of pixel pairs in 16 bits, then madd and two horizontal adds sum each 2x2 block
+			const __m128i S01 = _mm_add_epi16(_mm_unpacklo_epi8(A, Zero), _mm_unpacklo_epi8(CC, Zero));
+			const __m128i S23 = _mm_add_epi16(_mm_unpackhi_epi8(A, Zero), _mm_unpackhi_epi8(CC, Zero));
+			const __m128i S45 = _mm_add_epi16(_mm_unpacklo_epi8(B, Zero), _mm_unpacklo_epi8(D, Zero));
+			const __m128i S67 = _mm_add_epi16(_mm_unpackhi_epi8(B, Zero), _mm_unpackhi_epi8(D, Zero));
+			__m128i SumU = _mm_hadd_epi32(_mm_hadd_epi32(_mm_madd_epi16(S01, CoefU), _mm_madd_epi16(S23, CoefU)), _mm_hadd_epi32(_mm_madd_epi16(S45, CoefU), _mm_madd_epi16(S67, CoefU)));
+			__m128i SumV = _mm_hadd_epi32(_mm_hadd_epi32(_mm_madd_epi16(S01, CoefV), _mm_madd_epi16(S23, CoefV)), _mm_hadd_epi32(_mm_madd_epi16(S45, CoefV), _mm_madd_epi16(S67, CoefV)));
+			SumU = _mm_srai_epi32(_mm_add_epi32(SumU, RoundC), 16);
+			SumV = _mm_srai_epi32(_mm_add_epi32(SumV, RoundC), 16);
+
+			// u0-3 v0-3 as 16 bits, saturating the same as the scalar clamp
+			const __m128i UV = _mm_packus_epi32(SumU, SumV);
+			if (Layout == ESelfieYUVLayout::I420)
+			{
+				const __m128i UV8 = _mm_packus_epi16(UV, Zero);
+				const int32 ChromaU = _mm_cvtsi128_si32(UV8);
+				const int32 ChromaV = _mm_cvtsi128_si32(_mm_srli_si128(UV8, 4));
+				FMemory::Memcpy(U + x / 2, &ChromaU, 4);
+				FMemory::Memcpy(V + x / 2, &ChromaV, 4);
+			}
+			else
+			{
+				const __m128i Interleaved = _mm_unpacklo_epi16(UV, _mm_srli_si128(UV, 8));
+				_mm_storel_epi64((__m128i*)(U + x), _mm_packus_epi16(Interleaved, Interleaved));
+			}
+		}
+		return EndX;
+	}
+
+	/** Eight BGRA pixels to eight unshifted luma sums, in order */
+	static FORCEINLINE SELFIE_TARGET_AVX2 __m256i PixelSums8(__m256i Pixels, __m256i Coefficients)
+	{
+		// Unpacks work within each 128 bit lane, the horizontal add puts the pixels back in order
+		const __m256i Zero = _mm256_setzero_si256();
+		return _mm256_hadd_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi8(Pixels, Zero), Coefficients), _mm256_madd_epi16(_mm256_unpackhi_epi8(Pixels, Zero), Coefficients));
+	}
+
+	static FORCEINLINE SELFIE_TARGET_AVX2 __m128i PackLuma16(__m256i Sums0, __m256i Sums1, __m256i Round)
+	{
+		const __m256i Luma16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_srai_epi32(_mm256_add_epi32(Sums0, Round), 14), _mm256_srai_epi32(_mm256_add_epi32(Sums1, Round), 14)), _MM_SHUFFLE(3, 1, 2, 0));
+		return _mm_packus_epi16(_mm256_castsi256_si128(Luma16), _mm256_extracti128_si256(Luma16, 1));
+	}
+
+	/** Sums for the 2x2 blocks of sixteen columns, eight chroma samples in order, shifted but not saturated */
+	static FORCEINLINE SELFIE_TARGET_AVX2 __m128i ChromaSamples8(__m256i SLoA, __m256i SHiA, __m256i SLoB, __m256i SHiB, __m256i Coefficients, __m256i Round)
+	{
+		const __m256i PixelsA = _mm256_hadd_epi32(_mm256_madd_epi16(SLoA, Coefficients), _mm256_madd_epi16(SHiA, Coefficients));
+		const __m256i PixelsB = _mm256_hadd_epi32(_mm256_madd_epi16(SLoB, Coefficients), _mm256_madd_epi16(SHiB, Coefficients));
+		// c0 c1 c4 c5 | c2 c3 c6 c7
+		__m256i Samples = _mm256_permutevar8x32_epi32(_mm256_hadd_epi32(PixelsA, PixelsB), _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+		Samples = _mm256_srai_epi32(_mm256_add_epi32(Samples, Round), 16);
+		return _mm_packus_epi32(_mm256_castsi256_si128(Samples), _mm256_extracti128_si256(Samples, 1));
+	}
+
+	/** Sixteen pixels at a time */
+	static SELFIE_TARGET_AVX2 int32 RowPairAVX2(const FColor* Row0, const FColor* Row1, int32 Width, uint8* Y0, uint8* Y1, uint8* U, uint8* V)
+	{
+		const __m256i Zero = _mm256_setzero_si256();
+		const __m256i CoefY = _mm256_setr_epi16(C::YB, C::YG, C::YR, 0, C::YB, C::YG, C::YR, 0, C::YB, C::YG, C::YR, 0, C::YB, C::YG, C::YR, 0);
+		const __m256i CoefU = _mm256_setr_epi16(C::UB, C::UG, C::UR, 0, C::UB, C::UG, C::UR, 0, C::UB, C::UG, C::UR, 0, C::UB, C::UG, C::UR, 0);
+		const __m256i CoefV = _mm256_setr_epi16(C::VB, C::VG, C::VR, 0, C::VB, C::VG, C::VR, 0, C::VB, C::VG, C::VR, 0, C::VB, C::VG, C::VR, 0);
+		const __m256i RoundY = _mm256_set1_epi32(LumaRound);
+		const __m256i RoundC = _mm256_set1_epi32(ChromaRound);
+
+		const int32 EndX = Width & ~15;
+		for (int32 x = 0; x < EndX; x += 16)
+		{
+			const __m256i A = _mm256_loadu_si256((const __m256i*)(Row0 + x));
+			const __m256i B = _mm256_loadu_si256((const __m256i*)(Row0 + x + 8));
+			const __m256i CC = _mm256_loadu_si256((const __m256i*)(Row1 + x));
+			const __m256i D = _mm256_loadu_si256((const __m256i*)(Row1 + x + 8));
+
+			_mm_storeu_si128((__m128i*)(Y0 + x), PackLuma16(PixelSums8(A, CoefY), PixelSums8(B, CoefY), RoundY));
+			_mm_storeu_si128((__m128i*)(Y1 + x), PackLuma16(PixelSums8(CC, CoefY), PixelSums8(D, CoefY), RoundY));
+
+			const __m256i SLoA = _mm256_add_epi16(_mm256_unpacklo_epi8(A, Zero), _mm256_unpacklo_epi8(CC, Zero));
+			const __m256i SHiA = _mm256_add_epi16(_mm256_unpackhi_epi8(A, Zero), _mm256_unpackhi_epi8(CC, Zero));
+			const __m256i SLoB = _mm256_add_epi16(_mm256_unpacklo_epi8(B, Zero), _mm256_unpacklo_epi8(D, Zero));
+			const __m256i SHiB = _mm256_add_epi16(_mm256_unpackhi_epi8(B, Zero), _mm256_unpackhi_epi8(D, Zero));
+			const __m128i ChromaU = ChromaSamples8(SLoA, SHiA, SLoB, SHiB, CoefU, RoundC);
+			const __m128i ChromaV = ChromaSamples8(SLoA, SHiA, SLoB, SHiB, CoefV, RoundC);
+
+			if (Layout == ESelfieYUVLayout::I420)
+			{
+				const __m128i UV8 = _mm_packus_epi16(ChromaU, ChromaV);
+				_mm_storel_epi64((__m128i*)(U + x / 2), UV8);
+				_mm_storel_epi64((__m128i*)(V + x / 2), _mm_srli_si128(UV8, 8));
+			}
+			else
+			{
+				_mm_storeu_si128((__m128i*)(U + x), _mm_packus_epi16(_mm_unpacklo_epi16(ChromaU, ChromaV), _mm_unpackhi_epi16(ChromaU, ChromaV)));
+			}
+		}
+
+		// The scalar tail and whoever called us next may well be SSE
+		_mm256_zeroupper();
+		return EndX;
+	}
+
+	template<int SIMD>
+	static void Convert(const FColor* Src, int32 SrcStride, int32 Width, int32 Height, const FSelfieYUVPlanes& Dst)
+	{
+		for (int32 y = 0; y < Height; y += 2)
+		{
+			const bool bPair = y + 1 < Height;
+			const FColor* Row0 = Src + y * SrcStride;
+			const FColor* Row1 = bPair ? Row0 + SrcStride : Row0;
+			uint8* Y0 = Dst.Y + y * Dst.YStride;
+			uint8* Y1 = bPair ? Y0 + Dst.YStride : Y0;
+			uint8* U = Dst.U + (y / 2) * Dst.UStride;
+			uint8* V = Layout == ESelfieYUVLayout::I420 ? Dst.V + (y / 2) * Dst.VStride : nullptr;
+
+			int32 x = 0;
+			if (SIMD == ESelfieSIMD::AVX2)
+			{
+				x = RowPairAVX2(Row0, Row1, Width, Y0, Y1, U, V);
+			}
+			else if (SIMD == ESelfieSIMD::SSE4)
+			{
+				x = RowPairSSE4(Row0, Row1, Width, Y0, Y1, U, V);
+			}
+			RowPairScalar(Row0, Row1, x, Width, Y0, Y1, U, V);
+		}
+	}
+};
+
+// Indexed by layout, matrix, range and SIMD level, in enum order
+#define SELFIE_YUV_KERNELS(Layout, Matrix, Range) \
+	&TSelfieYUVKernel<Layout, Matrix, Range>::Convert<ESelfieSIMD::Scalar>, \
+	&TSelfieYUVKernel<Layout, Matrix, Range>::Convert<ESelfieSIMD::SSE4>, \
+	&TSelfieYUVKernel<Layout, Matrix, Range>::Convert<ESelfieSIMD::AVX2>
+
+static const FSelfieYUVKernel GSelfieYUVKernels[2][2][2][3] =
+{
+	{
+		{ { SELFIE_YUV_KERNELS(ESelfieYUVLayout::I420, ESelfieYUVMatrix::BT601, ESelfieYUVRange::Limited) }, { SELFIE_YUV_KERNELS(ESelfieYUVLayout::I420, ESelfieYUVMatrix::BT601, ESelfieYUVRange::Full) } },
+		{ { SELFIE_YUV_KERNELS(ESelfieYUVLayout::I420, ESelfieYUVMatrix::BT709, ESelfieYUVRange::Limited) }, { SELFIE_YUV_KERNELS(ESelfieYUVLayout::I420, ESelfieYUVMatrix::BT709, ESelfieYUVRange::Full) } },
+	},
+	{
+		{ { SELFIE_YUV_KERNELS(ESelfieYUVLayout::NV12, ESelfieYUVMatrix::BT601, ESelfieYUVRange::Limited) }, { SELFIE_YUV_KERNELS(ESelfieYUVLayout::NV12, ESelfieYUVMatrix::BT601, ESelfieYUVRange::Full) } },
+		{ { SELFIE_YUV_KERNELS(ESelfieYUVLayout::NV12, ESelfieYUVMatrix::BT709, ESelfieYUVRange::Limited) }, { SELFIE_YUV_KERNELS(ESelfieYUVLayout::NV12, ESelfieYUVMatrix::BT709, ESelfieYUVRange::Full) } },
+	},
+};
+
+#undef SELFIE_YUV_KERNELS
+
+static void SelfieCpuId(int32 Leaf, int32 SubLeaf, uint32 OutRegisters[4])
+{
+#if PLATFORM_WINDOWS
+	__cpuidex((int*)OutRegisters, Leaf, SubLeaf);
+#else
+	__cpuid_count(Leaf, SubLeaf, OutRegisters[0], OutRegisters[1], OutRegisters[2], OutRegisters[3]);
+#endif
+}
+
+static ESelfieSIMD::Type DetectSelfieSIMD()
+{
+	uint32 Registers[4];
+	SelfieCpuId(0, 0, Registers);
+	const uint32 MaxLeaf = Registers[0];
+
+	SelfieCpuId(1, 0, Registers);
+	const bool bSSE41 = (Registers[2] & (1 << 19)) != 0;
+	const bool bSSSE3 = (Registers[2] & (1 << 9)) != 0;
+	if (!bSSE41 || !bSSSE3)
+	{
+		return ESelfieSIMD::Scalar;
+	}
+
+	// AVX2 also needs the OS to save the upper halves of the registers
+	const bool bOSXSAVE = (Registers[2] & (1 << 27)) != 0;
+	const bool bAVX = (Registers[2] & (1 << 28)) != 0;
+	if (!bOSXSAVE || !bAVX || MaxLeaf < 7)
+	{
+		return ESelfieSIMD::SSE4;
+	}
+#if PLATFORM_WINDOWS
+	const uint64 XCR0 = _xgetbv(0);
+#else
+	uint32 XCR0Lo = 0;
+	uint32 XCR0Hi = 0;
+	__asm__("xgetbv" : "=a"(XCR0Lo), "=d"(XCR0Hi) : "c"(0));
+	const uint64 XCR0 = ((uint64)XCR0Hi << 32) | XCR0Lo;
+#endif
+	if ((XCR0 & 6) != 6)
+	{
+		return ESelfieSIMD::SSE4;
+	}
+
+	SelfieCpuId(7, 0, Registers);
+	return (Registers[1] & (1 << 5)) != 0 ? ESelfieSIMD::AVX2 : ESelfieSIMD::SSE4;
+}
+
+ESelfieSIMD::Type FSelfieYUV::GetBestSIMD()
+{
+	static const ESelfieSIMD::Type Best = DetectSelfieSIMD();
+	return Best;
+}
+
+const TCHAR* FSelfieYUV::GetSIMDName(ESelfieSIMD::Type SIMD)
+{
+	switch (SIMD)
+	{
+	case ESelfieSIMD::AVX2: return TEXT("AVX2");
+	case ESelfieSIMD::SSE4: return TEXT("SSE4");
+	default: return TEXT("scalar");
+	}
+}
+
+FSelfieYUVKernel FSelfieYUV::GetKernel(const FSelfieYUVFormat& Format, ESelfieSIMD::Type SIMD)
+{
+	SIMD = (ESelfieSIMD::Type)FMath::Min<int32>(SIMD, GetBestSIMD());
+	return GSelfieYUVKernels[Format.Layout][Format.Matrix][Format.Range][SIMD];
+}
+
+FSelfieYUVPlanes FSelfieYUV::GetPackedPlanes(const FSelfieYUVFormat& Format, uint8* Buffer, int32 Width, int32 Height)
+{
+	const int32 ChromaWidth = (Width + 1) / 2;
+	const int32 ChromaHeight = (Height + 1) / 2;
+
+	FSelfieYUVPlanes Planes;
+	Planes.Y = Buffer;
+	Planes.YStride = Width;
+	Planes.U = Buffer + Width * Height;
+	if (Format.Layout == ESelfieYUVLayout::I420)
+	{
+		Planes.UStride = ChromaWidth;
+		Planes.V = Planes.U + ChromaWidth * ChromaHeight;
+		Planes.VStride = ChromaWidth;
+	}
+	else
+	{
+		Planes.UStride = ChromaWidth * 2;
+		Planes.V = nullptr;
+		Planes.VStride = 0;
+	}
+	return Planes;
+}
+
+FString FSelfieYUVFormat::ToString() const
+{
+	return FString::Printf(TEXT("%s BT.%s %s range"), Layout == ESelfieYUVLayout::I420 ? TEXT("I420") : TEXT("NV12"),
+		Matrix == ESelfieYUVMatrix::BT601 ? TEXT("601") : TEXT("709"), Range == ESelfieYUVRange::Limited ? TEXT("limited") : TEXT("full"));
+}
@@ -0,0 +1,104 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+namespace ESelfieYUVLayout
+{
+	enum Type
+	{
+		/** Y, U and V planes */
+		I420,
+		/** Y plane then one plane of interleaved U and V */
+		NV12,
+	};
+}
+
+namespace ESelfieYUVMatrix
+{
+	enum Type
+	{
+		BT601,
+		BT709,
+	};
+}
+
+namespace ESelfieYUVRange
+{
+	enum Type
+	{
+		/** 16-235 luma, 16-240 chroma */
+		Limited,
+		Full,
+	};
+}
+
+namespace ESelfieSIMD
+{
+	enum Type
+	{
+		Scalar,
+		SSE4,
+		AVX2,
+	};
+}
+
+struct FSelfieYUVFormat
+{
+	ESelfieYUVLayout::Type Layout;
+	ESelfieYUVMatrix::Type Matrix;
+	ESelfieYUVRange::Type Range;
+
+	/** What libyuv::ARGBToI420 made and what VP8 decoders assume */
+	FSelfieYUVFormat()
+		: Layout(ESelfieYUVLayout::I420)
+		, Matrix(ESelfieYUVMatrix::BT601)
+		, Range(ESelfieYUVRange::Limited)
+	{
+	}
+
+	FSelfieYUVFormat(ESelfieYUVLayout::Type InLayout, ESelfieYUVMatrix::Type InMatrix, ESelfieYUVRange::Type InRange)
+		: Layout(InLayout)
+		, Matrix(InMatrix)
+		, Range(InRange)
+	{
+	}
+
+	/** VP8 has no way to say it's anything but BT.601 video range, players will show anything else with the wrong colours */
+	bool IsVP8Native() const { return Matrix == ESelfieYUVMatrix::BT601 && Range == ESelfieYUVRange::Limited; }
+
+	FString ToString() const;
+};
+
+/** Output planes, NV12 writes interleaved UV to U and leaves V alone */
+struct FSelfieYUVPlanes
+{
+	uint8* Y;
+	int32 YStride;
+	uint8* U;
+	int32 UStride;
+	uint8* V;
+	int32 VStride;
+};
+
+/** Width x Height BGRA pixels with SrcStride pixels per row. Chroma is the average of each 2x2 block, edges repeat */
+typedef void (*FSelfieYUVKernel)(const FColor* Src, int32 SrcStride, int32 Width, int32 Height, const FSelfieYUVPlanes& Dst);
+
+/**
+ * BGRA to YUV colour conversion, specialised at compile time for every layout, matrix and range, and compiled for
+ * scalar, SSE4 and AVX2 with the best one the CPU has picked at run time.
+ *
+ * Every version does the same Q14 fixed point sums, so they're bit exact with each other. Luma is computed per pixel,
+ * chroma from the sum of each 2x2 block so there's only the one rounding.
+ */
+struct FSelfieYUV
+{
+	static ESelfieSIMD::Type GetBestSIMD();
+	static const TCHAR* GetSIMDName(ESelfieSIMD::Type SIMD);
+
+	/** Falls back to the best the CPU has if SIMD isn't supported */
+	static FSelfieYUVKernel GetKernel(const FSelfieYUVFormat& Format, ESelfieSIMD::Type SIMD);
+	static FSelfieYUVKernel GetKernel(const FSelfieYUVFormat& Format) { return GetKernel(Format, GetBestSIMD()); }
+
+	/** Planes for a tightly packed frame of Format in one buffer, GetFrameSize bytes */
+	static FSelfieYUVPlanes GetPackedPlanes(const FSelfieYUVFormat& Format, uint8* Buffer, int32 Width, int32 Height);
+	static int32 GetFrameSize(int32 Width, int32 Height) { return Width * Height + ((Width + 1) / 2) * ((Height + 1) / 2) * 2; }
+};
@@ -0,0 +1,196 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "LetMeTakeASelfie.h"
+#include "SelfieYUVBenchCommandlet.h"
+#include "SelfieRingDump.h"
+#include "SelfieYUV.h"
+
+#include "libyuv/convert.h"
+#include "libyuv/convert_from_argb.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogUTSelfieYUVBench, Log, All);
+
+USelfieYUVBenchCommandlet::USelfieYUVBenchCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+/** Something like a game frame, smooth gradients with a bit of noise and some flat HUD-ish blocks */
+static void MakeSyntheticFrame(int32 Width, int32 Height, int32 FrameIndex, FRandomStream& Random, TArray<FColor>& OutPixels)
+{
+	OutPixels.Empty(Width * Height);
+	OutPixels.AddUninitialized(Width * Height);
+	for (int32 y = 0; y < Height; y++)
+	{
+		for (int32 x = 0; x < Width; x++)
+		{
+			FColor& Pixel = OutPixels[y * Width + x];
+			if ((x / 64 + y / 64) % 7 == 0)
+			{
+				Pixel = FColor(255, 255, 255);
+				continue;
+			}
+			const int32 Noise = Random.RandRange(-8, 8);
+			Pixel.R = (uint8)FMath::Clamp((x + FrameIndex * 4) % 256 + Noise, 0, 255);
+			Pixel.G = (uint8)FMath::Clamp((y * 2) % 256 + Noise, 0, 255);
+			Pixel.B = (uint8)FMath::Clamp(((x + y) / 2 + FrameIndex) % 256 - Noise, 0, 255);
+			Pixel.A = 255;
+		}
+	}
+}
+
+/** Best of Passes runs over every frame, as MB/s of BGRA in */
+template<typename ConvertFunc>
+static double TimeConversion(const TArray< TArray<FColor> >& Frames, int32 Width, int32 Height, int32 Passes, ConvertFunc Convert)
+{
+	double BestSeconds = DBL_MAX;
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 FrameIndex = 0; FrameIndex < Frames.Num(); FrameIndex++)
+		{
+			Convert(FrameIndex);
+		}
+		BestSeconds = FMath::Min(BestSeconds, FPlatformTime::Seconds() - StartTime);
+	}
+	const double Megabytes = (double)Width * Height * 4 * Frames.Num() / (1024.0 * 1024.0);
+	return Megabytes / FMath::Max(BestSeconds, 1e-9);
+}
+
+static int32 MaxDifference(const TArray<uint8>& A, const TArray<uint8>& B)
+{
+	int32 MaxDiff = 0;
+	for (int32 Index = 0; Index < A.Num(); Index++)
+	{
+		MaxDiff = FMath::Max(MaxDiff, FMath::Abs((int32)A[Index] - (int32)B[Index]));
+	}
+	return MaxDiff;
+}
+
+int32 USelfieYUVBenchCommandlet::Main(const FString& Params)
+{
+	int32 Width = 1280;
+	int32 Height = 720;
+	int32 NumFrames = 30;
+	int32 Passes = 5;
+	FParse::Value(*Params, TEXT("Width="), Width);
+	FParse::Value(*Params, TEXT("Height="), Height);
+	FParse::Value(*Params, TEXT("Frames="), NumFrames);
+	FParse::Value(*Params, TEXT("Passes="), Passes);
+	Passes = FMath::Max(Passes, 1);
+
+	TArray< TArray<FColor> > Frames;
+	FString DumpPath;
+	if (FParse::Value(*Params, TEXT("Dump="), DumpPath))
+	{
+		FSelfieRingDumpHeader Header;
+		if (!FSelfieRingDump::Read(DumpPath, Header, Frames) || Header.NumFrames == 0)
+		{
+			UE_LOG(LogUTSelfieYUVBench, Error, TEXT("Couldn't read ring dump %s"), *DumpPath);
+			return 1;
+		}
+		Width = Header.Width;
+		Height = Header.Height;
+	}
+	else
+	{
+		Width = FMath::Max(Width, 1);
+		Height = FMath::Max(Height, 1);
+		FRandomStream Random(0x5e1f1e);
+		Frames.AddDefaulted(FMath::Max(NumFrames, 1));
+		for (int32 FrameIndex = 0; FrameIndex < Frames.Num(); FrameIndex++)
+		{
+			MakeSyntheticFrame(Width, Height, FrameIndex, Random, Frames[FrameIndex]);
+		}
+	}
+
+	const ESelfieSIMD::Type BestSIMD = FSelfieYUV::GetBestSIMD();
+	UE_LOG(LogUTSelfieYUVBench, Display, TEXT("%d frames of %dx%d, best of %d passes, CPU has %s"), Frames.Num(), Width, Height, Passes, FSelfieYUV::GetSIMDName(BestSIMD));
+
+	const int32 FrameSize = FSelfieYUV::GetFrameSize(Width, Height);
+	TArray<uint8> Output;
+	Output.Init(0, FrameSize);
+	TArray<uint8> Reference;
+	Reference.Init(0, FrameSize);
+
+	int32 NumMismatches = 0;
+	for (int32 Layout = 0; Layout < 2; Layout++)
+	{
+		for (int32 Matrix = 0; Matrix < 2; Matrix++)
+		{
+			for (int32 Range = 0; Range < 2; Range++)
+			{
+				const FSelfieYUVFormat Format((ESelfieYUVLayout::Type)Layout, (ESelfieYUVMatrix::Type)Matrix, (ESelfieYUVRange::Type)Range);
+				const FSelfieYUVPlanes ReferencePlanes = FSelfieYUV::GetPackedPlanes(Format, Reference.GetData(), Width, Height);
+				const FSelfieYUVPlanes OutputPlanes = FSelfieYUV::GetPackedPlanes(Format, Output.GetData(), Width, Height);
+				const FSelfieYUVKernel ScalarKernel = FSelfieYUV::GetKernel(Format, ESelfieSIMD::Scalar);
+
+				FString Line = FString::Printf(TEXT("%-28s"), *Format.ToString());
+				for (int32 SIMD = ESelfieSIMD::Scalar; SIMD <= BestSIMD; SIMD++)
+				{
+					const FSelfieYUVKernel Kernel = FSelfieYUV::GetKernel(Format, (ESelfieSIMD::Type)SIMD);
+
+					bool bExact = true;
+					for (int32 FrameIndex = 0; FrameIndex < Frames.Num() && bExact; FrameIndex++)
+					{
+						ScalarKernel(Frames[FrameIndex].GetData(), Width, Width, Height, ReferencePlanes);
+						Kernel(Frames[FrameIndex].GetData(), Width, Width, Height, OutputPlanes);
+						bExact = FMemory::Memcmp(Output.GetData(), Reference.GetData(), FrameSize) == 0;
+					}
+					if (!bExact)
+					{
+						NumMismatches++;
+					}
+
+					const double MBps = TimeConversion(Frames, Width, Height, Passes, [&](int32 FrameIndex)
+					{
+						Kernel(Frames[FrameIndex].GetData(), Width, Width, Height, OutputPlanes);
+					});
+					Line += FString::Printf(TEXT("  %s %7.0f MB/s%s"), FSelfieYUV::GetSIMDName((ESelfieSIMD::Type)SIMD), MBps, bExact ? TEXT("") : TEXT(" MISMATCH"));
+				}
+				UE_LOG(LogUTSelfieYUVBench, Display, TEXT("%s"), *Line);
+			}
+		}
+	}
+
+	// libyuv doesn't do 709 or full range, so only the VP8 format has something to race. Differences are on the last frame
+	const TArray<FColor>& LastFrame = Frames.Last();
+	TArray<uint8> ScalarVP8[2];
+	for (int32 Layout = 0; Layout < 2; Layout++)
+	{
+		const FSelfieYUVFormat Format((ESelfieYUVLayout::Type)Layout, ESelfieYUVMatrix::BT601, ESelfieYUVRange::Limited);
+		ScalarVP8[Layout].Init(0, FrameSize);
+		FSelfieYUV::GetKernel(Format, ESelfieSIMD::Scalar)(LastFrame.GetData(), Width, Width, Height, FSelfieYUV::GetPackedPlanes(Format, ScalarVP8[Layout].GetData(), Width, Height));
+	}
+
+	const int32 ChromaWidth = (Width + 1) / 2;
+	const int32 ChromaHeight = (Height + 1) / 2;
+	uint8* Y = Output.GetData();
+	uint8* U = Y + Width * Height;
+	uint8* V = U + ChromaWidth * ChromaHeight;
+
+	const double I420MBps = TimeConversion(Frames, Width, Height, Passes, [&](int32 FrameIndex)
+	{
+		libyuv::ARGBToI420((const uint8*)Frames[FrameIndex].GetData(), Width * 4, Y, Width, U, ChromaWidth, V, ChromaWidth, Width, Height);
+	});
+	const int32 I420Diff = MaxDifference(Output, ScalarVP8[ESelfieYUVLayout::I420]);
+	UE_LOG(LogUTSelfieYUVBench, Display, TEXT("libyuv ARGBToI420 %7.0f MB/s, max difference %d"), I420MBps, I420Diff);
+
+	const double NV12MBps = TimeConversion(Frames, Width, Height, Passes, [&](int32 FrameIndex)
+	{
+		libyuv::ARGBToNV12((const uint8*)Frames[FrameIndex].GetData(), Width * 4, Y, Width, U, ChromaWidth * 2, Width, Height);
+	});
+	const int32 NV12Diff = MaxDifference(Output, ScalarVP8[ESelfieYUVLayout::NV12]);
+	UE_LOG(LogUTSelfieYUVBench, Display, TEXT("libyuv ARGBToNV12 %7.0f MB/s, max difference %d"), NV12MBps, NV12Diff);
+
+	if (NumMismatches > 0)
+	{
+		UE_LOG(LogUTSelfieYUVBench, Error, TEXT("%d kernels don't match scalar"), NumMismatches);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,21 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include "SelfieYUVBenchCommandlet.generated.h"
+
+/**
+ * Times every FSelfieYUV kernel against libyuv and checks each SIMD level is bit exact with the scalar one.
+ *
+ * Runs over the frames of a ring dump made with SELFIEDUMP, or synthetic ones if there isn't one. Prints MB/s of BGRA
+ * in for every layout, matrix, range and SIMD level the CPU has, then libyuv's ARGBToI420 and ARGBToNV12 with how far
+ * they are from our BT.601 video range output. Returns 1 if any kernel disagrees with scalar.
+ *
+ * UE4Editor-Cmd.exe UnrealTournament -run=SelfieYUVBench [-Dump=<file>] [-Width=1280 -Height=720 -Frames=30] [-Passes=5]
+ */
+UCLASS()
+class USelfieYUVBenchCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	virtual int32 Main(const FString& Params) override;
+};
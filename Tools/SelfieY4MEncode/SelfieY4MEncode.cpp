@@ -0,0 +1,453 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+// Encodes a LetMeTakeASelfie .y4m dump and its sidecar into the WebM the game would have written with WriteWebM.
+// Same libvpx config, static threshold, active maps and muxing as FSelfieEncodePipeline and FSelfieWebMMuxer.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "vpx/vpx_encoder.h"
+#include "vpx/vp8cx.h"
+#include "third_party/libwebm/mkvmuxer.hpp"
+#include "third_party/libwebm/mkvwriter.hpp"
+
+struct FSidecar
+{
+	int Version = 0;
+	int Width = 0;
+	int Height = 0;
+	int FrameRate = 30;
+	int TargetBitrate = 0;
+	unsigned long Deadline = VPX_DL_GOOD_QUALITY;
+	unsigned int StaticThreshold = 0;
+	unsigned int StaticBlockSAD = 0;
+	int Matrix = 601;
+	int FullRange = 0;
+	std::vector<double> FrameTimes;
+};
+
+static bool ReadSidecar(const std::string& Path, FSidecar& Sidecar)
+{
+	FILE* File = fopen(Path.c_str(), "r");
+	if (File == nullptr)
+	{
+		fprintf(stderr, "Couldn't open sidecar %s\n", Path.c_str());
+		return false;
+	}
+
+	char Line[256];
+	int NumFrames = -1;
+	while (NumFrames < 0 && fgets(Line, sizeof(Line), File))
+	{
+		char Key[64];
+		unsigned long Value = 0;
+		if (Line[0] == '#' || sscanf(Line, "%63s %lu", Key, &Value) != 2)
+		{
+			continue;
+		}
+
+		const std::string K = Key;
+		if (K == "version") Sidecar.Version = (int)Value;
+		else if (K == "width") Sidecar.Width = (int)Value;
+		else if (K == "height") Sidecar.Height = (int)Value;
+		else if (K == "fps") Sidecar.FrameRate = (int)Value;
+		else if (K == "bitrate") Sidecar.TargetBitrate = (int)Value;
+		else if (K == "deadline") Sidecar.Deadline = Value;
+		else if (K == "static_threshold") Sidecar.StaticThreshold = (unsigned int)Value;
+		else if (K == "static_block_sad") Sidecar.StaticBlockSAD = (unsigned int)Value;
+		else if (K == "matrix") Sidecar.Matrix = (int)Value;
+		else if (K == "full_range") Sidecar.FullRange = (int)Value;
+		else if (K == "frames") NumFrames = (int)Value;
+	}
+
+	for (int FrameIndex = 0; FrameIndex < NumFrames && fgets(Line, sizeof(Line), File); FrameIndex++)
+	{
+		int Index = 0;
+		double Seconds = 0;
+		if (sscanf(Line, "%d %lf", &Index, &Seconds) == 2)
+		{
+			Sidecar.FrameTimes.push_back(Seconds);
+		}
+	}
+	fclose(File);
+
+	if (Sidecar.Version != 1 || Sidecar.Width <= 0 || Sidecar.Height <= 0 || Sidecar.FrameRate <= 0 || NumFrames < 0 || (int)Sidecar.FrameTimes.size() != NumFrames)
+	{
+		fprintf(stderr, "Bad sidecar %s\n", Path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Reads the stream header and leaves File at the first FRAME */
+static bool ReadY4MHeader(FILE* File, int& Width, int& Height)
+{
+	char Header[512];
+	if (fgets(Header, sizeof(Header), File) == nullptr || strncmp(Header, "YUV4MPEG2 ", 10) != 0)
+	{
+		return false;
+	}
+
+	Width = Height = 0;
+	for (char* Token = strtok(Header + 10, " \n"); Token; Token = strtok(nullptr, " \n"))
+	{
+		if (Token[0] == 'W') Width = atoi(Token + 1);
+		else if (Token[0] == 'H') Height = atoi(Token + 1);
+		else if (Token[0] == 'C' && strncmp(Token, "C420", 4) != 0)
+		{
+			fprintf(stderr, "Only 4:2:0 dumps, got %s\n", Token);
+			return false;
+		}
+	}
+	return Width > 0 && Height > 0;
+}
+
+static bool ReadY4MFrame(FILE* File, std::vector<uint8_t>& Frame)
+{
+	// FRAME plus optional parameters we don't use
+	char Marker[128];
+	if (fgets(Marker, sizeof(Marker), File) == nullptr || strncmp(Marker, "FRAME", 5) != 0)
+	{
+		return false;
+	}
+	return fread(Frame.data(), 1, Frame.size(), File) == Frame.size();
+}
+
+/**
+ * Same idea as FSelfieStaticRegions on the luma plane. A uniform change of d in R, G and B costs 3d of BGRA SAD in the
+ * game but only about 0.86d of luma, so the game's threshold is scaled by a quarter to mark about the same blocks
+ */
+class FStaticRegions
+{
+public:
+	FStaticRegions(int InWidth, int InHeight, unsigned int InBlockSADThreshold)
+		: Width(InWidth)
+		, Height(InHeight)
+		, Cols((InWidth + 15) / 16)
+		, Rows((InHeight + 15) / 16)
+		, LumaThreshold(InBlockSADThreshold / 4)
+		, MaxStaticRun(15)
+		, ActiveBlocks(Cols * Rows, 1)
+		, StaticRun(Cols * Rows, 0)
+	{
+		ActiveMap.active_map = ActiveBlocks.data();
+		ActiveMap.rows = Rows;
+		ActiveMap.cols = Cols;
+	}
+
+	vpx_active_map_t* Analyze(const uint8_t* PreviousY, const uint8_t* CurrentY)
+	{
+		for (int BlockY = 0; BlockY < Rows; BlockY++)
+		{
+			for (int BlockX = 0; BlockX < Cols; BlockX++)
+			{
+				const int BlockIndex = BlockY * Cols + BlockX;
+				bool bStatic = false;
+				if (PreviousY && StaticRun[BlockIndex] < MaxStaticRun)
+				{
+					unsigned int Total = 0;
+					const int EndY = std::min(BlockY * 16 + 16, Height);
+					const int EndX = std::min(BlockX * 16 + 16, Width);
+					for (int y = BlockY * 16; y < EndY && Total <= LumaThreshold; y++)
+					{
+						for (int x = BlockX * 16; x < EndX; x++)
+						{
+							Total += abs((int)PreviousY[y * Width + x] - (int)CurrentY[y * Width + x]);
+						}
+					}
+					bStatic = Total <= LumaThreshold;
+				}
+				ActiveBlocks[BlockIndex] = bStatic ? 0 : 1;
+				StaticRun[BlockIndex] = bStatic ? StaticRun[BlockIndex] + 1 : 0;
+			}
+		}
+		return &ActiveMap;
+	}
+
+private:
+	int Width;
+	int Height;
+	int Cols;
+	int Rows;
+	unsigned int LumaThreshold;
+	int MaxStaticRun;
+	std::vector<unsigned char> ActiveBlocks;
+	std::vector<int> StaticRun;
+	vpx_active_map_t ActiveMap;
+};
+
+/** FSelfieWebMMuxer writing to a plain file */
+class FWebMFile
+{
+public:
+	bool Begin(const std::string& Path, const vpx_codec_enc_cfg_t& Cfg, int FrameRate)
+	{
+		Timebase = Cfg.g_timebase;
+		if (!Writer.Open(Path.c_str()) || !Segment.Init(&Writer))
+		{
+			return false;
+		}
+		Segment.set_mode(mkvmuxer::Segment::kFile);
+		Segment.OutputCues(true);
+
+		mkvmuxer::SegmentInfo* const Info = Segment.GetSegmentInfo();
+		Info->set_timecode_scale(1000000);
+		Info->set_writing_app("LetMeTakeASelfie");
+
+		VideoTrackId = Segment.AddVideoTrack(Cfg.g_w, Cfg.g_h, 1);
+		mkvmuxer::VideoTrack* const VideoTrack = static_cast<mkvmuxer::VideoTrack*>(Segment.GetTrackByNumber(VideoTrackId));
+		if (VideoTrack == nullptr)
+		{
+			return false;
+		}
+		VideoTrack->set_codec_id("V_VP8");
+		VideoTrack->set_frame_rate(FrameRate);
+		return true;
+	}
+
+	bool WriteBlock(const vpx_codec_cx_pkt_t* Pkt)
+	{
+		int64_t PtsNs = Pkt->data.frame.pts * 1000000000ll * Timebase.num / Timebase.den;
+		if (PtsNs <= LastPtsNs)
+		{
+			PtsNs = LastPtsNs + 1000000;
+		}
+		LastPtsNs = PtsNs;
+
+		const bool bKeyFrame = (Pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+		return Segment.AddFrame((const uint8_t*)Pkt->data.frame.buf, Pkt->data.frame.sz, VideoTrackId, PtsNs, bKeyFrame);
+	}
+
+	bool Finish()
+	{
+		const bool bFinalized = Segment.Finalize();
+		Writer.Close();
+		return bFinalized;
+	}
+
+private:
+	mkvmuxer::MkvWriter Writer;
+	mkvmuxer::Segment Segment;
+	uint64_t VideoTrackId = 0;
+	vpx_rational Timebase = { 1, 30 };
+	int64_t LastPtsNs = -1;
+};
+
+static bool WritePackets(vpx_codec_ctx_t& Codec, FWebMFile& WebM, int& NumPackets)
+{
+	NumPackets = 0;
+	vpx_codec_iter_t Iter = nullptr;
+	const vpx_codec_cx_pkt_t* Pkt = nullptr;
+	while ((Pkt = vpx_codec_get_cx_data(&Codec, &Iter)) != nullptr)
+	{
+		if (Pkt->kind == VPX_CODEC_CX_FRAME_PKT)
+		{
+			if (!WebM.WriteBlock(Pkt))
+			{
+				return false;
+			}
+			NumPackets++;
+		}
+	}
+	return true;
+}
+
+/**
+ * FSelfieBurstTimeline::PlanRealTime without the burst windows, which the sidecar doesn't have: keeps the first frame
+ * into each FrameInterval slot. Base rate frames go through the same test, so there's more slack for capture jitter
+ */
+static void PlanRealTime(const std::vector<double>& FrameTimes, double FrameInterval, std::vector<bool>& OutKeep)
+{
+	OutKeep.assign(FrameTimes.size(), false);
+
+	const double Slack = FrameInterval * 0.25;
+	double NextSlotTime = -1e300;
+	for (size_t FrameIndex = 0; FrameIndex < FrameTimes.size(); FrameIndex++)
+	{
+		const double Time = FrameTimes[FrameIndex];
+		if (Time >= NextSlotTime - Slack)
+		{
+			OutKeep[FrameIndex] = true;
+			NextSlotTime = std::max(NextSlotTime + FrameInterval, Time + FrameInterval - Slack);
+		}
+	}
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"Usage: SelfieY4MEncode [options] <dump.y4m>\n"
+		"  -o <file.webm>     output, defaults to the dump with .webm\n"
+		"  -s <sidecar.txt>   sidecar, defaults to the dump with .txt\n"
+		"  -t <threads>       encoder threads, default 4\n"
+		"  --vfr              every frame at its captured time, otherwise bursts are thinned to the fixed frame rate\n"
+		"  --allow-truncated  encode what's there if the dump has fewer frames than the sidecar\n");
+}
+
+int main(int argc, char** argv)
+{
+	std::string InputPath;
+	std::string OutputPath;
+	std::string SidecarPath;
+	int Threads = 4;
+	bool bVariableFrameRate = false;
+	bool bAllowTruncated = false;
+
+	for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++)
+	{
+		const std::string Arg = argv[ArgIndex];
+		if (Arg == "-o" && ArgIndex + 1 < argc) OutputPath = argv[++ArgIndex];
+		else if (Arg == "-s" && ArgIndex + 1 < argc) SidecarPath = argv[++ArgIndex];
+		else if (Arg == "-t" && ArgIndex + 1 < argc) Threads = std::max(atoi(argv[++ArgIndex]), 1);
+		else if (Arg == "--vfr") bVariableFrameRate = true;
+		else if (Arg == "--allow-truncated") bAllowTruncated = true;
+		else if (Arg[0] != '-' && InputPath.empty()) InputPath = Arg;
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+	if (InputPath.empty())
+	{
+		Usage();
+		return 1;
+	}
+
+	const size_t Dot = InputPath.find_last_of('.');
+	const std::string BasePath = Dot == std::string::npos ? InputPath : InputPath.substr(0, Dot);
+	if (OutputPath.empty()) OutputPath = BasePath + ".webm";
+	if (SidecarPath.empty()) SidecarPath = BasePath + ".txt";
+
+	FSidecar Sidecar;
+	if (!ReadSidecar(SidecarPath, Sidecar))
+	{
+		return 1;
+	}
+
+	FILE* Input = fopen(InputPath.c_str(), "rb");
+	int Width = 0;
+	int Height = 0;
+	if (Input == nullptr || !ReadY4MHeader(Input, Width, Height))
+	{
+		fprintf(stderr, "Couldn't read %s\n", InputPath.c_str());
+		return 1;
+	}
+	if (Width != Sidecar.Width || Height != Sidecar.Height)
+	{
+		fprintf(stderr, "Dump is %dx%d but the sidecar says %dx%d\n", Width, Height, Sidecar.Width, Sidecar.Height);
+		return 1;
+	}
+	if (Sidecar.Matrix != 601 || Sidecar.FullRange)
+	{
+		// VP8 can't signal anything else, players will assume BT.601 video range regardless
+		fprintf(stderr, "Warning: dump is BT.%d %s range, the clip will play with the wrong colours\n", Sidecar.Matrix, Sidecar.FullRange ? "full" : "limited");
+	}
+
+	// FSelfieEncodePipeline::InitConfig, with the bitrate the game worked out
+	vpx_codec_enc_cfg_t Cfg;
+	if (vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &Cfg, 0))
+	{
+		return 1;
+	}
+	Cfg.rc_target_bitrate = Sidecar.TargetBitrate > 0 ? Sidecar.TargetBitrate : Width * Height * Cfg.rc_target_bitrate / Cfg.g_w / Cfg.g_h;
+	Cfg.g_w = Width;
+	Cfg.g_h = Height;
+	Cfg.g_timebase.num = 1;
+	Cfg.g_timebase.den = bVariableFrameRate ? 1000 : Sidecar.FrameRate;
+	Cfg.g_threads = Threads;
+
+	vpx_codec_ctx_t Codec;
+	if (vpx_codec_enc_init(&Codec, vpx_codec_vp8_cx(), &Cfg, 0))
+	{
+		fprintf(stderr, "Couldn't start the encoder: %s\n", vpx_codec_error(&Codec));
+		return 1;
+	}
+	vpx_codec_control(&Codec, VP8E_SET_STATIC_THRESHOLD, Sidecar.StaticThreshold);
+
+	FWebMFile WebM;
+	if (!WebM.Begin(OutputPath, Cfg, Sidecar.FrameRate))
+	{
+		fprintf(stderr, "Couldn't open %s\n", OutputPath.c_str());
+		return 1;
+	}
+
+	const int ChromaWidth = (Width + 1) / 2;
+	const int ChromaHeight = (Height + 1) / 2;
+	std::vector<uint8_t> Frames[2];
+	Frames[0].resize(Width * Height + ChromaWidth * ChromaHeight * 2);
+	Frames[1].resize(Frames[0].size());
+
+	FStaticRegions StaticRegions(Width, Height, Sidecar.StaticBlockSAD);
+
+	// Fixed rate is one frame a tick, so burst frames have to go the way they do in the game's real time clip
+	const int NumFrames = (int)Sidecar.FrameTimes.size();
+	std::vector<bool> KeepFrames(NumFrames, true);
+	if (!bVariableFrameRate)
+	{
+		PlanRealTime(Sidecar.FrameTimes, 1.0 / Sidecar.FrameRate, KeepFrames);
+	}
+
+	bool bSuccess = true;
+	int NumPackets = 0;
+	int NumEncoded = 0;
+	int FrameIndex = 0;
+	for (; FrameIndex < NumFrames && bSuccess; FrameIndex++)
+	{
+		// Last encoded frame stays in the other buffer for the static regions
+		std::vector<uint8_t>& Frame = Frames[NumEncoded & 1];
+		if (!ReadY4MFrame(Input, Frame))
+		{
+			// Usually a capture that died part way, that's a failure unless asked to keep what there is
+			fprintf(stderr, "Dump ends after %d of %d frames\n", FrameIndex, NumFrames);
+			bSuccess = bAllowTruncated;
+			break;
+		}
+		if (!KeepFrames[FrameIndex])
+		{
+			continue;
+		}
+
+		vpx_image_t Image;
+		vpx_img_wrap(&Image, VPX_IMG_FMT_I420, Width, Height, 1, Frame.data());
+
+		if (Sidecar.StaticBlockSAD > 0)
+		{
+			const uint8_t* PreviousY = NumEncoded > 0 ? Frames[(NumEncoded - 1) & 1].data() : nullptr;
+			vpx_codec_control(&Codec, VP8E_SET_ACTIVEMAP, StaticRegions.Analyze(PreviousY, Frame.data()));
+		}
+
+		vpx_codec_pts_t Pts = NumEncoded;
+		unsigned long Duration = 1;
+		if (bVariableFrameRate)
+		{
+			// Milliseconds, and never two frames on the same tick
+			const double NextTime = FrameIndex + 1 < NumFrames ? Sidecar.FrameTimes[FrameIndex + 1] : Sidecar.FrameTimes[FrameIndex] + 1.0 / Sidecar.FrameRate;
+			Pts = (vpx_codec_pts_t)llround(Sidecar.FrameTimes[FrameIndex] * 1000.0);
+			Duration = (unsigned long)std::max<long long>(llround(NextTime * 1000.0) - Pts, 1);
+		}
+
+		bSuccess = vpx_codec_encode(&Codec, &Image, Pts, Duration, 0, Sidecar.Deadline) == VPX_CODEC_OK && WritePackets(Codec, WebM, NumPackets);
+		NumEncoded++;
+	}
+
+	// Flush, the encoder keeps handing back packets until it's drained
+	do
+	{
+		bSuccess = bSuccess && vpx_codec_encode(&Codec, nullptr, 0, 1, 0, Sidecar.Deadline) == VPX_CODEC_OK && WritePackets(Codec, WebM, NumPackets);
+	}
+	while (bSuccess && NumPackets > 0);
+
+	vpx_codec_destroy(&Codec);
+	fclose(Input);
+	bSuccess = WebM.Finish() && bSuccess;
+
+	printf("%s %d of %d frames to %s\n", bSuccess ? "Encoded" : "Failed after", NumEncoded, FrameIndex, OutputPath.c_str());
+	return bSuccess ? 0 : 1;
+}